@@ -0,0 +1,62 @@
+#include "ec800_at_arguments.h"
+#include <charconv>
+
+bool AtArgumentViewEC::ToInt(int& value) const {
+    if (raw.empty()) {
+        return false;
+    }
+    auto result = std::from_chars(raw.data(), raw.data() + raw.size(), value);
+    return result.ec == std::errc() && result.ptr == raw.data() + raw.size();
+}
+
+bool AtArgumentViewEC::ToDouble(double& value) const {
+    if (raw.empty()) {
+        return false;
+    }
+    auto result = std::from_chars(raw.data(), raw.data() + raw.size(), value);
+    return result.ec == std::errc() && result.ptr == raw.data() + raw.size();
+}
+
+int AtArgumentViewEC::int_value(int default_value) const {
+    int value;
+    return ToInt(value) ? value : default_value;
+}
+
+double AtArgumentViewEC::double_value(double default_value) const {
+    double value;
+    return ToDouble(value) ? value : default_value;
+}
+
+void AtArgumentListEC::Parse(std::string_view values) {
+    size_ = 0;
+    if (values.empty()) {
+        return;
+    }
+
+    size_t start = 0;
+    bool in_quotes = false;
+    for (size_t i = 0; i <= values.size(); i++) {
+        if (i < values.size()) {
+            char c = values[i];
+            if (c == '"') {
+                in_quotes = !in_quotes;
+                continue;
+            }
+            if (c != ',' || in_quotes || size_ == kMaxArguments - 1) {
+                continue;
+            }
+        }
+
+        auto item = values.substr(start, i - start);
+        auto& argument = arguments_[size_++];
+        argument.quoted = !item.empty() && item.front() == '"';
+        if (argument.quoted) {
+            item.remove_prefix(1);
+            if (!item.empty() && item.back() == '"') {
+                item.remove_suffix(1);
+            }
+        }
+        argument.raw = item;
+        start = i + 1;
+    }
+}
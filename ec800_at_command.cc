@@ -0,0 +1,66 @@
+#include "ec800_at_command.h"
+#include <esp_timer.h>
+#include <chrono>
+
+EC800AtCommand::EC800AtCommand(std::string command, int timeout_ms, AtCommandPriority priority, CompletionCallback on_complete)
+    : command_(std::move(command)), timeout_ms_(timeout_ms), priority_(priority), on_complete_(std::move(on_complete)) {
+    enqueue_time_us_ = esp_timer_get_time();
+}
+
+AtCommandResult EC800AtCommand::result() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return result_;
+}
+
+bool EC800AtCommand::Wait(int timeout_ms) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto finished = [this] { return result_ != AtCommandResult::Pending; };
+    if (timeout_ms < 0) {
+        cv_.wait(lock, finished);
+    } else if (!cv_.wait_for(lock, std::chrono::milliseconds(timeout_ms), finished)) {
+        return false;
+    }
+    return result_ == AtCommandResult::Ok;
+}
+
+void EC800AtCommand::AppendLine(std::string_view line) {
+    // The echo while ATE0 has not been applied, kept apart from the answer
+    if (echo_.empty() && line == command_) {
+        echo_ = line;
+        return;
+    }
+    response_lines_.emplace_back(line);
+}
+
+bool EC800AtCommand::Complete(AtCommandResult result, int error_code) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (result_ != AtCommandResult::Pending) {
+            return false;
+        }
+        result_ = result;
+        error_code_ = error_code;
+        complete_time_us_ = esp_timer_get_time();
+    }
+    cv_.notify_all();
+    if (on_complete_) {
+        on_complete_(*this);
+    }
+    return true;
+}
+
+void EC800AtCommand::SignalPrompt() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        prompted_ = true;
+    }
+    cv_.notify_all();
+}
+
+bool EC800AtCommand::WaitForPrompt(int timeout_ms) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this] {
+        return prompted_ || result_ != AtCommandResult::Pending;
+    });
+    return prompted_ && result_ == AtCommandResult::Pending;
+}
@@ -1,20 +1,99 @@
 #include "ec800_at_modem.h"
 #include <esp_log.h>
 #include <esp_err.h>
-#include <sstream>
-#include <iomanip>
+#include <esp_timer.h>
 #include <cstring>
+#include <algorithm>
+#include <chrono>
 
 static const char* TAG = "EC800AtModem";
 
+// Sent by the module when the peer closes a transparent connection
+static const char kNoCarrier[] = "\r\nNO CARRIER\r\n";
+static const size_t kNoCarrierLength = sizeof(kNoCarrier) - 1;
 
-static bool is_number(const std::string& s) {
+static bool is_number(std::string_view s) {
     return !s.empty() && std::all_of(s.begin(), s.end(), ::isdigit) && s.length() < 10;
 }
 
+// "AT+QIRD=<id>,1500" -> id, or EC800_URC_ANY_ID
+static int CommandConnectionId(const std::string& command) {
+    auto pos = command.find('=');
+    if (pos == std::string::npos) {
+        return EC800_URC_ANY_ID;
+    }
+    auto end = command.find_first_not_of("0123456789", pos + 1);
+    if (end == std::string::npos) {
+        end = command.size();
+    }
+    AtArgumentViewEC id{std::string_view(command).substr(pos + 1, end - pos - 1)};
+    return id.int_value(EC800_URC_ANY_ID);
+}
+
+// "AT+QIRD=0,1500" has the verb QIRD, "AT+A=1;+B?" has A and B
+static bool CommandHasVerb(const std::string& command, std::string_view verb) {
+    for (size_t pos = command.find('+'); pos != std::string::npos; pos = command.find('+', pos + 1)) {
+        size_t end = pos + 1 + verb.size();
+        if (command.compare(pos + 1, verb.size(), verb) == 0 &&
+            (end == command.size() || command[end] == '=' || command[end] == '?' || command[end] == ';')) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Basic commands (ATI, AT&V) and the identity queries answer with bare text lines, all
+// other commands with "+VERB: " lines
+static bool AnswersInText(const std::string& command) {
+    static const char* const text_verbs[] = {"CGSN", "CGMR", "CGMI", "CGMM", "CIMI", "GSN", "GMR", "GMI", "GMM", "QGMR"};
+    if (command.size() < 3 || command[2] != '+') {
+        return true;
+    }
+    return std::any_of(std::begin(text_verbs), std::end(text_verbs), [&command](const char* verb) {
+        return CommandHasVerb(command, verb);
+    });
+}
+
+// Bare text the module sends on its own; dispatched like URCs, never a response line
+static bool IsUnsolicitedText(std::string_view line) {
+    static const std::string_view texts[] = {"RDY", "APP RDY", "POWERED DOWN", "NORMAL POWER DOWN", "RING", "NO CARRIER"};
+    return std::find(std::begin(texts), std::end(texts), line) != std::end(texts);
+}
+
+// Build the legacy argument vector, only needed when EcCommandResponseCallback listeners exist
+static std::vector<AtArgumentValueEC> ToArgumentValues(const AtArgumentListEC& arguments) {
+    std::vector<AtArgumentValueEC> values;
+    values.reserve(arguments.size());
+    for (auto& item : arguments) {
+        AtArgumentValueEC argument = {};
+        if (item.quoted) {
+            argument.type = AtArgumentValueEC::Type::String;
+            argument.string_value = item.raw;
+        } else if (item.raw.find('.') != std::string_view::npos) {
+            argument.type = AtArgumentValueEC::Type::Double;
+            argument.double_value = item.double_value();
+        } else if (is_number(item.raw)) {
+            argument.type = AtArgumentValueEC::Type::Int;
+            argument.int_value = item.int_value();
+            argument.string_value = item.raw;
+        } else {
+            argument.type = AtArgumentValueEC::Type::String;
+            argument.string_value = item.raw;
+        }
+        values.push_back(std::move(argument));
+    }
+    return values;
+}
+
 EC800AtModem::EC800AtModem(int tx_pin, int rx_pin, size_t rx_buffer_size)
-    : rx_buffer_size_(rx_buffer_size), uart_num_(DEFAULT_UART_NUM), tx_pin_(tx_pin), rx_pin_(rx_pin), baud_rate_(DEFAULT_BAUD_RATE) {
+    : rx_buffer_size_(rx_buffer_size), at_channel_(EC800_CMUX_AT_DLCI, rx_buffer_size * 2), uart_num_(DEFAULT_UART_NUM), tx_pin_(tx_pin), rx_pin_(rx_pin), baud_rate_(DEFAULT_BAUD_RATE) {
     event_group_handle_ = xEventGroupCreate();
+    for (int id = 0; id < EC800_SOCKET_ID_COUNT; id++) {
+        free_connection_ids_[(int)EC800ConnectionKind::Socket].push_back(id);
+    }
+    for (int id = 0; id < EC800_MQTT_ID_COUNT; id++) {
+        free_connection_ids_[(int)EC800ConnectionKind::Mqtt].push_back(id);
+    }
 
     uart_config_t uart_config = {};
     uart_config.baud_rate = baud_rate_;
@@ -29,27 +108,45 @@ EC800AtModem::EC800AtModem(int tx_pin, int rx_pin, size_t rx_buffer_size)
 
     xTaskCreate([](void* arg) {
         auto ec800_at_modem = (EC800AtModem*)arg;
-        ec800_at_modem->EventTask();
+        ec800_at_modem->ReceiveTask();
         vTaskDelete(NULL);
-    }, "modem_event", 4096, this, 5, &event_task_handle_);
+    }, "modem_receive", AT_RECEIVE_TASK_STACK_SIZE, this, AT_RECEIVE_TASK_PRIORITY, &receive_task_handle_);
+
+    StartCommandTask(at_channel_, "modem_command");
 
     xTaskCreate([](void* arg) {
         auto ec800_at_modem = (EC800AtModem*)arg;
-        ec800_at_modem->ReceiveTask();
+        ec800_at_modem->DeferTask();
         vTaskDelete(NULL);
-    }, "modem_receive", 4096 * 2, this, 5, &receive_task_handle_);
+    }, "modem_defer", AT_DEFER_TASK_STACK_SIZE, this, AT_DEFER_TASK_PRIORITY, &defer_task_handle_);
 }
 
 EC800AtModem::~EC800AtModem() {
-    vTaskDelete(event_task_handle_);
+    if (urc_latency_probe_) {
+        gpio_isr_handler_remove((gpio_num_t)rx_pin_);
+    }
     vTaskDelete(receive_task_handle_);
+    vTaskDelete(at_channel_.command_task);
+    if (lane_channel_) {
+        vTaskDelete(lane_channel_->command_task);
+    }
+    vTaskDelete(defer_task_handle_);
     vEventGroupDelete(event_group_handle_);
     uart_driver_delete(uart_num_);
 }
 
-bool EC800AtModem::DetectBaudRate() {
+bool EC800AtModem::DetectBaudRate(int timeout_ms) {
+    int64_t deadline_us = esp_timer_get_time() + timeout_ms * 1000LL;
     // Write and Read AT command to detect the current baud rate
     std::vector<int> baud_rates = {115200, 921600, 460800, 230400, 57600, 38400, 19200, 9600};
+    {
+        // The module usually still runs at the rate the last boot left it at
+        std::lock_guard<std::mutex> lock(profile_mutex_);
+        auto cached = std::find(baud_rates.begin(), baud_rates.end(), boot_profile_.baud_rate);
+        if (cached != baud_rates.end()) {
+            std::rotate(baud_rates.begin(), cached, cached + 1);
+        }
+    }
     while (true) {
         ESP_LOGI(TAG, "Detecting baud rate...");
         for (int rate : baud_rates) {
@@ -57,37 +154,228 @@ bool EC800AtModem::DetectBaudRate() {
             if (Command("AT", 20)) {
                 ESP_LOGI(TAG, "Detected baud rate: %d", rate);
                 baud_rate_ = rate;
+                MarkStartupStage(EC800StartupStage::UartUp);
                 return true;
             }
         }
+        if (timeout_ms >= 0 && esp_timer_get_time() >= deadline_us) {
+            return false;
+        }
         vTaskDelay(pdMS_TO_TICKS(1000));
     }
     return false;
 }
 
+bool EC800AtModem::ResyncUart(int timeout_ms) {
+    int baud_rate = baud_rate_;
+    if (!DetectBaudRate(timeout_ms)) {
+        return false;
+    }
+    // A restart falls back to the rate stored in the module, which need not be ours
+    if (baud_rate_ != baud_rate && !SwitchBaudRate(baud_rate)) {
+        ESP_LOGW(TAG, "Staying at %d baud", baud_rate_.load());
+        RememberBaudRate();
+    }
+    return true;
+}
+
 bool EC800AtModem::SetBaudRate(int new_baud_rate) {
     if (!DetectBaudRate()) {
         ESP_LOGE(TAG, "Failed to detect baud rate");
         return false;
     }
-    if (new_baud_rate == baud_rate_) {
-        return true;
-    }
-    // Set new baud rate
-    if (Command(std::string("AT+IPR=") + std::to_string(new_baud_rate))) {
+    ValidateBootProfile();
+    if (new_baud_rate != baud_rate_) {
+        // Set new baud rate
+        if (!Command(std::string("AT+IPR=") + std::to_string(new_baud_rate))) {
+            ESP_LOGI(TAG, "Failed to set baud rate to %d", new_baud_rate);
+            return false;
+        }
         uart_set_baudrate(uart_num_, new_baud_rate);
         baud_rate_ = new_baud_rate;
+        AddCapability(EC800_CAPABILITY_IPR);
         ESP_LOGI(TAG, "Set baud rate to %d", new_baud_rate);
-        return true;
     }
-    ESP_LOGI(TAG, "Failed to set baud rate to %d", new_baud_rate);
+    RememberBaudRate();
+    return true;
+}
+
+// Rates tried by NegotiateBaudRate(), ascending
+static const int kNegotiationBaudRates[] = {115200, 230400, 460800, 921600};
+
+// AT+IPR, then follow on the UART and make sure the modem answers there
+bool EC800AtModem::SwitchBaudRate(int baud_rate) {
+    if (!Command(std::string("AT+IPR=") + std::to_string(baud_rate))) {
+        return false;
+    }
+    uart_set_baudrate(uart_num_, baud_rate);
+    baud_rate_ = baud_rate;
+    for (int i = 0; i < 3; i++) {
+        if (Command("AT", 100)) {
+            return true;
+        }
+    }
+    ESP_LOGW(TAG, "No answer at %d baud", baud_rate);
     return false;
 }
 
-int EC800AtModem::WaitForNetworkReady() {
-    ESP_LOGI(TAG, "Waiting for network ready...");
+// Needs ATE1. Either final result is fine, the echo is what is compared.
+EC800LinkTestResult EC800AtModem::TestLink() {
+    static const char pattern[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+    std::string line = AT_LINK_TEST_COMMAND "\"";
+    for (size_t i = 0; i < AT_LINK_TEST_PATTERN_LENGTH; i++) {
+        line.push_back(pattern[i % (sizeof(pattern) - 1)]);
+    }
+    line.push_back('"');
+
+    EC800LinkTestResult result = {baud_rate_, false, 0, 0};
+    uint32_t link_errors = link_error_count_;
+    size_t bytes = 0;
+    int64_t start_us = esp_timer_get_time();
+    for (int i = 0; i < AT_LINK_TEST_ROUNDS; i++) {
+        auto command = CommandAsync(line, 500, AtCommandPriority::Realtime);
+        command->Wait();
+        auto code = command->result();
+        if ((code != AtCommandResult::Ok && code != AtCommandResult::Error) || command->echo() != line) {
+            result.errors++;
+            continue;
+        }
+        // Command + CRLF out, the echo + CRLF back, then the result and its lines
+        bytes += (line.size() + 2) * 2 + 6;
+        for (auto& response : command->response_lines()) {
+            bytes += response.size() + 2;
+        }
+    }
+    int64_t elapsed_us = esp_timer_get_time() - start_us;
+    result.errors += link_error_count_ - link_errors;
+    result.ok = result.errors == 0;
+    if (elapsed_us > 0) {
+        result.bytes_per_second = bytes * 1000000 / elapsed_us;
+    }
+    ESP_LOGI(TAG, "Link test at %d baud: %s, %u bytes/s, %u errors", result.baud_rate, result.ok ? "ok" : "failed",
+        (unsigned)result.bytes_per_second, (unsigned)result.errors);
+    return result;
+}
+
+int EC800AtModem::NegotiateBaudRate(int max_baud_rate) {
+    if (!DetectBaudRate()) {
+        return baud_rate_;
+    }
+    {
+        std::lock_guard<std::mutex> lock(link_mutex_);
+        link_tests_.clear();
+        baud_fallback_enabled_ = false;
+    }
+
+    // The link test compares echoes
+    if (!Command("ATE1")) {
+        ESP_LOGE(TAG, "Failed to enable echo, keeping %d baud", (int)baud_rate_);
+        return baud_rate_;
+    }
+    auto result = TestLink();
+    {
+        std::lock_guard<std::mutex> lock(link_mutex_);
+        link_tests_.push_back(result);
+    }
+    if (!result.ok) {
+        Command("ATE0");
+        return baud_rate_;
+    }
+
+    int best = baud_rate_;
+    for (int rate : kNegotiationBaudRates) {
+        if (rate <= best || rate > max_baud_rate) {
+            continue;
+        }
+        bool switched = SwitchBaudRate(rate);
+        result = switched ? TestLink() : EC800LinkTestResult{rate, false, 0, 1};
+        {
+            std::lock_guard<std::mutex> lock(link_mutex_);
+            link_tests_.push_back(result);
+        }
+        if (!result.ok) {
+            // Back to the last clean rate, find the modem first if it did not follow
+            if (!switched || !SwitchBaudRate(best)) {
+                DetectBaudRate();
+                if (baud_rate_ != best) {
+                    SwitchBaudRate(best);
+                }
+            }
+            break;
+        }
+        best = rate;
+    }
     Command("ATE0");
-    Command("AT+CEREG=1", 1000);
+    ESP_LOGI(TAG, "Negotiated baud rate: %d", (int)baud_rate_);
+
+    {
+        std::lock_guard<std::mutex> lock(link_mutex_);
+        window_error_count_ = 0;
+        error_window_start_us_ = esp_timer_get_time();
+        baud_fallback_enabled_ = baud_rate_ > kNegotiationBaudRates[0];
+    }
+    RememberBaudRate();
+    return baud_rate_;
+}
+
+std::vector<EC800LinkTestResult> EC800AtModem::GetLinkTestResults() {
+    std::lock_guard<std::mutex> lock(link_mutex_);
+    return link_tests_;
+}
+
+// Framing error or corrupt payload; too many in one window step the negotiated rate down
+void EC800AtModem::RecordLinkError() {
+    link_error_count_++;
+    std::lock_guard<std::mutex> lock(link_mutex_);
+    int64_t now = esp_timer_get_time();
+    if (now - error_window_start_us_ > AT_LINK_ERROR_WINDOW_MS * 1000LL) {
+        error_window_start_us_ = now;
+        window_error_count_ = 0;
+    }
+    if (++window_error_count_ < AT_LINK_ERROR_THRESHOLD || !baud_fallback_enabled_ || baud_fallback_running_.exchange(true)) {
+        return;
+    }
+    window_error_count_ = 0;
+    // Called from the receive task, which must not block on a command
+    if (!Defer([this]() { StepDownBaudRate(); }, this)) {
+        baud_fallback_running_ = false;
+    }
+}
+
+void EC800AtModem::StepDownBaudRate() {
+    int current = baud_rate_;
+    int lower = 0;
+    for (int rate : kNegotiationBaudRates) {
+        if (rate < current) {
+            lower = rate;
+        }
+    }
+    if (lower == 0) {
+        baud_fallback_running_ = false;
+        return;
+    }
+    ESP_LOGW(TAG, "Too many link errors at %d baud, falling back to %d", current, lower);
+    if (!SwitchBaudRate(lower)) {
+        DetectBaudRate();
+    }
+    {
+        std::lock_guard<std::mutex> lock(link_mutex_);
+        baud_fallback_enabled_ = baud_rate_ > kNegotiationBaudRates[0];
+        window_error_count_ = 0;
+        error_window_start_us_ = esp_timer_get_time();
+    }
+    RememberBaudRate();
+    baud_fallback_running_ = false;
+}
+
+int EC800AtModem::WaitForNetworkReady(int timeout_ms) {
+    ESP_LOGI(TAG, "Waiting for network ready...");
+    int64_t deadline_us = esp_timer_get_time() + timeout_ms * 1000LL;
+    // ATE0, then both URC settings on one line; the queries below go out right after
+    CommandBatch({"ATE0", "AT+CEREG=1", "AT+CGEREP=2,1"}, 1000);
+    // Pick up whatever was reached before the URCs were enabled
+    CommandAsync("AT+CPIN?");
+    CommandAsync("AT+CEREG?");
     while (!network_ready_) {
         if (pin_ready_ == 2) {
             ESP_LOGE(TAG, "PIN is not ready");
@@ -97,299 +385,2288 @@ int EC800AtModem::WaitForNetworkReady() {
             ESP_LOGI(TAG, "Registration denied");
             return -2;
         }
-        // Command("AT+MIPCALL?");
-        Command("AT+CGATT?");
-        xEventGroupWaitBits(event_group_handle_, AT_EVENT_NETWORK_READY, pdTRUE, pdFALSE, pdMS_TO_TICKS(1000));
+        if (timeout_ms >= 0 && esp_timer_get_time() >= deadline_us) {
+            ESP_LOGW(TAG, "Not attached after %d ms", timeout_ms);
+            return -4;
+        }
+        auto bits = xEventGroupWaitBits(event_group_handle_, AT_EVENT_NETWORK_READY | AT_EVENT_NETWORK_STATE, pdTRUE, pdFALSE,
+            pdMS_TO_TICKS(AT_ATTACH_POLL_MS));
+        if (bits == 0) {
+            CommandAsync("AT+CGATT?");
+        }
+    }
+
+    // The context may still be up if only the host restarted
+    SetIpAddress("");
+    Command("AT+QIACT?");
+    if (ip_address().empty()) {
+        std::string apn;
+        {
+            std::lock_guard<std::mutex> lock(profile_mutex_);
+            apn = boot_profile_.apn.empty() ? DEFAULT_APN : boot_profile_.apn;
+        }
+        //配置 PDP 上下文为 1
+        if (!Command(std::string("AT+QICSGP=1,1,\"") + apn + "\",\"\",\"\",1")) {
+            ESP_LOGE(TAG, "Failed to configure PDP context, APN %s", apn.c_str());
+            return -3;
+        }
+        //激活 PDP 上下文
+        if (!Command("AT+QIACT=1", AT_PDP_ACTIVATE_TIMEOUT_MS)) {
+            ESP_LOGE(TAG, "Failed to activate PDP context");
+            return -3;
+        }
+        Command("AT+QIACT?");
     }
-    //配置 PDP 上下文为 1，APN 为中国联通的"UNINET"。
-    Command(std::string("AT+QICSGP=1,1,\"UNINET\",\"\",\"\",1"));
-    //激活 PDP 上下文
-    Command(std::string("AT+QIACT=1"));
+    SaveBootProfile();
+    LogStartupTimeline();
     return 0;
 }
 
+std::string EC800AtModem::ip_address() const {
+    std::lock_guard<std::mutex> lock(ip_mutex_);
+    return ip_address_;
+}
+
+void EC800AtModem::SetIpAddress(std::string_view address) {
+    std::lock_guard<std::mutex> lock(ip_mutex_);
+    ip_address_ = address;
+}
+
+void EC800AtModem::MarkStartupStage(EC800StartupStage stage) {
+    int64_t unset = 0;
+    startup_time_us_[(int)stage].compare_exchange_strong(unset, esp_timer_get_time());
+}
+
+EC800StartupTimeline EC800AtModem::GetStartupTimeline() const {
+    EC800StartupTimeline timeline;
+    for (int i = 0; i < EC800_STARTUP_STAGE_COUNT; i++) {
+        timeline.time_us[i] = startup_time_us_[i];
+    }
+    return timeline;
+}
+
+void EC800AtModem::LogStartupTimeline() {
+    static const char* names[EC800_STARTUP_STAGE_COUNT] = {"uart", "sim", "registered", "pdp", "ip"};
+    auto timeline = GetStartupTimeline();
+    std::string line;
+    int64_t previous_us = 0;
+    for (int i = 0; i < EC800_STARTUP_STAGE_COUNT; i++) {
+        char item[48];
+        if (timeline.time_us[i] == 0) {
+            snprintf(item, sizeof(item), " %s -", names[i]);
+        } else {
+            int64_t delta_us = previous_us == 0 ? 0 : timeline.time_us[i] - previous_us;
+            snprintf(item, sizeof(item), " %s %lld(+%lld)", names[i], (long long)(timeline.time_us[i] / 1000), (long long)(delta_us / 1000));
+            previous_us = timeline.time_us[i];
+        }
+        line += item;
+    }
+    std::string firmware;
+    {
+        std::lock_guard<std::mutex> lock(profile_mutex_);
+        firmware = boot_profile_.firmware;
+    }
+    ESP_LOGI(TAG, "Startup timeline ms:%s, firmware %s", line.c_str(), firmware.empty() ? "?" : firmware.c_str());
+}
+
+void EC800AtModem::SetBootProfileStorage(EC800BootProfileStorage* storage) {
+    EC800BootProfile profile;
+    bool loaded = storage != nullptr && storage->Load(profile);
+    std::lock_guard<std::mutex> lock(profile_mutex_);
+    profile_storage_ = storage;
+    if (loaded) {
+        ESP_LOGI(TAG, "Boot profile: baud %d, firmware %s", profile.baud_rate, profile.firmware.c_str());
+        // Anything set before the storage was attached wins
+        if (!boot_profile_.apn.empty()) {
+            profile.apn = boot_profile_.apn;
+        }
+        boot_profile_ = std::move(profile);
+    }
+    profile_dirty_ = !loaded && !boot_profile_.empty();
+}
+
+EC800BootProfile EC800AtModem::boot_profile() {
+    std::lock_guard<std::mutex> lock(profile_mutex_);
+    return boot_profile_;
+}
+
+bool EC800AtModem::SaveBootProfile() {
+    std::lock_guard<std::mutex> lock(profile_mutex_);
+    if (profile_storage_ == nullptr || !profile_dirty_) {
+        return true;
+    }
+    if (!profile_storage_->Save(boot_profile_)) {
+        return false;
+    }
+    profile_dirty_ = false;
+    return true;
+}
+
+void EC800AtModem::ClearBootProfile() {
+    std::lock_guard<std::mutex> lock(profile_mutex_);
+    boot_profile_ = EC800BootProfile();
+    profile_dirty_ = false;
+    if (profile_storage_ != nullptr) {
+        profile_storage_->Erase();
+    }
+}
+
+void EC800AtModem::SetApn(const std::string& apn) {
+    UpdateBootProfile(&EC800BootProfile::apn, apn);
+}
+
+void EC800AtModem::UpdateBootProfile(std::string EC800BootProfile::*field, const std::string& value) {
+    std::lock_guard<std::mutex> lock(profile_mutex_);
+    if (boot_profile_.*field != value) {
+        boot_profile_.*field = value;
+        profile_dirty_ = true;
+    }
+}
+
+void EC800AtModem::RememberBaudRate() {
+    {
+        std::lock_guard<std::mutex> lock(profile_mutex_);
+        if (boot_profile_.baud_rate != baud_rate_) {
+            boot_profile_.baud_rate = baud_rate_;
+            profile_dirty_ = true;
+        }
+    }
+    SaveBootProfile();
+}
+
+void EC800AtModem::AddCapability(uint32_t capability) {
+    std::lock_guard<std::mutex> lock(profile_mutex_);
+    if (!(boot_profile_.capabilities & capability)) {
+        boot_profile_.capabilities |= capability;
+        profile_dirty_ = true;
+    }
+}
+
+// Re-read the cached identity once per boot without blocking anyone. Results land in the
+// profile and are persisted by the next SaveBootProfile().
+void EC800AtModem::ValidateBootProfile() {
+    {
+        std::lock_guard<std::mutex> lock(profile_mutex_);
+        if (profile_validated_) {
+            return;
+        }
+        profile_validated_ = true;
+    }
+    CommandAsync("AT+CGSN", DEFAULT_COMMAND_TIMEOUT, AtCommandPriority::Background, [this](EC800AtCommand& command) {
+        if (command.ok() && !command.response().empty()) {
+            UpdateBootProfile(&EC800BootProfile::imei, command.response());
+        }
+    });
+    CommandAsync("AT+CGMR", DEFAULT_COMMAND_TIMEOUT, AtCommandPriority::Background, [this](EC800AtCommand& command) {
+        if (!command.ok() || command.response().empty()) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(profile_mutex_);
+        if (boot_profile_.firmware != command.response()) {
+            // Capabilities belong to the old firmware
+            boot_profile_.firmware = command.response();
+            boot_profile_.capabilities = 0;
+            profile_dirty_ = true;
+        }
+    });
+    CommandAsync("AT+QCCID", DEFAULT_COMMAND_TIMEOUT, AtCommandPriority::Background, [this](EC800AtCommand& command) {
+        if (command.ok()) {
+            UpdateBootProfile(&EC800BootProfile::iccid, iccid_);
+        } else if (command.error_code() == 10) {
+            // SIM not inserted
+            UpdateBootProfile(&EC800BootProfile::iccid, "");
+        }
+    });
+}
+
 // 获取IMEI号
 std::string EC800AtModem::GetImei() {
+    {
+        std::lock_guard<std::mutex> lock(profile_mutex_);
+        if (!boot_profile_.imei.empty()) {
+            return boot_profile_.imei;
+        }
+    }
     // 发送AT+CGSN命令
-    if (Command("AT+CGSN")) {
+    auto command = CommandAsync("AT+CGSN");
+    if (command->Wait()) {
+        UpdateBootProfile(&EC800BootProfile::imei, command->response());
+        SaveBootProfile();
         // 返回响应
-        return response_;
+        return command->response();
     }
     return "";
 }
 
 std::string EC800AtModem::GetIccid() {
-    if (Command("AT+QCCID")) {
+    {
+        std::lock_guard<std::mutex> lock(profile_mutex_);
+        if (!boot_profile_.iccid.empty()) {
+            return boot_profile_.iccid;
+        }
+    }
+    if (Command("AT+QCCID", DEFAULT_COMMAND_TIMEOUT, AtCommandPriority::Background)) {
+        UpdateBootProfile(&EC800BootProfile::iccid, iccid_);
+        SaveBootProfile();
         return iccid_;
     }
     return "";
 }
 
 std::string EC800AtModem::GetModuleName() {
-    if (Command("AT+CGMR")) {
-        return response_;
+    {
+        std::lock_guard<std::mutex> lock(profile_mutex_);
+        if (!boot_profile_.firmware.empty()) {
+            return boot_profile_.firmware;
+        }
+    }
+    auto command = CommandAsync("AT+CGMR");
+    if (command->Wait()) {
+        UpdateBootProfile(&EC800BootProfile::firmware, command->response());
+        SaveBootProfile();
+        return command->response();
     }
     return "";
 }
 
 std::string EC800AtModem::GetCarrierName() {
-    if (Command("AT+COPS?")) {
+    if (Command("AT+COPS?", DEFAULT_COMMAND_TIMEOUT, AtCommandPriority::Background)) {
         return carrier_name_;
     }
     return "";
 }
 
 int EC800AtModem::GetCsq() {
-    if (Command("AT+CSQ")) {
+    if (Command("AT+CSQ", DEFAULT_COMMAND_TIMEOUT, AtCommandPriority::Background)) {
         return csq_;
     }
     return -1;
 }
 
-void EC800AtModem::SetDebug(bool debug) {
-    debug_ = debug;
-}
-
-std::list<EcCommandResponseCallback>::iterator EC800AtModem::RegisterCommandResponseCallback(EcCommandResponseCallback callback) {
-    std::lock_guard<std::mutex> lock(mutex_ );
-    return on_data_received_.insert(on_data_received_.end(), callback);
-}
-
-void EC800AtModem::UnregisterCommandResponseCallback(std::list<EcCommandResponseCallback>::iterator iterator) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    on_data_received_.erase(iterator);
-}
-
-bool EC800AtModem::Command(const std::string command, int timeout_ms) {
-    std::lock_guard<std::mutex> lock(command_mutex_);
-    if (debug_) {
-        ESP_LOGI(TAG, ">> %.64s", command.c_str());
+std::string EC800AtModem::Resolve(const std::string& host, int timeout_ms) {
+    if (EC800DnsCache::IsAddress(host)) {
+        return host;
     }
-    response_.clear();
+    std::string address;
     {
-        std::lock_guard<std::mutex> lock(mutex_);
-        last_command_ = command + "\r\n";
-        vTaskDelay(50 / portTICK_PERIOD_MS);
-        int ret = uart_write_bytes(uart_num_, last_command_.c_str(), last_command_.length());
-        if (ret < 0) {
-            ESP_LOGE(TAG, "uart_write_bytes failed: %d", ret);
-            return false;
+        std::lock_guard<std::mutex> lock(dns_mutex_);
+        if (dns_cache_.Lookup(host, address)) {
+            return address;
         }
     }
-
-    if (timeout_ms > 0) {
-        auto bits = xEventGroupWaitBits(event_group_handle_, AT_EVENT_COMMAND_DONE | AT_EVENT_COMMAND_ERROR, pdTRUE, pdFALSE, pdMS_TO_TICKS(timeout_ms));
-        if (bits & AT_EVENT_COMMAND_DONE) {
-            return true;
-        } else if (bits & AT_EVENT_COMMAND_ERROR) {
-            ESP_LOGE(TAG, "command error: %s", command.c_str());
-            return false;
-        }
+    QueueDnsLookup(host);
+    // The answer is parsed by the receive task, it cannot wait for it
+    if (xTaskGetCurrentTaskHandle() == receive_task_handle_) {
+        return "";
     }
-    return false;
-}
-
-void EC800AtModem::EventTask() {
-    uart_event_t event;
-    while (true) {
-        if (xQueueReceive(event_queue_handle_, &event, portMAX_DELAY) == pdTRUE) {
-            switch (event.type)
-            {
-            case UART_DATA:
-                xEventGroupSetBits(event_group_handle_, AT_EVENT_DATA_AVAILABLE);
-                break;
-            case UART_BREAK:
-                ESP_LOGI(TAG, "break");
-                break;
-            case UART_BUFFER_FULL:
-                ESP_LOGE(TAG, "buffer full");
-                break;
-            case UART_FIFO_OVF:
-                ESP_LOGE(TAG, "FIFO overflow");
-                NotifyCommandResponse("FIFO_OVERFLOW", {});
-                break;
-            default:
-                ESP_LOGE(TAG, "unknown event type: %d", event.type);
-                break;
-            }
-        }
+    std::unique_lock<std::mutex> lock(dns_mutex_);
+    dns_cv_.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this, &host] {
+        return !DnsLookupPending(host);
+    });
+    if (!dns_cache_.Lookup(host, address)) {
+        ESP_LOGW(TAG, "Failed to resolve %s", host.c_str());
     }
+    return address;
 }
 
-void EC800AtModem::ReceiveTask() {
-    while (true) {
-        auto bits = xEventGroupWaitBits(event_group_handle_, AT_EVENT_DATA_AVAILABLE, pdTRUE, pdFALSE, portMAX_DELAY);
-        if (bits & AT_EVENT_DATA_AVAILABLE) {
-            size_t available;
-            uart_get_buffered_data_len(uart_num_, &available);
-            if (available > 0) {
-                // Extend rx_buffer_ and read into buffer
-                rx_buffer_.resize(rx_buffer_.size() + available);
-                char* rx_buffer_ptr = &rx_buffer_[rx_buffer_.size() - available];
-                uart_read_bytes(uart_num_, rx_buffer_ptr, available, portMAX_DELAY);
-                while (ParseResponse()) {}
-            }
+std::string EC800AtModem::ResolveCached(const std::string& host) {
+    if (EC800DnsCache::IsAddress(host)) {
+        return host;
+    }
+    {
+        std::string address;
+        std::lock_guard<std::mutex> lock(dns_mutex_);
+        if (dns_cache_.Lookup(host, address)) {
+            return address;
         }
     }
+    // Nothing to look it up with before the context is up
+    if (!ip_address().empty()) {
+        QueueDnsLookup(host);
+    }
+    return host;
 }
 
-bool EC800AtModem::ParseResponse() {
-    auto end_pos = rx_buffer_.find("\r\n");
-    if (end_pos == std::string::npos) {
-        return false;
-    }
+void EC800AtModem::InvalidateDns(const std::string& host) {
+    std::lock_guard<std::mutex> lock(dns_mutex_);
+    dns_cache_.Invalidate(host);
+}
 
-    // Ignore empty lines
-    if (end_pos == 0) {
-        rx_buffer_.erase(0, 2);
-        return true;
+void EC800AtModem::SetPreResolveHosts(std::vector<std::string> hosts) {
+    {
+        std::lock_guard<std::mutex> lock(dns_mutex_);
+        dns_pre_resolve_ = std::move(hosts);
     }
-    if (debug_) {
-        ESP_LOGI(TAG, "<< %.64s", rx_buffer_.substr(0, end_pos).c_str());
-        // print last 64 bytes before end_pos if available
-        // if (end_pos > 64) {
-        //     ESP_LOGI(TAG, "<< LAST: %.64s", rx_buffer_.c_str() + end_pos - 64);
-        // }
+    if (!ip_address().empty()) {
+        PreResolve();
     }
+}
 
-    // Parse "+CME ERROR: 123,456,789"
-    if (rx_buffer_[0] == '+') {
-        std::string command, values;
-        auto pos = rx_buffer_.find(": ");
-        if (pos == std::string::npos || pos > end_pos) {
-            command = rx_buffer_.substr(1, end_pos - 1);
-        } else {
-            command = rx_buffer_.substr(1, pos - 1);
-            values = rx_buffer_.substr(pos + 2, end_pos - pos - 2);
-        }
-        rx_buffer_.erase(0, end_pos + 2);
-
-        // Parse "string", int, int, ... into AtArgumentValueEC
-        std::vector<AtArgumentValueEC> arguments;
-        std::istringstream iss(values);
-        std::string item;
-        while (std::getline(iss, item, ',')) {
-            AtArgumentValueEC argument;
-            if (item.front() == '"') {
-                argument.type = AtArgumentValueEC::Type::String;
-                argument.string_value = item.substr(1, item.size() - 2);
-            } else if (item.find(".") != std::string::npos) {
-                argument.type = AtArgumentValueEC::Type::Double;
-                argument.double_value = std::stod(item);
-            } else if (is_number(item)) {
-                argument.type = AtArgumentValueEC::Type::Int;
-                argument.int_value = std::stoi(item);
-                argument.string_value = std::move(item);
-            } else {
-                argument.type = AtArgumentValueEC::Type::String;
-                argument.string_value = std::move(item);
+// Queue lookups for the configured hosts that are not cached, never waits
+void EC800AtModem::PreResolve() {
+    std::vector<std::string> hosts;
+    {
+        std::lock_guard<std::mutex> lock(dns_mutex_);
+        std::string address;
+        for (auto& host : dns_pre_resolve_) {
+            if (!EC800DnsCache::IsAddress(host) && !dns_cache_.Lookup(host, address)) {
+                hosts.push_back(host);
             }
-            arguments.push_back(argument);
         }
-
-        NotifyCommandResponse(command, arguments);
-        return true;
-    } else if (rx_buffer_.size() >= 4 && rx_buffer_[0] == 'O' && rx_buffer_[1] == 'K' && rx_buffer_[2] == '\r' && rx_buffer_[3] == '\n') {
-        rx_buffer_.erase(0, 4);
-        xEventGroupSetBits(event_group_handle_, AT_EVENT_COMMAND_DONE);
-        return true;
-    } else if (rx_buffer_.size() >= 1 && rx_buffer_[0] == '>') {
-        rx_buffer_.erase(0, 1);
-        xEventGroupSetBits(event_group_handle_, AT_EVENT_COMMAND_DONE);
-        return true;
-    } else if (rx_buffer_.size() >= 7 && rx_buffer_[0] == 'E' && rx_buffer_[1] == 'R' && rx_buffer_[2] == 'R' && rx_buffer_[3] == 'O' && rx_buffer_[4] == 'R' && rx_buffer_[5] == '\r' && rx_buffer_[6] == '\n') {
-        rx_buffer_.erase(0, 7);
-        xEventGroupSetBits(event_group_handle_, AT_EVENT_COMMAND_ERROR);
-        return true;
-    } else if (rx_buffer_.size() >= 9 && rx_buffer_[0] == 'C' && rx_buffer_[1] == 'O' && rx_buffer_[2] == 'N' && rx_buffer_[3] == 'N' && rx_buffer_[4] == 'E') {
-        rx_buffer_.erase(0, 9);
-        // xEventGroupSetBits(event_group_handle_, AT_EVENT_COMMAND_ERROR);
-        http_connect_flag_ = true;
-        return true;
-
-    } else {
-        response_ = rx_buffer_.substr(0, end_pos);
-        rx_buffer_.erase(0, end_pos + 2);
-        return true;
     }
-    return false;
-}
-
-void EC800AtModem::OnMaterialReady(std::function<void()> callback) {
-    on_material_ready_ = callback;
+    for (auto& host : hosts) {
+        QueueDnsLookup(host);
+    }
 }
 
-void EC800AtModem::NotifyCommandResponse(const std::string& command, const std::vector<AtArgumentValueEC>& arguments) {
-    if (command == "CME ERROR") {
-        xEventGroupSetBits(event_group_handle_, AT_EVENT_COMMAND_ERROR);
-        return;
-    }
-/*     if (command == "MIPCALL" && arguments.size() >= 3) {
-        if (arguments[1].int_value == 1) {
-            ip_address_ = arguments[2].string_value;
-            network_ready_ = true;
-            xEventGroupSetBits(event_group_handle_, AT_EVENT_NETWORK_READY);
-        }
-    } */
-    if (command == "CGATT" && arguments.size() >= 1) {
-        if( arguments[0].int_value == 1) {
-            network_ready_ = true;
-            xEventGroupSetBits(event_group_handle_, AT_EVENT_NETWORK_READY);
-        }
-    } else if (command == "QCCID" && arguments.size() >= 1) {
-        iccid_ = arguments[0].string_value;
-    } else if (command == "COPS" && arguments.size() >= 4) {
-        carrier_name_ = arguments[2].string_value;
-    } else if (command == "CSQ" && arguments.size() >= 2) {
-        csq_ = arguments[1].int_value;
-    } else if (command == "MATREADY") {
-        network_ready_ = false;
-        if (on_material_ready_) {
-            on_material_ready_();
+void EC800AtModem::QueueDnsLookup(const std::string& host) {
+    std::string next;
+    {
+        std::lock_guard<std::mutex> lock(dns_mutex_);
+        if (DnsLookupPending(host)) {
+            return;
         }
-    } else if (command == "CEREG" && arguments.size() >= 1) {
-        if (arguments.size() == 1) {
-            registration_state_ = arguments[0].int_value;
-        } else {
-            registration_state_ = arguments[1].int_value;
+        dns_queue_.push_back(host);
+        if (!dns_host_.empty() && esp_timer_get_time() > dns_deadline_us_) {
+            ESP_LOGW(TAG, "DNS lookup of %s timed out", dns_host_.c_str());
+            dns_host_.clear();
         }
-    } else if (command == "CPIN" && arguments.size() >= 1) {
-        if (arguments[0].string_value == "READY") {
-            pin_ready_ = 1;
-        } else {
-            pin_ready_ = 2;
+        if (dns_host_.empty()) {
+            next = NextDnsLookup();
         }
     }
-
-    std::lock_guard<std::mutex> lock(mutex_);
-    for (auto& callback : on_data_received_) {
-        callback(command, arguments);
+    if (!next.empty()) {
+        SendDnsLookup(next);
     }
 }
 
-static const char hex_chars[] = "0123456789ABCDEF";
-// 辅助函数，将单个十六进制字符转换为对应的数值
-inline uint8_t CharToHex(char c) {
-    if (c >= '0' && c <= '9') return c - '0';
-    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
-    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
-    return 0;  // 对于无效输入，返回0
+bool EC800AtModem::DnsLookupPending(const std::string& host) const {
+    return host == dns_host_ || std::find(dns_queue_.begin(), dns_queue_.end(), host) != dns_queue_.end();
 }
 
-void EC800AtModem::EncodeHexAppend(std::string& dest, const char* data, size_t length) {
-    dest.reserve(dest.size() + length * 2);  // 预分配空间
-    for (size_t i = 0; i < length; i++) {
-        dest.push_back(hex_chars[(data[i] & 0xF0) >> 4]);
-        dest.push_back(hex_chars[data[i] & 0x0F]);
+// Called with dns_mutex_ held once no lookup is running; the host to send, if any
+std::string EC800AtModem::NextDnsLookup() {
+    if (dns_queue_.empty()) {
+        return "";
     }
+    dns_host_ = std::move(dns_queue_.front());
+    dns_queue_.pop_front();
+    dns_addresses_.clear();
+    dns_expected_ = 0;
+    dns_ttl_s_ = 0;
+    dns_deadline_us_ = esp_timer_get_time() + AT_DNS_LOOKUP_TIMEOUT_MS * 1000LL;
+    return dns_host_;
 }
 
-void EC800AtModem::DecodeHexAppend(std::string& dest, const char* data, size_t length) {
-    dest.reserve(dest.size() + length / 2);  // 预分配空间
-    for (size_t i = 0; i < length; i += 2) {
-        char byte = (CharToHex(data[i]) << 4) | CharToHex(data[i + 1]);
-        dest.push_back(byte);
+// The answer arrives as URCs after OK, an error result means none will follow
+void EC800AtModem::SendDnsLookup(const std::string& host) {
+    CommandAsync("AT+QIDNSGIP=1,\"" + host + "\"", DEFAULT_COMMAND_TIMEOUT, AtCommandPriority::Interactive,
+        [this, host](EC800AtCommand& command) {
+            if (command.ok()) {
+                return;
+            }
+            std::string next;
+            {
+                std::lock_guard<std::mutex> lock(dns_mutex_);
+                if (dns_host_ != host) {
+                    return;
+                }
+                ESP_LOGW(TAG, "AT+QIDNSGIP for %s failed", host.c_str());
+                dns_host_.clear();
+                next = NextDnsLookup();
+            }
+            dns_cv_.notify_all();
+            if (!next.empty()) {
+                SendDnsLookup(next);
+            }
+        });
+}
+
+// +QIURC: "dnsgip",<err>,<IP_count>,<DNS_ttl>, then one +QIURC: "dnsgip","<IP>" per address
+void EC800AtModem::OnDnsResult(const AtArgumentListEC& arguments) {
+    std::string next;
+    {
+        std::lock_guard<std::mutex> lock(dns_mutex_);
+        if (dns_host_.empty()) {
+            return;
+        }
+        if (arguments[1].quoted) {
+            dns_addresses_.emplace_back(arguments[1].string_value());
+            if ((int)dns_addresses_.size() < dns_expected_) {
+                return;
+            }
+            dns_cache_.Store(dns_host_, std::move(dns_addresses_), dns_ttl_s_);
+        } else if (arguments[1].int_value(-1) == 0 && arguments.size() >= 4 && arguments[2].int_value(0) > 0) {
+            dns_expected_ = arguments[2].int_value(0);
+            dns_ttl_s_ = arguments[3].int_value(0);
+            return;
+        } else {
+            ESP_LOGW(TAG, "DNS lookup of %s failed: %d", dns_host_.c_str(), arguments[1].int_value(-1));
+        }
+        dns_host_.clear();
+        next = NextDnsLookup();
+    }
+    dns_cv_.notify_all();
+    if (!next.empty()) {
+        SendDnsLookup(next);
+    }
+}
+
+void EC800AtModem::SetDebug(bool debug) {
+    debug_ = debug;
+}
+
+std::list<EcCommandResponseCallback>::iterator EC800AtModem::RegisterCommandResponseCallback(EcCommandResponseCallback callback) {
+    std::lock_guard<std::mutex> lock(mutex_ );
+    return on_data_received_.insert(on_data_received_.end(), callback);
+}
+
+void EC800AtModem::UnregisterCommandResponseCallback(std::list<EcCommandResponseCallback>::iterator iterator) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    on_data_received_.erase(iterator);
+}
+
+std::list<EcCommandResponseViewCallback>::iterator EC800AtModem::RegisterCommandResponseCallback(EcCommandResponseViewCallback callback) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return on_data_received_view_.insert(on_data_received_view_.end(), callback);
+}
+
+void EC800AtModem::UnregisterCommandResponseCallback(std::list<EcCommandResponseViewCallback>::iterator iterator) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    on_data_received_view_.erase(iterator);
+}
+
+EC800UrcRouter::HandlerId EC800AtModem::RegisterUrcHandler(std::string_view urc, int connection_id, EcCommandResponseViewCallback handler) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return urc_router_.Register(urc, connection_id, std::move(handler));
+}
+
+void EC800AtModem::UnregisterUrcHandler(EC800UrcRouter::HandlerId id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    urc_router_.Unregister(id);
+}
+
+EC800UrcRouter::HandlerId EC800AtModem::RegisterUrcStream(std::string_view urc, std::string_view type, int connection_id,
+    size_t payload_index, EcUrcStreamHandler handler) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    UrcStream stream;
+    stream.id = next_stream_id_++;
+    stream.hash = EcUrcHash(urc);
+    stream.urc = urc;
+    stream.type = type;
+    stream.connection_id = connection_id;
+    stream.payload_index = std::max(payload_index, (size_t)1);
+    stream.handler = std::make_shared<EcUrcStreamHandler>(std::move(handler));
+    urc_streams_.push_back(std::move(stream));
+    return urc_streams_.back().id;
+}
+
+void EC800AtModem::UnregisterUrcStream(EC800UrcRouter::HandlerId id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    urc_streams_.erase(std::remove_if(urc_streams_.begin(), urc_streams_.end(), [id](const UrcStream& stream) {
+        return stream.id == id;
+    }), urc_streams_.end());
+}
+
+uint32_t EC800AtModem::RegisterPayloadSink(int connection_id, EcPayloadSink sink) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint32_t generation = next_payload_generation_++;
+    payload_sinks_[connection_id] = PayloadSink{generation, std::move(sink)};
+    return generation;
+}
+
+void EC800AtModem::UnregisterPayloadSink(int connection_id, uint32_t generation) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = payload_sinks_.find(connection_id);
+    if (it != payload_sinks_.end() && it->second.generation == generation) {
+        payload_sinks_.erase(it);
+    }
+}
+
+EC800AtCommandHandle EC800AtModem::CommandAsync(std::string command, int timeout_ms, AtCommandPriority priority, EC800AtCommand::CompletionCallback on_complete) {
+    return Enqueue(std::make_shared<EC800AtCommand>(std::move(command), timeout_ms >= 0 ? timeout_ms : DEFAULT_COMMAND_TIMEOUT, priority, std::move(on_complete)));
+}
+
+EC800AtCommandHandle EC800AtModem::CommandWithDataAsync(std::string command, std::string data, int timeout_ms, AtCommandPriority priority, EC800AtCommand::CompletionCallback on_complete) {
+    auto handle = std::make_shared<EC800AtCommand>(std::move(command), timeout_ms > 0 ? timeout_ms : DEFAULT_COMMAND_TIMEOUT, priority, std::move(on_complete));
+    handle->data_ = std::move(data);
+    return Enqueue(std::move(handle));
+}
+
+// Only the receive task can complete a command, it must never wait for one
+bool EC800AtModem::OnReceiveTask(EC800AtCommand& command) {
+    if (xTaskGetCurrentTaskHandle() != receive_task_handle_) {
+        return false;
+    }
+    ESP_LOGE(TAG, "%.64s issued on the receive task, queued without waiting; use Defer()", command.command().c_str());
+    return true;
+}
+
+bool EC800AtModem::CommandWithData(std::string command, std::string data, int timeout_ms, AtCommandPriority priority) {
+    auto handle = CommandWithDataAsync(std::move(command), std::move(data), timeout_ms, priority);
+    if (OnReceiveTask(*handle)) {
+        return false;
+    }
+    if (!handle->Wait()) {
+        if (handle->result() == AtCommandResult::Error) {
+            ESP_LOGE(TAG, "command error: %s", handle->command().c_str());
+        }
+        return false;
+    }
+    return true;
+}
+
+EC800AtCommandHandle EC800AtModem::Enqueue(EC800AtCommandHandle handle) {
+    auto priority = handle->priority();
+    bool dropped = false;
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        auto& queue = command_queues_[(int)priority];
+        auto& stats = queue_stats_[(int)priority];
+        if (priority == AtCommandPriority::Background && !handle->on_complete_ && handle->data().empty()) {
+            // Coalesce repeated polls, the caller gets the handle already queued
+            for (auto& queued : queue) {
+                if (queued->command() == handle->command() && queued->data().empty()) {
+                    return queued;
+                }
+            }
+        }
+        if (priority == AtCommandPriority::Background && queue.size() >= AT_BACKGROUND_QUEUE_LIMIT) {
+            dropped = true;
+            stats.dropped++;
+        } else {
+            queue.push_back(handle);
+            stats.enqueued++;
+            stats.depth = queue.size();
+            stats.max_depth = std::max(stats.max_depth, stats.depth);
+        }
+    }
+    if (dropped) {
+        handle->Complete(AtCommandResult::Dropped);
+        command_stats_.Record(*handle);
+        return handle;
+    }
+    // Each channel's task waits for its own classes, wake them all
+    queue_cv_.notify_all();
+    return handle;
+}
+
+bool EC800AtModem::Command(const std::string command, int timeout_ms, AtCommandPriority priority) {
+    auto handle = CommandAsync(command, timeout_ms, priority);
+    if (timeout_ms <= 0 || OnReceiveTask(*handle)) {
+        return false;
+    }
+    // The command task enforces the timeout from the moment the command is written
+    if (!handle->Wait()) {
+        if (handle->result() == AtCommandResult::Error) {
+            ESP_LOGE(TAG, "command error: %s", command.c_str());
+        }
+        return false;
+    }
+    return true;
+}
+
+// Extended commands can share a line, basic ones like ATE0 or ATI cannot
+static bool IsConcatenable(const std::string& command) {
+    return command.size() > 3 && command.compare(0, 3, "AT+") == 0 && command.find(';') == std::string::npos;
+}
+
+EC800AtBatchResult EC800AtModem::CommandBatch(const std::vector<std::string>& commands, int timeout_ms, AtCommandPriority priority) {
+    EC800AtBatchResult batch{true, -1, std::vector<AtCommandResult>(commands.size(), AtCommandResult::Pending)};
+    if (commands.empty()) {
+        return batch;
+    }
+    struct Line {
+        size_t first;
+        size_t count;
+        EC800AtCommandHandle handle;
+    };
+    std::vector<Line> lines;
+    for (size_t i = 0; i < commands.size();) {
+        std::string line = commands[i];
+        size_t count = 1;
+        if (IsConcatenable(line)) {
+            // "AT+A=1" + "AT+B=2" -> "AT+A=1;+B=2"
+            while (i + count < commands.size() && IsConcatenable(commands[i + count]) &&
+                   line.size() + commands[i + count].size() - 1 <= AT_BATCH_LINE_MAX) {
+                line += ";" + commands[i + count].substr(2);
+                count++;
+            }
+        }
+        lines.push_back({i, count, CommandAsync(std::move(line), timeout_ms * count, priority)});
+        i += count;
+    }
+    if (OnReceiveTask(*lines.front().handle)) {
+        batch.ok = false;
+        return batch;
+    }
+
+    for (auto& line : lines) {
+        line.handle->Wait();
+        auto result = line.handle->result();
+        if (result == AtCommandResult::Ok || line.count == 1) {
+            std::fill_n(batch.results.begin() + line.first, line.count, result);
+            continue;
+        }
+        // The module stops at the failing command and does not say which one it was. Every
+        // command up to the last one whose "+VERB: " answer came back has run, the rest are
+        // replayed one by one; the last command at least is the one that failed.
+        size_t end = line.first + line.count;
+        size_t resume = line.first;
+        for (auto& response : line.handle->response_lines()) {
+            size_t colon = response.find(':');
+            if (response.empty() || response[0] != '+' || colon == std::string::npos) {
+                continue;
+            }
+            auto verb = std::string_view(response).substr(1, colon - 1);
+            for (size_t i = resume; i < end; i++) {
+                if (CommandHasVerb(commands[i], verb)) {
+                    resume = i + 1;
+                    break;
+                }
+            }
+        }
+        resume = std::min(resume, end - 1);
+        std::fill(batch.results.begin() + line.first, batch.results.begin() + resume, AtCommandResult::Ok);
+        ESP_LOGW(TAG, "Batched line failed, replaying %zu of %zu commands", end - resume, line.count);
+        for (size_t i = resume; i < end; i++) {
+            auto handle = CommandAsync(commands[i], timeout_ms, priority);
+            handle->Wait();
+            batch.results[i] = handle->result();
+            if (batch.results[i] != AtCommandResult::Ok) {
+                break;
+            }
+        }
+    }
+    for (size_t i = 0; i < batch.results.size(); i++) {
+        if (batch.results[i] != AtCommandResult::Ok) {
+            batch.ok = false;
+            batch.failed_index = i;
+            ESP_LOGE(TAG, "command error: %s", commands[i].c_str());
+            break;
+        }
+    }
+    return batch;
+}
+
+AtUrcLatencyStats EC800AtModem::GetUrcLatencyStats() {
+    std::lock_guard<std::mutex> lock(urc_latency_mutex_);
+    return urc_latency_;
+}
+
+void EC800AtModem::ResetUrcLatencyStats() {
+    std::lock_guard<std::mutex> lock(urc_latency_mutex_);
+    urc_latency_ = {0, UINT32_MAX, 0, 0};
+}
+
+// The UART start bit pulls RX low; only the first edge of a burst is kept
+static void IRAM_ATTR RxEdgeIsr(void* arg) {
+    auto edge_time_us = (std::atomic<int64_t>*)arg;
+    if (edge_time_us->load(std::memory_order_relaxed) == 0) {
+        edge_time_us->store(esp_timer_get_time(), std::memory_order_relaxed);
+    }
+}
+
+bool EC800AtModem::EnableUrcLatencyProbe() {
+    if (urc_latency_probe_) {
+        return true;
+    }
+    // The pin stays routed to the UART, the interrupt only watches its input
+    esp_err_t err = gpio_install_isr_service(0);
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {
+        ESP_LOGE(TAG, "Failed to install GPIO ISR service: %d", err);
+        return false;
+    }
+    rx_edge_time_us_ = 0;
+    if (gpio_set_intr_type((gpio_num_t)rx_pin_, GPIO_INTR_NEGEDGE) != ESP_OK ||
+        gpio_isr_handler_add((gpio_num_t)rx_pin_, RxEdgeIsr, &rx_edge_time_us_) != ESP_OK ||
+        gpio_intr_enable((gpio_num_t)rx_pin_) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to probe RX pin %d", rx_pin_);
+        gpio_isr_handler_remove((gpio_num_t)rx_pin_);
+        return false;
+    }
+    urc_latency_probe_ = true;
+    ResetUrcLatencyStats();
+    return true;
+}
+
+bool EC800AtModem::Defer(std::function<void()> work, const void* owner) {
+    {
+        std::lock_guard<std::mutex> lock(defer_mutex_);
+        if (defer_queue_.size() >= AT_DEFER_QUEUE_LIMIT) {
+            ESP_LOGE(TAG, "deferred work queue full");
+            return false;
+        }
+        defer_queue_.push_back({owner, std::move(work)});
+    }
+    defer_cv_.notify_all();
+    return true;
+}
+
+void EC800AtModem::CancelDeferred(const void* owner) {
+    std::unique_lock<std::mutex> lock(defer_mutex_);
+    defer_queue_.erase(std::remove_if(defer_queue_.begin(), defer_queue_.end(), [owner](const DeferredWork& item) {
+        return item.owner == owner;
+    }), defer_queue_.end());
+    // Work that destroys its own owner must not wait for itself
+    if (xTaskGetCurrentTaskHandle() == defer_task_handle_) {
+        return;
+    }
+    defer_cv_.wait(lock, [this, owner] {
+        return !defer_running_ || (defer_running_owner_ != owner && defer_running_owner_ != &restart_generation_);
+    });
+}
+
+void EC800AtModem::DeferTask() {
+    while (true) {
+        DeferredWork item;
+        {
+            std::unique_lock<std::mutex> lock(defer_mutex_);
+            defer_cv_.wait(lock, [this] { return !defer_queue_.empty(); });
+            item = std::move(defer_queue_.front());
+            defer_queue_.pop_front();
+            defer_running_owner_ = item.owner;
+            defer_running_ = true;
+        }
+        item.work();
+        {
+            std::lock_guard<std::mutex> lock(defer_mutex_);
+            defer_running_ = false;
+            defer_running_owner_ = nullptr;
+        }
+        defer_cv_.notify_all();
+    }
+}
+
+bool EC800AtModem::Configure(const std::string& key, const std::string& command, int timeout_ms) {
+    {
+        std::lock_guard<std::mutex> lock(config_mutex_);
+        auto it = config_cache_.find(key);
+        if (it != config_cache_.end() && it->second == command) {
+            config_skip_count_++;
+            return true;
+        }
+    }
+    bool ok = Command(command, timeout_ms);
+    std::lock_guard<std::mutex> lock(config_mutex_);
+    if (ok) {
+        config_cache_[key] = command;
+    } else {
+        // Unknown what the module holds now
+        config_cache_.erase(key);
+    }
+    return ok;
+}
+
+bool EC800AtModem::Configure(const std::vector<std::pair<std::string, std::string>>& settings, int timeout_ms) {
+    std::vector<const std::pair<std::string, std::string>*> changed;
+    std::vector<std::string> commands;
+    {
+        std::lock_guard<std::mutex> lock(config_mutex_);
+        for (auto& setting : settings) {
+            auto it = config_cache_.find(setting.first);
+            if (it != config_cache_.end() && it->second == setting.second) {
+                config_skip_count_++;
+                continue;
+            }
+            changed.push_back(&setting);
+            commands.push_back(setting.second);
+        }
+    }
+    if (commands.empty()) {
+        return true;
+    }
+    auto batch = CommandBatch(commands, timeout_ms);
+    std::lock_guard<std::mutex> lock(config_mutex_);
+    for (size_t i = 0; i < changed.size(); i++) {
+        if (batch.results[i] == AtCommandResult::Ok) {
+            config_cache_[changed[i]->first] = changed[i]->second;
+        } else {
+            config_cache_.erase(changed[i]->first);
+        }
+    }
+    return batch.ok;
+}
+
+void EC800AtModem::ClearConfigCache() {
+    std::lock_guard<std::mutex> lock(config_mutex_);
+    config_cache_.clear();
+}
+
+size_t EC800AtModem::command_queue_depth() {
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    size_t depth = 0;
+    for (auto& queue : command_queues_) {
+        depth += queue.size();
+    }
+    return depth;
+}
+
+AtCommandQueueStats EC800AtModem::GetCommandQueueStats(AtCommandPriority priority) {
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    return queue_stats_[(int)priority];
+}
+
+// Pick the next command for `channel`: realtime first, then interactive. Background
+// commands only go out once the data path has been quiet for AT_BACKGROUND_DEFER_MS
+// and are dropped if that does not happen within AT_BACKGROUND_MAX_WAIT_MS. While the
+// second AT lane is up the primary channel serves the realtime class and the lane the
+// other two, so commands of one class still run in the order they were queued.
+EC800AtCommandHandle EC800AtModem::NextCommand(AtChannel& channel) {
+    bool primary = &channel == &at_channel_;
+    std::vector<EC800AtCommandHandle> expired;
+    EC800AtCommandHandle command;
+    {
+        std::unique_lock<std::mutex> lock(queue_mutex_);
+        while (!command) {
+            // The UART is the data pipe, nothing can be sent until ExitDataMode()
+            if (data_mode_ && !cmux_active_) {
+                for (int i = 0; i < AT_COMMAND_PRIORITY_COUNT; i++) {
+                    auto& queue = command_queues_[i];
+                    queue_stats_[i].dropped += queue.size();
+                    queue_stats_[i].depth = 0;
+                    expired.insert(expired.end(), std::make_move_iterator(queue.begin()), std::make_move_iterator(queue.end()));
+                    queue.clear();
+                }
+                if (!expired.empty()) {
+                    break;
+                }
+            }
+            // The UART belongs to the data pipe or the multiplexer start-up, commands wait
+            if (CommandsHeld() || (!primary && !lane_active_)) {
+                queue_cv_.wait(lock);
+                continue;
+            }
+            int first = primary ? (int)AtCommandPriority::Realtime : (int)AtCommandPriority::Interactive;
+            int last = primary && lane_active_ ? (int)AtCommandPriority::Realtime : (int)AtCommandPriority::Background;
+            for (int i = first; i <= last && i < (int)AtCommandPriority::Background && !command; i++) {
+                if (!command_queues_[i].empty()) {
+                    command = std::move(command_queues_[i].front());
+                    command_queues_[i].pop_front();
+                    queue_stats_[i].depth = command_queues_[i].size();
+                }
+            }
+            if (command) {
+                break;
+            }
+            if (last != (int)AtCommandPriority::Background) {
+                queue_cv_.wait(lock);
+                continue;
+            }
+
+            auto& background = command_queues_[(int)AtCommandPriority::Background];
+            auto& stats = queue_stats_[(int)AtCommandPriority::Background];
+            int64_t now = esp_timer_get_time();
+            while (!background.empty() && now - background.front()->enqueue_time_us() > AT_BACKGROUND_MAX_WAIT_MS * 1000LL) {
+                expired.push_back(std::move(background.front()));
+                background.pop_front();
+                stats.dropped++;
+            }
+            stats.depth = background.size();
+            if (!expired.empty()) {
+                break;
+            }
+
+            int64_t quiet_until = last_realtime_write_us_ + AT_BACKGROUND_DEFER_MS * 1000LL;
+            if (!background.empty() && now >= quiet_until) {
+                command = std::move(background.front());
+                background.pop_front();
+                stats.depth = background.size();
+            } else if (!background.empty()) {
+                queue_cv_.wait_for(lock, std::chrono::microseconds(quiet_until - now));
+            } else {
+                queue_cv_.wait(lock);
+            }
+        }
+    }
+    for (auto& handle : expired) {
+        ESP_LOGW(TAG, "dropped command: %.64s", handle->command().c_str());
+        handle->Complete(AtCommandResult::Dropped);
+        command_stats_.Record(*handle);
+    }
+    return command;
+}
+
+void EC800AtModem::StartCommandTask(AtChannel& channel, const char* name) {
+    auto context = new std::pair<EC800AtModem*, AtChannel*>(this, &channel);
+    xTaskCreate([](void* arg) {
+        auto context = (std::pair<EC800AtModem*, AtChannel*>*)arg;
+        auto ec800_at_modem = context->first;
+        auto& channel = *context->second;
+        delete context;
+        ec800_at_modem->CommandTask(channel);
+        vTaskDelete(NULL);
+    }, name, AT_COMMAND_TASK_STACK_SIZE, context, AT_COMMAND_TASK_PRIORITY, &channel.command_task);
+}
+
+// One task per AT channel; each channel runs its commands one after the other
+void EC800AtModem::CommandTask(AtChannel& channel) {
+    while (true) {
+        auto command = NextCommand(channel);
+        if (command) {
+            ExecuteCommand(channel, command);
+        }
+    }
+}
+
+void EC800AtModem::ExecuteCommand(AtChannel& channel, const EC800AtCommandHandle& command) {
+    // Leave the modem a gap after the previous result; the gap grows when commands
+    // time out and shrinks back while the modem keeps up
+    int64_t wait_us = channel.last_result_time_us + channel.command_gap_us - esp_timer_get_time();
+    if (wait_us >= portTICK_PERIOD_MS * 1000) {
+        vTaskDelay(pdMS_TO_TICKS(wait_us / 1000));
+    }
+
+    if (command->priority() == AtCommandPriority::Realtime) {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        last_realtime_write_us_ = esp_timer_get_time();
+    }
+    WriteCommand(channel, command);
+    if (command->timeout_ms() == 0) {
+        // Send only: the entry left in flight absorbs the result, nobody waits for it
+        command->Complete(AtCommandResult::Ok);
+        channel.last_result_time_us = esp_timer_get_time();
+        return;
+    }
+    // The prompt and the result share one deadline, counted from the write
+    int64_t deadline_us = command->write_time_us() + command->timeout_ms() * 1000LL;
+    auto remaining_ms = [deadline_us]() {
+        return (int)std::max<int64_t>((deadline_us - esp_timer_get_time()) / 1000, 0);
+    };
+    if (!command->data().empty()) {
+        if (command->WaitForPrompt(remaining_ms())) {
+            // Raw payload right after the prompt, no extra delay
+            channel.in_flight_wants_prompt = false;
+            int ret = WriteUart(channel, command->data().data(), command->data().size());
+            if (ret < 0) {
+                ESP_LOGE(TAG, "uart_write_bytes failed: %d", ret);
+                DropInFlight(channel, command);
+                command->Complete(AtCommandResult::Error);
+            }
+        } else if (!command->done()) {
+            // The module may still be waiting for the data; ESC cancels the entry so the next
+            // command is not taken as payload
+            ESP_LOGW(TAG, "no prompt for %.64s, cancelling", command->command().c_str());
+            WriteUart(channel, "\x1b", 1);
+            command->Wait(AT_PROMPT_CANCEL_MS);
+        }
+    }
+    if (!command->Wait(remaining_ms())) {
+        DropInFlight(channel, command);
+    }
+    if (command->Complete(AtCommandResult::Timeout)) {
+        ESP_LOGE(TAG, "command timeout: %.64s", command->command().c_str());
+        channel.command_gap_us = std::min<int64_t>(channel.command_gap_us * 2, AT_COMMAND_GAP_MAX_US);
+        consecutive_timeouts_++;
+    } else {
+        if (command->result() == AtCommandResult::Ok) {
+            channel.command_gap_us = std::max<int64_t>(channel.command_gap_us * 3 / 4, AT_COMMAND_GAP_MIN_US);
+        }
+        consecutive_timeouts_ = 0;
+    }
+    channel.last_result_time_us = esp_timer_get_time();
+    command_stats_.Record(*command);
+}
+
+void EC800AtModem::WriteCommand(AtChannel& channel, const EC800AtCommandHandle& command) {
+    if (debug_) {
+        ESP_LOGI(TAG, ">> %.64s", command->command().c_str());
+    }
+    command->write_time_us_ = esp_timer_get_time();
+    {
+        std::lock_guard<std::mutex> lock(channel.in_flight_mutex);
+        // Sent-only commands whose result never came
+        auto& in_flight = channel.in_flight;
+        while (!in_flight.empty() && in_flight.front()->done() &&
+               command->write_time_us_ - in_flight.front()->write_time_us() > DEFAULT_COMMAND_TIMEOUT * 1000LL) {
+            in_flight.pop_front();
+        }
+        if (in_flight.empty()) {
+            channel.in_flight_connection_id = CommandConnectionId(command->command());
+        }
+        in_flight.push_back(command);
+        channel.in_flight_wants_prompt = !command->data().empty();
+    }
+    int ret = WriteUart(channel, command->command().c_str(), command->command().length());
+    if (ret >= 0) {
+        ret = WriteUart(channel, "\r\n", 2);
+    }
+    if (ret < 0) {
+        ESP_LOGE(TAG, "uart_write_bytes failed: %d", ret);
+        DropInFlight(channel, command);
+        command->Complete(AtCommandResult::Error);
+    }
+}
+
+// Final result code: it belongs to the oldest command in flight
+void EC800AtModem::CompleteInFlight(AtChannel& channel, AtCommandResult result, int error_code) {
+    EC800AtCommandHandle command;
+    {
+        std::lock_guard<std::mutex> lock(channel.in_flight_mutex);
+        auto& in_flight = channel.in_flight;
+        if (!in_flight.empty()) {
+            command = std::move(in_flight.front());
+            in_flight.pop_front();
+        }
+        channel.in_flight_connection_id = in_flight.empty() ? EC800_URC_ANY_ID : CommandConnectionId(in_flight.front()->command());
+        if (in_flight.empty()) {
+            channel.in_flight_wants_prompt = false;
+        }
+    }
+    if (command) {
+        command->Complete(result, error_code);
+    }
+}
+
+// A command given up on by its task, wherever it is in the line
+void EC800AtModem::DropInFlight(AtChannel& channel, const EC800AtCommandHandle& command) {
+    std::lock_guard<std::mutex> lock(channel.in_flight_mutex);
+    auto& in_flight = channel.in_flight;
+    in_flight.erase(std::remove(in_flight.begin(), in_flight.end(), command), in_flight.end());
+    channel.in_flight_connection_id = in_flight.empty() ? EC800_URC_ANY_ID : CommandConnectionId(in_flight.front()->command());
+    if (in_flight.empty() || !command->data().empty()) {
+        channel.in_flight_wants_prompt = false;
+    }
+}
+
+// AT+QISEND with data ends with SEND OK or SEND FAIL only, an OK or '>' line before
+// that must not complete it
+bool EC800AtModem::AwaitsSendResult(AtChannel& channel) {
+    std::lock_guard<std::mutex> lock(channel.in_flight_mutex);
+    if (channel.in_flight.empty()) {
+        return false;
+    }
+    auto& command = channel.in_flight.front();
+    return !command->data().empty() && CommandHasVerb(command->command(), "QISEND");
+}
+
+// '>' or CONNECT; only the newest command in flight can carry data
+void EC800AtModem::SignalPromptInFlight(AtChannel& channel) {
+    channel.in_flight_wants_prompt = false;
+    std::lock_guard<std::mutex> lock(channel.in_flight_mutex);
+    if (!channel.in_flight.empty()) {
+        channel.in_flight.back()->SignalPrompt();
+    }
+}
+
+// Information text of the oldest command in flight: "+VERB: " lines of its own verb, and
+// bare text only if it is a command that answers that way
+void EC800AtModem::AppendResponseLine(AtChannel& channel, std::string_view line, std::string_view verb) {
+    std::lock_guard<std::mutex> lock(channel.in_flight_mutex);
+    if (channel.in_flight.empty()) {
+        return;
+    }
+    auto& command = channel.in_flight.front();
+    if (line == command->command() || (verb.empty() ? AnswersInText(command->command()) : CommandHasVerb(command->command(), verb))) {
+        command->AppendLine(line);
+    }
+}
+
+// The only reader of the UART: driver events are handled and data is read and parsed
+// right here, one wake-up per burst
+void EC800AtModem::ReceiveTask() {
+    uart_event_t event;
+    while (true) {
+        // A possible NO CARRIER, or the start of one, is waiting for the guard time to pass
+        AtChannel* raw_channel = data_mode_channel_;
+        bool held = raw_channel != nullptr && raw_channel->raw && raw_channel->raw_held > 0;
+        if (xQueueReceive(event_queue_handle_, &event, held ? pdMS_TO_TICKS(AT_DATA_MODE_GUARD_MS) : portMAX_DELAY) != pdTRUE) {
+            CheckNoCarrier(*raw_channel);
+            continue;
+        }
+        rx_event_time_us_ = esp_timer_get_time();
+        if (urc_latency_probe_) {
+            int64_t edge_time_us = rx_edge_time_us_;
+            if (edge_time_us > 0) {
+                rx_event_time_us_ = edge_time_us;
+            }
+        }
+        switch (event.type)
+        {
+        case UART_DATA:
+            last_receive_time_us_ = esp_timer_get_time();
+            ReadUart();
+            break;
+        case UART_BREAK:
+            ESP_LOGI(TAG, "break");
+            break;
+        case UART_BUFFER_FULL:
+            ESP_LOGE(TAG, "buffer full");
+            buffer_full_count_++;
+            RecoverFromOverflow();
+            break;
+        case UART_FIFO_OVF:
+            ESP_LOGE(TAG, "FIFO overflow");
+            fifo_overflow_count_++;
+            RecoverFromOverflow();
+            break;
+        case UART_FRAME_ERR:
+        case UART_PARITY_ERR:
+            ESP_LOGW(TAG, "framing error");
+            RecordLinkError();
+            break;
+        default:
+            ESP_LOGE(TAG, "unknown event type: %d", event.type);
+            break;
+        }
+        if (held) {
+            CheckNoCarrier(*raw_channel);
+        }
+        // Arm the probe for the next burst
+        rx_edge_time_us_ = 0;
+    }
+}
+
+// Everything the driver has buffered, bursts that arrived after the event included
+void EC800AtModem::ReadUart() {
+    char cmux_buffer[256];
+    size_t available;
+    uart_get_buffered_data_len(uart_num_, &available);
+    while (available > 0) {
+        if (cmux_active_) {
+            // Frames are demultiplexed, the AT channels come back through FeedAtStream()
+            int ret = uart_read_bytes(uart_num_, cmux_buffer, std::min(available, sizeof(cmux_buffer)), portMAX_DELAY);
+            if (ret <= 0) {
+                break;
+            }
+            cmux_->Input(cmux_buffer, ret);
+            available -= ret;
+            continue;
+        }
+
+        // Read straight into the free region of the ring buffer
+        auto& rx_buffer = at_channel_.rx_buffer;
+        size_t writable;
+        char* rx_buffer_ptr = rx_buffer.WritePointer(&writable);
+        if (writable == 0) {
+            DropFullBuffer(at_channel_);
+            continue;
+        }
+        int ret = uart_read_bytes(uart_num_, rx_buffer_ptr, std::min(available, writable), portMAX_DELAY);
+        if (ret <= 0) {
+            break;
+        }
+        rx_buffer.Commit(ret);
+        available -= ret;
+        while (ParseResponse(at_channel_)) {}
+    }
+}
+
+// Input was lost somewhere in the UART driver. Drop what is still buffered and restart the
+// parser on the next line; whatever was being received when the gap hit is reported as lost.
+void EC800AtModem::RecoverFromOverflow() {
+    uart_flush_input(uart_num_);
+    if (at_channel_.raw || cmux_active_) {
+        // PPP and 27.010 frames carry checksums, their decoders resync on the next flag.
+        // A transparent socket cannot, its transport closes the connection.
+        NotifyCommandResponse("FIFO_OVERFLOW", AtArgumentListEC());
+        return;
+    }
+
+    std::string damaged[EC800_CONNECTION_KIND_COUNT];
+    ResetParser(at_channel_, damaged);
+    NotifyOverflow(nullptr, damaged);
+}
+
+// Forget the buffered input and anything the parser was in the middle of: the hex stream
+// or raw payload being delivered and QIRD answers still in flight. Parsing restarts on the
+// next line. The connections that lost data are added to `damaged`, comma separated.
+void EC800AtModem::ResetParser(AtChannel& channel, std::string (&damaged)[EC800_CONNECTION_KIND_COUNT]) {
+    auto add_damaged = [&damaged](EC800ConnectionKind kind, int connection_id) {
+        if (connection_id != EC800_URC_ANY_ID) {
+            auto& ids = damaged[(int)kind];
+            ids += (ids.empty() ? "" : ",") + std::to_string(connection_id);
+        }
+    };
+    if (channel.stream) {
+        add_damaged(channel.stream_kind, channel.stream_connection_id);
+        auto stream = std::move(channel.stream);
+        channel.stream.reset();
+        if (stream->end) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stream->end(false);
+        }
+    }
+    if (channel.payload_remaining > 0) {
+        add_damaged(EC800ConnectionKind::Socket, channel.payload_connection_id);
+        channel.payload_remaining = 0;
+        channel.payload_generation = 0;
+    }
+    {
+        // Buffer access hands out data only once, a cut QIRD answer cannot be read again
+        std::lock_guard<std::mutex> lock(channel.in_flight_mutex);
+        for (auto& command : channel.in_flight) {
+            if (!command->done() && command->command().compare(0, 7, "AT+QIRD") == 0) {
+                add_damaged(EC800ConnectionKind::Socket, CommandConnectionId(command->command()));
+            }
+        }
+    }
+    channel.rx_buffer.Clear();
+    channel.discard_line = true;
+}
+
+// FIFO_OVERFLOW with one quoted id list per connection kind, in EC800ConnectionKind order
+void EC800AtModem::NotifyOverflow(AtChannel* channel, const std::string (&damaged)[EC800_CONNECTION_KIND_COUNT]) {
+    std::string arguments;
+    bool any = false;
+    for (int kind = 0; kind < EC800_CONNECTION_KIND_COUNT; kind++) {
+        arguments += (kind == 0 ? "\"" : ",\"") + damaged[kind] + "\"";
+        any = any || !damaged[kind].empty();
+    }
+    if (any) {
+        overflow_damage_count_++;
+    }
+    ESP_LOGW(TAG, "Resynchronized after overflow, lost data on connections: %s", any ? arguments.c_str() : "none");
+    NotifyCommandResponse("FIFO_OVERFLOW", AtArgumentListEC(arguments), channel);
+}
+
+bool EC800AtModem::OverflowDamaged(const AtArgumentListEC& arguments, EC800ConnectionKind kind, int connection_id) {
+    if ((size_t)kind >= arguments.size()) {
+        return false;
+    }
+    std::string_view ids = arguments[(size_t)kind].string_value();
+    while (!ids.empty()) {
+        size_t comma = ids.find(',');
+        AtArgumentViewEC id{ids.substr(0, comma)};
+        if (id.int_value() == connection_id) {
+            return true;
+        }
+        ids.remove_prefix(comma == std::string_view::npos ? ids.size() : comma + 1);
+    }
+    return false;
+}
+
+// The ring filled up without a line end, so the parser is lost. Resync like after a UART
+// overflow so the owners of a cut payload learn about it.
+void EC800AtModem::DropFullBuffer(AtChannel& channel) {
+    ESP_LOGE(TAG, "rx buffer overflow, dropping %u bytes", (unsigned)channel.rx_buffer.size());
+    rx_overflow_count_++;
+    std::string damaged[EC800_CONNECTION_KIND_COUNT];
+    ResetParser(channel, damaged);
+    NotifyOverflow(&channel, damaged);
+}
+
+// AT channel payload while multiplexing, parsed exactly like the plain UART stream
+void EC800AtModem::FeedAtStream(AtChannel& channel, const char* data, size_t length) {
+    while (length > 0) {
+        size_t written = channel.rx_buffer.Write(data, length);
+        if (written == 0) {
+            DropFullBuffer(channel);
+            continue;
+        }
+        data += written;
+        length -= written;
+        while (ParseResponse(channel)) {}
+    }
+}
+
+int EC800AtModem::WriteUart(AtChannel& channel, const char* data, size_t length) {
+    if (cmux_active_) {
+        auto cmux_channel = cmux_->channel(channel.dlci);
+        return cmux_channel != nullptr ? cmux_channel->Write(data, length) : -1;
+    }
+    return uart_write_bytes(uart_num_, data, length);
+}
+
+bool EC800AtModem::EnableHardwareFlowControl(int rts_pin, int cts_pin) {
+    if (uart_set_pin(uart_num_, tx_pin_, rx_pin_, rts_pin, cts_pin) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to set RTS/CTS pins");
+        return false;
+    }
+    // Drive RTS first; CTS is only honoured once the modem is known to drive it
+    uart_set_hw_flow_ctrl(uart_num_, UART_HW_FLOWCTRL_RTS, AT_UART_RTS_THRESHOLD);
+    if (!Command("AT+IFC=2,2")) {
+        uart_set_hw_flow_ctrl(uart_num_, UART_HW_FLOWCTRL_DISABLE, 0);
+        ESP_LOGE(TAG, "Failed to enable hardware flow control");
+        return false;
+    }
+    uart_set_hw_flow_ctrl(uart_num_, UART_HW_FLOWCTRL_CTS_RTS, AT_UART_RTS_THRESHOLD);
+    hardware_flow_control_ = true;
+    AddCapability(EC800_CAPABILITY_HW_FLOW);
+    return true;
+}
+
+bool EC800AtModem::EnableCmux(size_t channel_count) {
+    if (cmux_active_) {
+        return true;
+    }
+    if (!cmux_) {
+        cmux_.reset(new EC800Cmux([this](const char* data, size_t length) {
+            return uart_write_bytes(uart_num_, data, length);
+        }, std::max(channel_count, (size_t)EC800_CMUX_DATA_DLCI)));
+        cmux_->channel(EC800_CMUX_AT_DLCI)->SetReceiveCallback([this](const char* data, size_t length) {
+            FeedAtStream(at_channel_, data, length);
+        });
+        data_channel_.reset(new AtChannel(EC800_CMUX_DATA_DLCI, rx_buffer_size_));
+        cmux_->channel(EC800_CMUX_DATA_DLCI)->SetReceiveCallback([this](const char* data, size_t length) {
+            FeedAtStream(*data_channel_, data, length);
+        });
+        if (cmux_->channel_count() >= EC800_CMUX_LANE_DLCI) {
+            lane_channel_.reset(new AtChannel(EC800_CMUX_LANE_DLCI, rx_buffer_size_));
+            cmux_->channel(EC800_CMUX_LANE_DLCI)->SetReceiveCallback([this](const char* data, size_t length) {
+                FeedAtStream(*lane_channel_, data, length);
+            });
+            StartCommandTask(*lane_channel_, "modem_lane");
+        }
+    }
+
+    // The parser switches to frames right after the OK, see ParseResponse()
+    cmux_requested_ = true;
+    bool ok = Command("AT+CMUX=0", DEFAULT_COMMAND_TIMEOUT, AtCommandPriority::Realtime);
+    cmux_requested_ = false;
+    if (ok && cmux_active_) {
+        ok = cmux_->Open();
+        if (!ok) {
+            cmux_->Close();
+            cmux_active_ = false;
+        } else {
+            AddCapability(EC800_CAPABILITY_CMUX);
+        }
+    } else {
+        ok = false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        cmux_opening_ = false;
+        lane_active_ = ok && lane_channel_ != nullptr;
+    }
+    queue_cv_.notify_all();
+    if (!ok) {
+        ESP_LOGE(TAG, "failed to start CMUX");
+    }
+    return ok;
+}
+
+void EC800AtModem::DisableCmux() {
+    if (!cmux_active_) {
+        return;
+    }
+    if (data_mode_) {
+        // The pipe on DLCI 2 would end up on the AT channel
+        ExitDataMode();
+    }
+    {
+        // Everything goes back to the single plain AT channel
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        lane_active_ = false;
+    }
+    queue_cv_.notify_all();
+    // Plain AT resumes once the modem answered the close down
+    cmux_->Close();
+    cmux_active_ = false;
+}
+
+// The data prompt "> " is not followed by CRLF, pick it up as soon as it arrives
+bool EC800AtModem::ParsePrompt(AtChannel& channel) {
+    if (!channel.in_flight_wants_prompt || channel.rx_buffer.empty() || channel.rx_buffer.At(0) != '>') {
+        return false;
+    }
+    channel.rx_buffer.Consume(channel.rx_buffer.size() >= 2 && channel.rx_buffer.At(1) == ' ' ? 2 : 1);
+    SignalPromptInFlight(channel);
+    return true;
+}
+
+// Transparent mode: everything is payload. The modem leaves data mode on its own and
+// reports NO CARRIER when the peer closes, but the same bytes can be payload. A tail that
+// may be (the start of) it is held back, across reads, until the guard time passed without
+// more data (CheckNoCarrier()): then the complete sequence is the close, a part of it is
+// payload after all.
+bool EC800AtModem::ParseRawData(AtChannel& channel) {
+    size_t pending = channel.rx_buffer.size();
+    size_t held = std::min(pending, kNoCarrierLength);
+    for (; held > 0; held--) {
+        size_t i = 0;
+        while (i < held && channel.rx_buffer.At(pending - held + i) == kNoCarrier[i]) {
+            i++;
+        }
+        if (i == held) {
+            break;
+        }
+    }
+    channel.raw_held = held;
+    channel.raw_receive_time_us = esp_timer_get_time();
+    DeliverRawData(channel, pending - held);
+    return false;
+}
+
+// The first `pending` bytes of the buffer to on_raw_data_. Not under mutex_: on_data feeds
+// lwIP (esp_netif_receive), which may call back into us.
+void EC800AtModem::DeliverRawData(AtChannel& channel, size_t pending) {
+    std::lock_guard<std::mutex> lock(raw_callback_mutex_);
+    while (pending > 0) {
+        size_t length;
+        const char* data = channel.rx_buffer.ReadPointer(&length);
+        length = std::min(length, pending);
+        if (on_raw_data_) {
+            on_raw_data_(data, length);
+        }
+        channel.rx_buffer.Consume(length);
+        pending -= length;
+    }
+}
+
+// Called by the receive task when it was woken or timed out
+void EC800AtModem::CheckNoCarrier(AtChannel& channel) {
+    if (!channel.raw || channel.raw_held == 0 ||
+        esp_timer_get_time() - channel.raw_receive_time_us < AT_DATA_MODE_GUARD_MS * 1000LL) {
+        return;
+    }
+    if (channel.raw_held < kNoCarrierLength) {
+        // A payload that ends like the sequence starts, e.g. with "\r\n"
+        size_t held = channel.raw_held;
+        channel.raw_held = 0;
+        DeliverRawData(channel, held);
+        return;
+    }
+    channel.rx_buffer.Consume(kNoCarrierLength);
+    channel.raw_held = 0;
+    ESP_LOGI(TAG, "data mode closed by the peer");
+    LeaveDataMode();
+    std::lock_guard<std::mutex> lock(raw_callback_mutex_);
+    if (on_data_mode_closed_) {
+        on_data_mode_closed_();
+    }
+}
+
+// A URC announced <len> raw bytes; hand them to the connection's sink as they arrive
+bool EC800AtModem::ParsePayload(AtChannel& channel) {
+    if (channel.payload_remaining == 0 || channel.rx_buffer.empty()) {
+        return false;
+    }
+    size_t length;
+    const char* data = channel.rx_buffer.ReadPointer(&length);
+    length = std::min(length, channel.payload_remaining);
+    channel.payload_remaining -= length;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = payload_sinks_.find(channel.payload_connection_id);
+        if (it != payload_sinks_.end() && it->second.generation == channel.payload_generation) {
+            it->second.sink(data, length, channel.payload_remaining);
+        } else if (debug_) {
+            ESP_LOGW(TAG, "No payload sink for connection %d, dropping %u bytes", channel.payload_connection_id, (unsigned)length);
+        }
+    }
+    channel.rx_buffer.Consume(length);
+    return true;
+}
+
+// Start streaming when the buffered line is a registered bulk URC and all arguments before
+// the payload have arrived. Lines that end early are left to the line parser.
+bool EC800AtModem::BeginStream(AtChannel& channel) {
+    if (channel.rx_buffer.empty() || channel.rx_buffer.At(0) != '+') {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (urc_streams_.empty()) {
+        return false;
+    }
+
+    // "+NAME: ", names are short
+    size_t size = channel.rx_buffer.size();
+    size_t name_end = 1;
+    while (name_end < size && channel.rx_buffer.At(name_end) != ':') {
+        if (channel.rx_buffer.At(name_end) == '\r' || name_end > 32) {
+            return false;
+        }
+        name_end++;
+    }
+    if (name_end + 2 > size) {
+        return false;
+    }
+    // Copied out, Linearize() for the header below may move the ring's contents
+    char name_buffer[33];
+    for (size_t i = 1; i < name_end; i++) {
+        name_buffer[i - 1] = channel.rx_buffer.At(i);
+    }
+    std::string_view name(name_buffer, name_end - 1);
+    uint32_t hash = EcUrcHash(name);
+    size_t max_index = 0;
+    for (auto& stream : urc_streams_) {
+        if (stream.hash == hash && stream.urc == name) {
+            max_index = std::max(max_index, stream.payload_index);
+        }
+    }
+    if (max_index == 0) {
+        return false;
+    }
+
+    // Positions of the separators in front of each argument, quotes respected
+    size_t separators[AtArgumentListEC::kMaxArguments];
+    size_t values_start = name_end + 2;
+    size_t count = 0;
+    bool quoted = false;
+    for (size_t pos = values_start; pos < size && count < max_index && count < AtArgumentListEC::kMaxArguments; pos++) {
+        char c = channel.rx_buffer.At(pos);
+        if (c == '"') {
+            quoted = !quoted;
+        } else if (c == '\r') {
+            break;
+        } else if (c == ',' && !quoted) {
+            separators[count++] = pos;
+        }
+    }
+
+    for (auto& stream : urc_streams_) {
+        if (stream.hash != hash || stream.payload_index > count || stream.urc != name) {
+            continue;
+        }
+        size_t header_end = separators[stream.payload_index - 1];
+        const char* line = channel.rx_buffer.Linearize(header_end);
+        AtArgumentListEC header(std::string_view(line + values_start, header_end - values_start));
+        if (!stream.type.empty() && (header.empty() || header[0] != stream.type)) {
+            continue;
+        }
+        if (stream.connection_id != EC800_URC_ANY_ID && UrcConnectionId(hash, header, &channel) != stream.connection_id) {
+            continue;
+        }
+        if (debug_) {
+            ESP_LOGI(TAG, "<< %.*s,<streaming>", (int)std::min(header_end, (size_t)64), line);
+        }
+        if (hash == EcUrcHash("QIRD") && header.size() >= 3) {
+            // +QIRD: <a>,<b>,<len>,<hex>
+            read_length_ = header[2].int_value(0);
+        }
+        if (stream.handler->begin) {
+            stream.handler->begin(header);
+        }
+        channel.stream = stream.handler;
+        channel.stream_ok = true;
+        channel.stream_connection_id = UrcConnectionId(hash, header, &channel);
+        channel.stream_kind = UrcConnectionKind(hash);
+        channel.rx_buffer.Consume(header_end + 1);
+        return true;
+    }
+    return false;
+}
+
+// Decode the streamed payload as it arrives; quotes around it are skipped, CRLF ends it
+bool EC800AtModem::ParseStream(AtChannel& channel) {
+    if (!channel.stream) {
+        return BeginStream(channel);
+    }
+    if (channel.rx_buffer.empty()) {
+        return false;
+    }
+
+    size_t length;
+    const char* data = channel.rx_buffer.ReadPointer(&length);
+    auto stop = std::find_if(data, data + length, [](char c) { return c == '\r' || c == '"'; });
+    size_t hex_length = stop - data;
+    size_t even_length = hex_length & ~(size_t)1;
+    if (even_length > 0) {
+        char decoded[AT_STREAM_CHUNK_SIZE / 2];
+        even_length = std::min(even_length, (size_t)AT_STREAM_CHUNK_SIZE);
+        if (!EC800Hex::Decode(decoded, data, even_length)) {
+            channel.stream_ok = false;
+        } else if (channel.stream->data) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            channel.stream->data(decoded, even_length / 2);
+        }
+        channel.rx_buffer.Consume(even_length);
+        return true;
+    }
+
+    if (stop == data + length) {
+        // A single digit left at the end of the contiguous region, pair it with the next byte
+        if (channel.rx_buffer.size() < 2) {
+            return false;
+        }
+        const char* pair = channel.rx_buffer.Linearize(2);
+        if (pair[1] != '\r' && pair[1] != '"') {
+            char decoded;
+            if (!EC800Hex::Decode(&decoded, pair, 2)) {
+                channel.stream_ok = false;
+            } else if (channel.stream->data) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                channel.stream->data(&decoded, 1);
+            }
+            channel.rx_buffer.Consume(2);
+            return true;
+        }
+        hex_length = 1;
+    }
+    if (hex_length == 1) {
+        // Odd number of digits
+        channel.stream_ok = false;
+        channel.rx_buffer.Consume(1);
+        return true;
+    }
+    if (*stop == '"') {
+        channel.rx_buffer.Consume(1);
+        return true;
+    }
+    if (channel.rx_buffer.size() < 2) {
+        return false;
+    }
+    channel.rx_buffer.Consume(2);
+    auto stream = std::move(channel.stream);
+    channel.stream.reset();
+    if (!channel.stream_ok) {
+        RecordLinkError();
+    }
+    if (stream->end) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stream->end(channel.stream_ok);
+    }
+    return true;
+}
+
+// Direct push: +QIURC: "recv",<id>,<len>[,"<ip>",<port>] followed by <len> bytes.
+// Buffer access: +QIRD: <len>[,"<ip>",<port>] followed by <len> bytes, then OK. UDP
+// sockets name the sender; the three numbers answering AT+QIRD=<id>,0 carry no payload.
+void EC800AtModem::BeginPayload(AtChannel& channel, uint32_t hash, const AtArgumentListEC& arguments) {
+    if (hash == EcUrcHash("QIURC")) {
+        if (arguments.size() >= 3 && arguments[0] == "recv") {
+            channel.payload_connection_id = arguments[1].int_value();
+            channel.payload_remaining = std::max(arguments[2].int_value(0), 0);
+        }
+    } else if (hash == EcUrcHash("QIRD")) {
+        if (arguments.size() == 1 || (arguments.size() == 3 && arguments[1].quoted)) {
+            channel.payload_connection_id = channel.in_flight_connection_id;
+            channel.payload_remaining = std::max(arguments[0].int_value(0), 0);
+            read_length_ = channel.payload_remaining;
+        }
+    }
+    if (channel.payload_remaining == 0) {
+        return;
+    }
+    // Bound to the sink of the current open; a reopen while it streams drops the rest
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = payload_sinks_.find(channel.payload_connection_id);
+    channel.payload_generation = it != payload_sinks_.end() ? it->second.generation : 0;
+}
+
+bool EC800AtModem::ParseResponse(AtChannel& channel) {
+    if (channel.raw) {
+        return ParseRawData(channel);
+    }
+    if (channel.discard_line) {
+        auto end_pos = channel.rx_buffer.FindLineEnd();
+        if (end_pos == EC800RingBuffer::npos) {
+            // Keep a trailing CR, its LF may still be on the way
+            if (channel.rx_buffer.size() > 1) {
+                channel.rx_buffer.Consume(channel.rx_buffer.size() - 1);
+            }
+            return false;
+        }
+        channel.rx_buffer.Consume(end_pos + 2);
+        channel.discard_line = false;
+        return true;
+    }
+    if (ParsePayload(channel)) {
+        return true;
+    }
+    if (ParsePrompt(channel)) {
+        return true;
+    }
+    if (ParseStream(channel)) {
+        return true;
+    }
+
+    auto end_pos = channel.rx_buffer.FindLineEnd();
+    if (end_pos == EC800RingBuffer::npos) {
+        return false;
+    }
+
+    // Ignore empty lines
+    if (end_pos == 0) {
+        channel.rx_buffer.Consume(2);
+        return true;
+    }
+    const char* line = channel.rx_buffer.Linearize(end_pos + 2);
+    if (debug_) {
+        ESP_LOGI(TAG, "<< %.*s", (int)std::min(end_pos, (size_t)64), line);
+    }
+
+    // Parse "+CME ERROR: 123,456,789"
+    if (line[0] == '+') {
+        std::string_view command, values;
+        auto separator = (const char*)memmem(line, end_pos, ": ", 2);
+        if (separator == nullptr) {
+            command = std::string_view(line + 1, end_pos - 1);
+        } else {
+            size_t pos = separator - line;
+            command = std::string_view(line + 1, pos - 1);
+            values = std::string_view(line + pos + 2, end_pos - pos - 2);
+        }
+
+        // Parse "string", int, int, ... into views of the receive buffer.
+        // The views stay valid until the line is consumed below.
+        AtArgumentListEC arguments(values);
+        NotifyCommandResponse(command, arguments, &channel);
+        AppendResponseLine(channel, std::string_view(line, end_pos), command);
+        BeginPayload(channel, EcUrcHash(command), arguments);
+        channel.rx_buffer.Consume(end_pos + 2);
+        if (rx_event_time_us_ > 0) {
+            uint32_t latency_us = esp_timer_get_time() - rx_event_time_us_;
+            std::lock_guard<std::mutex> lock(urc_latency_mutex_);
+            urc_latency_.count++;
+            urc_latency_.min_us = std::min(urc_latency_.min_us, latency_us);
+            urc_latency_.max_us = std::max(urc_latency_.max_us, latency_us);
+            urc_latency_.total_us += latency_us;
+        }
+        return true;
+    } else if (end_pos == 2 && line[0] == 'O' && line[1] == 'K') {
+        channel.rx_buffer.Consume(4);
+        bool switched = false;
+        if (cmux_requested_) {
+            // AT+CMUX=0 accepted, from here on the UART carries 27.010 frames
+            std::lock_guard<std::mutex> lock(queue_mutex_);
+            cmux_requested_ = false;
+            cmux_opening_ = true;
+            cmux_active_ = true;
+            switched = true;
+        }
+        if (!AwaitsSendResult(channel)) {
+            CompleteInFlight(channel, AtCommandResult::Ok);
+        }
+        if (switched) {
+            // Whatever followed the OK in the same read is already framed.
+            // Moved out first, the decoder feeds DLCI 1 back into this buffer.
+            std::string framed;
+            framed.reserve(channel.rx_buffer.size());
+            while (!channel.rx_buffer.empty()) {
+                size_t length;
+                const char* data = channel.rx_buffer.ReadPointer(&length);
+                framed.append(data, length);
+                channel.rx_buffer.Consume(length);
+            }
+            if (!framed.empty()) {
+                cmux_->Input(framed.data(), framed.size());
+            }
+            return false;
+        }
+        return true;
+    } else if (line[0] == '>') {
+        channel.rx_buffer.Consume(1);
+        if (!AwaitsSendResult(channel)) {
+            CompleteInFlight(channel, AtCommandResult::Ok);
+        }
+        return true;
+    } else if (end_pos == 5 && memcmp(line, "ERROR", 5) == 0) {
+        channel.rx_buffer.Consume(7);
+        CompleteInFlight(channel, AtCommandResult::Error);
+        return true;
+    } else if (end_pos == 7 && memcmp(line, "SEND OK", 7) == 0) {
+        channel.rx_buffer.Consume(9);
+        CompleteInFlight(channel, AtCommandResult::Ok);
+        return true;
+    } else if (end_pos == 9 && memcmp(line, "SEND FAIL", 9) == 0) {
+        // Kept as the response, senders tell a full send buffer from an ERROR by it
+        AppendResponseLine(channel, std::string_view(line, end_pos), "QISEND");
+        channel.rx_buffer.Consume(11);
+        CompleteInFlight(channel, AtCommandResult::Error);
+        return true;
+    } else if (end_pos >= 7 && memcmp(line, "CONNE", 5) == 0) {
+        channel.rx_buffer.Consume(end_pos + 2);
+        // CONNECT ends the command phase, the caller sends its data next
+        http_connect_flag_ = true;
+        if (data_mode_requested_ && !channel.in_flight_wants_prompt) {
+            // Everything after this CONNECT belongs to the data pipe
+            data_mode_requested_ = false;
+            data_mode_ = true;
+            channel.raw_held = 0;
+            channel.raw = true;
+            CompleteInFlight(channel, AtCommandResult::Ok);
+        } else if (channel.in_flight_wants_prompt) {
+            SignalPromptInFlight(channel);
+        } else {
+            CompleteInFlight(channel, AtCommandResult::Ok);
+        }
+        return true;
+
+    } else {
+        std::string_view text(line, end_pos);
+        if (IsUnsolicitedText(text)) {
+            NotifyCommandResponse(text, AtArgumentListEC(), &channel);
+        } else {
+            AppendResponseLine(channel, text);
+        }
+        channel.rx_buffer.Consume(end_pos + 2);
+        return true;
+    }
+    return false;
+}
+
+int EC800AtModem::AllocateConnectionId(EC800ConnectionKind kind, int preferred) {
+    std::lock_guard<std::mutex> lock(connection_id_mutex_);
+    auto& free_ids = free_connection_ids_[(int)kind];
+    if (preferred != EC800_AUTO_CONNECTION_ID) {
+        auto it = std::find(free_ids.begin(), free_ids.end(), preferred);
+        if (it != free_ids.end()) {
+            free_ids.erase(it);
+            return preferred;
+        }
+        ESP_LOGW(TAG, "Connect id %d is taken", preferred);
+    }
+    if (free_ids.empty()) {
+        ESP_LOGE(TAG, "No free connect id");
+        return -1;
+    }
+    int id = free_ids.front();
+    free_ids.pop_front();
+    return id;
+}
+
+void EC800AtModem::ReleaseConnectionId(EC800ConnectionKind kind, int connection_id) {
+    if (connection_id < 0) {
+        return;
+    }
+    if (kind == EC800ConnectionKind::Socket) {
+        std::lock_guard<std::mutex> lock(read_mutex_);
+        socket_reads_.erase(connection_id);
+    }
+    std::lock_guard<std::mutex> lock(connection_id_mutex_);
+    auto& free_ids = free_connection_ids_[(int)kind];
+    if (std::find(free_ids.begin(), free_ids.end(), connection_id) == free_ids.end()) {
+        free_ids.push_back(connection_id);
+    }
+}
+
+void EC800AtModem::RequestRead(int connection_id) {
+    {
+        std::lock_guard<std::mutex> lock(read_mutex_);
+        auto& reads = socket_reads_[connection_id];
+        if (reads.depth++ == 0) {
+            reads.requested_us = esp_timer_get_time();
+        }
+    }
+    IssueNextRead();
+}
+
+void EC800AtModem::SetReadWeight(int connection_id, int weight) {
+    std::lock_guard<std::mutex> lock(read_mutex_);
+    socket_reads_[connection_id].weight = std::max(weight, 1);
+}
+
+std::vector<EC800SocketStats> EC800AtModem::GetSocketStats() {
+    std::lock_guard<std::mutex> lock(read_mutex_);
+    std::vector<EC800SocketStats> stats;
+    for (auto& [id, reads] : socket_reads_) {
+        stats.push_back({id, reads.weight, reads.depth, reads.reads, reads.bytes_read, reads.max_wait_us});
+    }
+    return stats;
+}
+
+// Weighted round robin: the socket under the cursor keeps its turn for `weight` reads
+int EC800AtModem::NextReadId() {
+    auto current = socket_reads_.find(read_cursor_);
+    if (current != socket_reads_.end()) {
+        if (current->second.depth > 0 && current->second.served < current->second.weight) {
+            return read_cursor_;
+        }
+        current->second.served = 0;
+    }
+    auto it = socket_reads_.upper_bound(read_cursor_);
+    for (size_t i = 0; i < socket_reads_.size(); i++, it++) {
+        if (it == socket_reads_.end()) {
+            it = socket_reads_.begin();
+        }
+        if (it->second.depth > 0) {
+            read_cursor_ = it->first;
+            it->second.served = 0;
+            return read_cursor_;
+        }
+    }
+    return EC800_URC_ANY_ID;
+}
+
+void EC800AtModem::IssueNextRead() {
+    int connection_id;
+    {
+        std::lock_guard<std::mutex> lock(read_mutex_);
+        if (read_in_flight_) {
+            return;
+        }
+        connection_id = NextReadId();
+        if (connection_id == EC800_URC_ANY_ID) {
+            return;
+        }
+        auto& reads = socket_reads_[connection_id];
+        reads.served++;
+        reads.reads++;
+        reads.max_wait_us = std::max(reads.max_wait_us, (uint32_t)(esp_timer_get_time() - reads.requested_us));
+        read_in_flight_ = true;
+        read_length_ = -1;
+    }
+    CommandAsync("AT+QIRD=" + std::to_string(connection_id) + "," + std::to_string(AT_READ_CHUNK_SIZE), DEFAULT_COMMAND_TIMEOUT,
+        AtCommandPriority::Realtime, [this, connection_id](EC800AtCommand& command) {
+            OnReadComplete(connection_id, command.ok());
+        });
+}
+
+void EC800AtModem::OnReadComplete(int connection_id, bool ok) {
+    {
+        std::lock_guard<std::mutex> lock(read_mutex_);
+        read_in_flight_ = false;
+        auto it = socket_reads_.find(connection_id);
+        if (it != socket_reads_.end()) {
+            auto& reads = it->second;
+            int length = read_length_;
+            if (ok && length > 0) {
+                // The modem only reports "recv" again once its buffer was read empty, keep
+                // reading until it says so
+                reads.bytes_read += length;
+                reads.depth = std::max(reads.depth - 1, (size_t)1);
+                reads.requested_us = esp_timer_get_time();
+            } else {
+                // Empty, closed or failed: every request for it is answered
+                reads.depth = 0;
+            }
+        }
+    }
+    IssueNextRead();
+}
+
+bool EC800AtModem::EnterDataMode(const std::string& command, EcRawDataCallback on_data, std::function<void()> on_closed, int timeout_ms) {
+    {
+        std::lock_guard<std::mutex> lock(raw_callback_mutex_);
+        on_raw_data_ = std::move(on_data);
+        on_data_mode_closed_ = std::move(on_closed);
+    }
+    return RequestDataMode(command, timeout_ms);
+}
+
+bool EC800AtModem::ResumeDataMode(int timeout_ms) {
+    return RequestDataMode("ATO", timeout_ms);
+}
+
+// While multiplexing, the data mode command goes out on DLCI 2 from the caller's thread
+// and the pipe opens there; otherwise the UART itself turns into the pipe
+bool EC800AtModem::RequestDataMode(const std::string& command, int timeout_ms) {
+    if (data_mode_) {
+        return true;
+    }
+    AtChannel& channel = cmux_active_ ? *data_channel_ : at_channel_;
+    data_mode_channel_ = &channel;
+    data_mode_requested_ = true;
+    bool ok = DataCommand(channel, command, timeout_ms);
+    data_mode_requested_ = false;
+    if (!ok || !data_mode_) {
+        ESP_LOGE(TAG, "failed to enter data mode: %s", command.c_str());
+        return false;
+    }
+    last_raw_write_us_ = esp_timer_get_time();
+    return true;
+}
+
+// DLCI 2 has no command task; its few commands are run by the caller
+bool EC800AtModem::DataCommand(AtChannel& channel, const std::string& command, int timeout_ms) {
+    if (&channel == &at_channel_) {
+        return Command(command, timeout_ms, AtCommandPriority::Realtime);
+    }
+    auto handle = std::make_shared<EC800AtCommand>(command, timeout_ms > 0 ? timeout_ms : DEFAULT_COMMAND_TIMEOUT, AtCommandPriority::Realtime);
+    ExecuteCommand(channel, handle);
+    return handle->ok();
+}
+
+int EC800AtModem::WriteRaw(const char* data, size_t length) {
+    std::lock_guard<std::mutex> lock(data_mode_mutex_);
+    if (!data_mode_) {
+        return -1;
+    }
+    int ret = WriteUart(*data_mode_channel_, data, length);
+    last_raw_write_us_ = esp_timer_get_time();
+    return ret;
+}
+
+bool EC800AtModem::ExitDataMode() {
+    auto escape = std::make_shared<EC800AtCommand>("+++", AT_DATA_MODE_GUARD_MS * 2, AtCommandPriority::Realtime);
+    AtChannel* channel;
+    {
+        std::lock_guard<std::mutex> lock(data_mode_mutex_);
+        if (!data_mode_) {
+            return true;
+        }
+        channel = data_mode_channel_;
+        int64_t idle_ms = (esp_timer_get_time() - last_raw_write_us_) / 1000;
+        if (idle_ms < AT_DATA_MODE_GUARD_MS) {
+            vTaskDelay(pdMS_TO_TICKS(AT_DATA_MODE_GUARD_MS - idle_ms));
+        }
+        // The modem answers OK after the trailing guard time; parse lines again from here
+        {
+            std::lock_guard<std::mutex> lock(channel->in_flight_mutex);
+            channel->in_flight.push_back(escape);
+            channel->in_flight_connection_id = EC800_URC_ANY_ID;
+        }
+        channel->raw = false;
+        escape->write_time_us_ = esp_timer_get_time();
+        WriteUart(*channel, "+++", 3);
+        bool ok = escape->Wait(AT_DATA_MODE_GUARD_MS * 2);
+        DropInFlight(*channel, escape);
+        LeaveDataMode();
+        if (ok) {
+            return true;
+        }
+    }
+    // No OK seen, maybe it was lost: check the module is back in command mode
+    ESP_LOGW(TAG, "no answer to +++");
+    return DataCommand(*channel, "AT", DEFAULT_COMMAND_TIMEOUT);
+}
+
+void EC800AtModem::LeaveDataMode() {
+    AtChannel* channel = data_mode_channel_;
+    if (channel != nullptr) {
+        channel->raw = false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        data_mode_ = false;
+    }
+    queue_cv_.notify_all();
+}
+
+// The module restarted: everything it held is gone. Connections learn about it from the
+// pseudo URC "MODEM_RESET", sent from the deferred work task so that its handlers may run
+// commands, and after the handlers of the boot URC that got us here.
+void EC800AtModem::ForgetModuleState() {
+    // The module boots into command mode, whatever pipe was open is gone
+    LeaveDataMode();
+    network_ready_ = false;
+    SetIpAddress("");
+    // The module restarted, so does its timeline
+    for (auto& time_us : startup_time_us_) {
+        time_us = 0;
+    }
+    ClearConfigCache();
+    {
+        // Lookups in flight died with the module
+        std::lock_guard<std::mutex> lock(dns_mutex_);
+        dns_host_.clear();
+        dns_queue_.clear();
+    }
+    dns_cv_.notify_all();
+    {
+        std::lock_guard<std::mutex> lock(read_mutex_);
+        for (auto& [id, reads] : socket_reads_) {
+            reads.depth = 0;
+        }
+    }
+
+    // The boot message after Reset() is the restart announced there
+    int64_t reset_time_us = reset_time_us_.exchange(0);
+    if (reset_time_us != 0 && esp_timer_get_time() - reset_time_us < AT_RESET_BOOT_WINDOW_MS * 1000LL) {
+        return;
+    }
+    uint32_t generation = ++restart_generation_;
+    Defer([this, generation]() {
+        NotifyModemReset(generation);
+    }, &restart_generation_);
+}
+
+// Handlers may run commands and so must not hold mutex_, which URC dispatch needs. Owners
+// that unregister meanwhile wait in CancelDeferred() until the copies were called.
+void EC800AtModem::NotifyModemReset(uint32_t generation) {
+    if (generation != restart_generation_) {
+        return;
+    }
+    AtArgumentListEC arguments;
+    std::vector<EcCommandResponseViewCallback> handlers;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        handlers = urc_router_.Handlers(EcUrcHash("MODEM_RESET"), "MODEM_RESET", EC800_URC_ANY_ID);
+        for (auto& callback : on_data_received_view_) {
+            callback("MODEM_RESET", arguments);
+        }
+        for (auto& callback : on_data_received_) {
+            callback("MODEM_RESET", {});
+        }
+    }
+    for (auto& handler : handlers) {
+        handler("MODEM_RESET", arguments);
+    }
+}
+
+void EC800AtModem::OnMaterialReady(std::function<void()> callback) {
+    on_material_ready_ = callback;
+}
+
+// Which argument of a URC carries the connection id it belongs to
+int EC800AtModem::UrcConnectionId(uint32_t hash, const AtArgumentListEC& arguments, const AtChannel* channel) const {
+    size_t index;
+    switch (hash) {
+    case EcUrcHash("QISTATE"):
+    case EcUrcHash("QIOPEN"):
+    case EcUrcHash("MIPSTATE"):
+    case EcUrcHash("QMTOPEN"):
+    case EcUrcHash("QMTCONN"):
+    case EcUrcHash("QMTSTAT"):
+    case EcUrcHash("QMTSUB"):
+    case EcUrcHash("QMTPUBEX"):
+        index = 0;
+        break;
+    case EcUrcHash("QIURC"):
+    case EcUrcHash("MQTTURC"):
+    case EcUrcHash("MHTTPURC"):
+        index = 1;
+        break;
+    case EcUrcHash("QIRD"):
+    case EcUrcHash("QISEND"):
+        // Responses without an id belong to the connection of the command in flight, "AT+QIRD=<id>,..."
+        return channel != nullptr ? channel->in_flight_connection_id.load() : EC800_URC_ANY_ID;
+    default:
+        return EC800_URC_ANY_ID;
+    }
+    if (index >= arguments.size()) {
+        return EC800_URC_ANY_ID;
+    }
+    return arguments[index].int_value(EC800_URC_ANY_ID);
+}
+
+EC800ConnectionKind EC800AtModem::UrcConnectionKind(uint32_t hash) {
+    switch (hash) {
+    case EcUrcHash("MQTTURC"):
+        return EC800ConnectionKind::Mqtt;
+    case EcUrcHash("MHTTPURC"):
+        return EC800ConnectionKind::Http;
+    default:
+        return EC800ConnectionKind::Socket;
+    }
+}
+
+void EC800AtModem::NotifyCommandResponse(std::string_view command, const AtArgumentListEC& arguments, AtChannel* channel) {
+    auto hash = EcUrcHash(command);
+    switch (hash) {
+    case EcUrcHash("CME ERROR"):
+        if (channel != nullptr) {
+            CompleteInFlight(*channel, AtCommandResult::Error, arguments.empty() ? -1 : arguments[0].int_value());
+        }
+        return;
+/*     case EcUrcHash("MIPCALL"):
+        if (arguments.size() >= 3 && arguments[1].int_value() == 1) {
+            ip_address_ = arguments[2].string_value();
+            network_ready_ = true;
+            xEventGroupSetBits(event_group_handle_, AT_EVENT_NETWORK_READY);
+        }
+        break; */
+    case EcUrcHash("CGATT"):
+        if (arguments.size() >= 1 && arguments[0].int_value() == 1) {
+            network_ready_ = true;
+            xEventGroupSetBits(event_group_handle_, AT_EVENT_NETWORK_READY);
+        }
+        break;
+    case EcUrcHash("QCCID"):
+        if (arguments.size() >= 1) {
+            iccid_ = arguments[0].string_value();
+        }
+        break;
+    case EcUrcHash("COPS"):
+        if (arguments.size() >= 4) {
+            carrier_name_ = arguments[2].string_value();
+        }
+        break;
+    case EcUrcHash("CSQ"):
+        if (arguments.size() >= 2) {
+            csq_ = arguments[1].int_value();
+        }
+        break;
+    case EcUrcHash("MATREADY"):
+    case EcUrcHash("RDY"):
+        ForgetModuleState();
+        // The timeline starts over and the module just spoke
+        MarkStartupStage(EC800StartupStage::UartUp);
+        if (on_material_ready_) {
+            // Listeners typically reconfigure the module, which needs commands
+            Defer(on_material_ready_);
+        }
+        break;
+    case EcUrcHash("CEREG"):
+        // "+CEREG: <stat>[,"<tac>","<ci>",<act>]" as URC, "+CEREG: <n>,<stat>[,...]" in answer to AT+CEREG?
+        if (arguments.size() == 1 || (arguments.size() > 1 && arguments[1].quoted)) {
+            registration_state_ = arguments[0].int_value();
+        } else if (arguments.size() > 1) {
+            registration_state_ = arguments[1].int_value();
+        }
+        if (registration_state_ == 1 || registration_state_ == 5) {
+            // EPS registration implies the attach
+            MarkStartupStage(EC800StartupStage::Registered);
+            network_ready_ = true;
+            xEventGroupSetBits(event_group_handle_, AT_EVENT_NETWORK_READY);
+        } else {
+            xEventGroupSetBits(event_group_handle_, AT_EVENT_NETWORK_STATE);
+        }
+        break;
+    case EcUrcHash("CGEV"):
+        if (arguments.size() >= 1) {
+            auto event = arguments[0].string_value();
+            if (event.substr(0, 10) == "ME PDN ACT" || event.substr(0, 10) == "NW PDN ACT") {
+                MarkStartupStage(EC800StartupStage::PdpActive);
+            } else if (event == "NW DETACH" || event == "ME DETACH") {
+                network_ready_ = false;
+                SetIpAddress("");
+                xEventGroupSetBits(event_group_handle_, AT_EVENT_NETWORK_STATE);
+            }
+        }
+        break;
+    case EcUrcHash("QIACT"):
+        // +QIACT: <contextID>,<context_state>,<context_type>,<IP_address>
+        if (arguments.size() >= 4 && arguments[0].int_value() == 1 && arguments[1].int_value() == 1) {
+            MarkStartupStage(EC800StartupStage::PdpActive);
+            SetIpAddress(arguments[3].string_value());
+            if (!arguments[3].string_value().empty()) {
+                MarkStartupStage(EC800StartupStage::IpAssigned);
+                PreResolve();
+            }
+        }
+        break;
+    case EcUrcHash("QIURC"):
+        // DNS answers carry no connection id, keep them away from the socket handlers
+        if (arguments.size() >= 2 && arguments[0] == "dnsgip") {
+            OnDnsResult(arguments);
+            return;
+        }
+        // +QIURC: "pdpdeact",<contextID>, the network dropped the context the sockets use
+        if (arguments.size() >= 2 && arguments[0] == "pdpdeact" && arguments[1].int_value() == 1) {
+            network_ready_ = false;
+            SetIpAddress("");
+            xEventGroupSetBits(event_group_handle_, AT_EVENT_NETWORK_STATE);
+        }
+        break;
+    case EcUrcHash("CPIN"):
+        if (arguments.size() >= 1) {
+            if (arguments[0].string_value() == "READY") {
+                pin_ready_ = 1;
+                MarkStartupStage(EC800StartupStage::SimReady);
+            } else {
+                pin_ready_ = 2;
+            }
+            xEventGroupSetBits(event_group_handle_, AT_EVENT_NETWORK_STATE);
+        }
+        break;
+    default:
+        break;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    urc_router_.Dispatch(hash, command, UrcConnectionId(hash, arguments, channel), arguments);
+    for (auto& callback : on_data_received_view_) {
+        callback(command, arguments);
+    }
+    if (!on_data_received_.empty()) {
+        std::string command_string(command);
+        auto values = ToArgumentValues(arguments);
+        for (auto& callback : on_data_received_) {
+            callback(command_string, values);
+        }
+    }
+}
+
+void EC800AtModem::EncodeHexAppend(std::string& dest, const char* data, size_t length) {
+    size_t offset = dest.size();
+    dest.resize(offset + length * 2);
+    EC800Hex::Encode(&dest[offset], data, length);
+}
+
+bool EC800AtModem::DecodeHexAppend(std::string& dest, const char* data, size_t length) {
+    size_t offset = dest.size();
+    dest.resize(offset + length / 2);
+    if (!EC800Hex::Decode(&dest[offset], data, length)) {
+        dest.resize(offset);
+        ESP_LOGW(TAG, "invalid hex data, %u characters", (unsigned)length);
+        RecordLinkError();
+        return false;
     }
+    return true;
 }
 
 std::string EC800AtModem::EncodeHex(const std::string& data) {
@@ -398,14 +2675,18 @@ std::string EC800AtModem::EncodeHex(const std::string& data) {
     return encoded;
 }
 
-std::string EC800AtModem::DecodeHex(const std::string& data) {
+std::string EC800AtModem::DecodeHex(std::string_view data) {
     std::string decoded;
-    DecodeHexAppend(decoded, data.c_str(), data.size());
+    DecodeHexAppend(decoded, data.data(), data.size());
     return decoded;
 }
 
 void EC800AtModem::Reset() {
-    Command("AT+MREBOOT=0");
+    // A hung pipe would hold the command forever; the module leaves data mode as it restarts
+    LeaveDataMode();
+    Command("AT+CFUN=1,1", AT_RESET_TIMEOUT_MS, AtCommandPriority::Realtime);
+    ForgetModuleState();
+    reset_time_us_ = esp_timer_get_time();
 }
 
 void EC800AtModem::ResetConnections() {
@@ -0,0 +1,105 @@
+#include "ec800_at_stats.h"
+#include "ec800_urc_router.h"
+#include <algorithm>
+#include <cstring>
+
+EC800AtStats::EC800AtStats() {
+    Reset();
+}
+
+std::string_view EC800AtStats::Verb(std::string_view command) {
+    if (command.size() < 2 || (command[0] != 'A' && command[0] != 'a') || (command[1] != 'T' && command[1] != 't')) {
+        return "DATA";
+    }
+    command.remove_prefix(2);
+    if (command.empty()) {
+        return "AT";
+    }
+    if (command[0] == '+' || command[0] == '&') {
+        command.remove_prefix(1);
+    }
+    auto end = command.find_first_of("=?;");
+    return command.substr(0, std::min(end, (size_t)AT_STATS_VERB_LENGTH - 1));
+}
+
+AtVerbStats& EC800AtStats::Find(std::string_view verb) {
+    auto hash = EcUrcHash(verb);
+    for (size_t i = 0; i < size_; i++) {
+        if (hashes_[i] == hash && verb == stats_[i].verb) {
+            return stats_[i];
+        }
+    }
+    // The last slot collects everything once the table is full
+    if (size_ == AT_STATS_MAX_VERBS - 1) {
+        verb = "OTHER";
+        hash = EcUrcHash(verb);
+        if (hashes_[size_] == hash) {
+            return stats_[size_];
+        }
+    }
+    auto& stats = stats_[size_];
+    hashes_[size_] = hash;
+    memcpy(stats.verb, verb.data(), verb.size());
+    stats.verb[verb.size()] = '\0';
+    if (size_ < AT_STATS_MAX_VERBS - 1) {
+        size_++;
+    }
+    return stats;
+}
+
+void EC800AtStats::Record(EC800AtCommand& command) {
+    auto result = command.result();
+    uint32_t latency_us = 0;
+    if (command.write_time_us() > 0 && command.complete_time_us() > command.write_time_us()) {
+        latency_us = command.complete_time_us() - command.write_time_us();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& stats = Find(Verb(command.command()));
+    stats.count++;
+    switch (result) {
+    case AtCommandResult::Ok:
+        stats.ok++;
+        break;
+    case AtCommandResult::Error:
+        stats.error++;
+        break;
+    case AtCommandResult::Timeout:
+        stats.timeout++;
+        return;
+    case AtCommandResult::Dropped:
+        stats.dropped++;
+        return;
+    default:
+        return;
+    }
+
+    stats.latency_min_us = std::min(stats.latency_min_us, latency_us);
+    stats.latency_max_us = std::max(stats.latency_max_us, latency_us);
+    stats.latency_total_us += latency_us;
+    size_t bucket = 0;
+    uint32_t latency_ms = latency_us / 1000;
+    while (bucket + 1 < AT_STATS_LATENCY_BUCKETS && latency_ms >= AtVerbStats::BucketLimitMs(bucket)) {
+        bucket++;
+    }
+    stats.latency_histogram[bucket]++;
+}
+
+std::vector<AtVerbStats> EC800AtStats::Snapshot() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t count = size_;
+    if (count == AT_STATS_MAX_VERBS - 1 && stats_[count].count > 0) {
+        count++;
+    }
+    return std::vector<AtVerbStats>(stats_, stats_ + count);
+}
+
+void EC800AtStats::Reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    memset(hashes_, 0, sizeof(hashes_));
+    memset(stats_, 0, sizeof(stats_));
+    for (auto& stats : stats_) {
+        stats.latency_min_us = UINT32_MAX;
+    }
+    size_ = 0;
+}
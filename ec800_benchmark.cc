@@ -0,0 +1,190 @@
+#include "ec800_benchmark.h"
+#include "ec800_hex.h"
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <algorithm>
+#include <string>
+
+static const char* TAG = "EC800Benchmark";
+
+// The byte-wise codec EC800Hex replaced, kept as the baseline
+static void ReferenceEncodeHex(std::string& dest, const char* data, size_t length) {
+    static const char hex_chars[] = "0123456789ABCDEF";
+    dest.reserve(dest.size() + length * 2);
+    for (size_t i = 0; i < length; i++) {
+        dest.push_back(hex_chars[(data[i] & 0xF0) >> 4]);
+        dest.push_back(hex_chars[data[i] & 0x0F]);
+    }
+}
+
+static uint8_t ReferenceHexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return 0;
+}
+
+static void ReferenceDecodeHex(std::string& dest, const char* data, size_t length) {
+    dest.reserve(dest.size() + length / 2);
+    for (size_t i = 0; i + 1 < length; i += 2) {
+        dest.push_back((ReferenceHexValue(data[i]) << 4) | ReferenceHexValue(data[i + 1]));
+    }
+}
+
+void EC800BenchmarkResult::Add(uint32_t us) {
+    count++;
+    min_us = std::min(min_us, us);
+    max_us = std::max(max_us, us);
+    total_us += us;
+}
+
+EC800Benchmark::EC800Benchmark(EC800AtModem& modem) : modem_(modem) {
+    event_group_handle_ = xEventGroupCreate();
+}
+
+EC800Benchmark::~EC800Benchmark() {
+    vEventGroupDelete(event_group_handle_);
+}
+
+EC800BenchmarkResult EC800Benchmark::CommandLatency(int rounds) {
+    auto result = MeasureCommands("command latency", rounds);
+    Log(result);
+    return result;
+}
+
+EC800BenchmarkResult EC800Benchmark::CommandLatencyUnderLoad(int connection_id, int rounds) {
+    bulk_connection_id_ = connection_id;
+    bulk_bytes_ = 0;
+    xEventGroupClearBits(event_group_handle_, BENCHMARK_EVENT_STOP | BENCHMARK_EVENT_STOPPED);
+    xTaskCreate([](void* arg) {
+        auto benchmark = (EC800Benchmark*)arg;
+        benchmark->BulkTask();
+        xEventGroupSetBits(benchmark->event_group_handle_, BENCHMARK_EVENT_STOPPED);
+        vTaskDelete(NULL);
+    }, "modem_benchmark", BENCHMARK_TASK_STACK_SIZE, this, BENCHMARK_TASK_PRIORITY, nullptr);
+
+    int64_t start_us = esp_timer_get_time();
+    auto result = MeasureCommands(modem_.cmux_active() ? "command latency under load, cmux" : "command latency under load", rounds);
+    int64_t elapsed_us = esp_timer_get_time() - start_us;
+
+    xEventGroupSetBits(event_group_handle_, BENCHMARK_EVENT_STOP);
+    xEventGroupWaitBits(event_group_handle_, BENCHMARK_EVENT_STOPPED, pdFALSE, pdFALSE, portMAX_DELAY);
+    ESP_LOGI(TAG, "bulk load: %lu bytes, %lu kbit/s", (unsigned long)bulk_bytes_,
+        (unsigned long)(elapsed_us > 0 ? bulk_bytes_ * 8000ULL / elapsed_us : 0));
+    Log(result);
+    return result;
+}
+
+EC800BenchmarkResult EC800Benchmark::MeasureCommands(const char* name, int rounds) {
+    EC800BenchmarkResult result;
+    result.name = name;
+    for (int i = 0; i < rounds; i++) {
+        int64_t start_us = esp_timer_get_time();
+        if (modem_.Command(BENCHMARK_PROBE_COMMAND)) {
+            result.Add(esp_timer_get_time() - start_us);
+        } else {
+            result.failed++;
+        }
+    }
+    return result;
+}
+
+std::vector<EC800BenchmarkResult> EC800Benchmark::UrcLatency(int rounds) {
+    std::vector<EC800BenchmarkResult> results;
+    if (modem_.urc_latency_probe()) {
+        ESP_LOGW(TAG, "URC latency probe already enabled, the first run is timed from the RX edge too");
+    }
+    results.push_back(MeasureUrcs("urc latency, from uart event", rounds));
+    if (modem_.EnableUrcLatencyProbe()) {
+        results.push_back(MeasureUrcs("urc latency, from rx edge", rounds));
+    }
+    for (auto& result : results) {
+        Log(result);
+    }
+    return results;
+}
+
+// The "+CSQ: ..." answer of every probe command goes through the URC path
+EC800BenchmarkResult EC800Benchmark::MeasureUrcs(const char* name, int rounds) {
+    EC800BenchmarkResult result;
+    result.name = name;
+    modem_.ResetUrcLatencyStats();
+    for (int i = 0; i < rounds; i++) {
+        if (!modem_.Command(BENCHMARK_PROBE_COMMAND)) {
+            result.failed++;
+        }
+    }
+    auto stats = modem_.GetUrcLatencyStats();
+    result.count = stats.count;
+    result.min_us = stats.min_us;
+    result.max_us = stats.max_us;
+    result.total_us = stats.total_us;
+    return result;
+}
+
+void EC800Benchmark::BulkTask() {
+    std::string chunk(BENCHMARK_BULK_CHUNK_SIZE, 'x');
+    std::string command = "AT+QISEND=" + std::to_string(bulk_connection_id_) + "," + std::to_string(chunk.size());
+    while (!(xEventGroupGetBits(event_group_handle_) & BENCHMARK_EVENT_STOP)) {
+        if (modem_.data_mode()) {
+            if (modem_.WriteRaw(chunk.data(), chunk.size()) < 0) {
+                break;
+            }
+        } else if (!modem_.CommandWithData(command, chunk, DEFAULT_COMMAND_TIMEOUT, AtCommandPriority::Realtime)) {
+            // SEND FAIL: the socket buffer is full, give it a moment
+            vTaskDelay(pdMS_TO_TICKS(10));
+            continue;
+        }
+        bulk_bytes_ += chunk.size();
+    }
+}
+
+std::vector<EC800BenchmarkResult> EC800Benchmark::HexCodec(size_t length, int rounds) {
+    std::string data(length, 0);
+    for (size_t i = 0; i < length; i++) {
+        data[i] = (char)(i * 7 + 3);
+    }
+    std::vector<EC800BenchmarkResult> results(4);
+    results[0].name = "hex encode";
+    results[1].name = "hex encode, byte-wise";
+    results[2].name = "hex decode";
+    results[3].name = "hex decode, byte-wise";
+    std::string hex(length * 2, 0);
+    std::string decoded(length, 0);
+    std::string reference;
+    for (int i = 0; i < rounds; i++) {
+        int64_t start_us = esp_timer_get_time();
+        EC800Hex::Encode(&hex[0], data.data(), length);
+        results[0].Add(esp_timer_get_time() - start_us);
+
+        reference.clear();
+        start_us = esp_timer_get_time();
+        ReferenceEncodeHex(reference, data.data(), length);
+        results[1].Add(esp_timer_get_time() - start_us);
+        if (reference != hex) {
+            results[0].failed++;
+        }
+
+        start_us = esp_timer_get_time();
+        bool ok = EC800Hex::Decode(&decoded[0], hex.data(), hex.size());
+        results[2].Add(esp_timer_get_time() - start_us);
+        if (!ok || decoded != data) {
+            results[2].failed++;
+        }
+
+        reference.clear();
+        start_us = esp_timer_get_time();
+        ReferenceDecodeHex(reference, hex.data(), hex.size());
+        results[3].Add(esp_timer_get_time() - start_us);
+    }
+    for (auto& result : results) {
+        Log(result);
+    }
+    return results;
+}
+
+void EC800Benchmark::Log(const EC800BenchmarkResult& result) {
+    ESP_LOGI(TAG, "%s: %lu runs, %lu failed, min %lu us, avg %lu us, max %lu us", result.name,
+        (unsigned long)result.count, (unsigned long)result.failed, (unsigned long)(result.count > 0 ? result.min_us : 0),
+        (unsigned long)result.average_us(), (unsigned long)result.max_us);
+}
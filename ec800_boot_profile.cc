@@ -0,0 +1,163 @@
+#include "ec800_boot_profile.h"
+#include <esp_log.h>
+#include <cstdio>
+#include <cstdlib>
+#include <string_view>
+
+#ifdef ESP_PLATFORM
+#include <nvs.h>
+#endif
+
+static const char* TAG = "EC800BootProfile";
+
+std::string EC800BootProfile::Serialize() const {
+    std::string data;
+    data += "version=" + std::to_string(EC800_BOOT_PROFILE_VERSION) + "\n";
+    data += "baud=" + std::to_string(baud_rate) + "\n";
+    data += "imei=" + imei + "\n";
+    data += "iccid=" + iccid + "\n";
+    data += "firmware=" + firmware + "\n";
+    data += "capabilities=" + std::to_string(capabilities) + "\n";
+    data += "apn=" + apn + "\n";
+    return data;
+}
+
+bool EC800BootProfile::Deserialize(const std::string& data) {
+    if (data.size() > EC800_BOOT_PROFILE_MAX_SIZE) {
+        return false;
+    }
+    EC800BootProfile profile;
+    int version = 0;
+    std::string_view rest(data);
+    while (!rest.empty()) {
+        auto end = rest.find('\n');
+        if (end == std::string_view::npos) {
+            return false;
+        }
+        auto line = rest.substr(0, end);
+        rest.remove_prefix(end + 1);
+        auto separator = line.find('=');
+        if (separator == std::string_view::npos) {
+            return false;
+        }
+        auto key = line.substr(0, separator);
+        std::string value(line.substr(separator + 1));
+        if (key == "version") {
+            version = atoi(value.c_str());
+        } else if (key == "baud") {
+            profile.baud_rate = atoi(value.c_str());
+        } else if (key == "imei") {
+            profile.imei = value;
+        } else if (key == "iccid") {
+            profile.iccid = value;
+        } else if (key == "firmware") {
+            profile.firmware = value;
+        } else if (key == "capabilities") {
+            profile.capabilities = strtoul(value.c_str(), nullptr, 10);
+        } else if (key == "apn") {
+            profile.apn = value;
+        }
+        // Unknown keys are skipped so a newer writer does not break an older reader
+    }
+    if (version != EC800_BOOT_PROFILE_VERSION) {
+        ESP_LOGW(TAG, "Ignoring boot profile version %d", version);
+        return false;
+    }
+    *this = std::move(profile);
+    return true;
+}
+
+#ifdef ESP_PLATFORM
+EC800NvsProfileStorage::EC800NvsProfileStorage(const std::string& name_space, const std::string& key)
+    : name_space_(name_space), key_(key) {
+}
+
+bool EC800NvsProfileStorage::Load(EC800BootProfile& profile) {
+    nvs_handle_t handle;
+    if (nvs_open(name_space_.c_str(), NVS_READONLY, &handle) != ESP_OK) {
+        return false;
+    }
+    std::string data;
+    size_t length = 0;
+    auto err = nvs_get_blob(handle, key_.c_str(), nullptr, &length);
+    if (err == ESP_OK && length <= EC800_BOOT_PROFILE_MAX_SIZE) {
+        data.resize(length);
+        err = nvs_get_blob(handle, key_.c_str(), &data[0], &length);
+    }
+    nvs_close(handle);
+    if (err != ESP_OK) {
+        if (err != ESP_ERR_NVS_NOT_FOUND) {
+            ESP_LOGW(TAG, "Failed to read boot profile: %s", esp_err_to_name(err));
+        }
+        return false;
+    }
+    return profile.Deserialize(data);
+}
+
+bool EC800NvsProfileStorage::Save(const EC800BootProfile& profile) {
+    nvs_handle_t handle;
+    auto err = nvs_open(name_space_.c_str(), NVS_READWRITE, &handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to open NVS namespace %s: %s", name_space_.c_str(), esp_err_to_name(err));
+        return false;
+    }
+    auto data = profile.Serialize();
+    err = nvs_set_blob(handle, key_.c_str(), data.data(), data.size());
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to write boot profile: %s", esp_err_to_name(err));
+        return false;
+    }
+    return true;
+}
+
+void EC800NvsProfileStorage::Erase() {
+    nvs_handle_t handle;
+    if (nvs_open(name_space_.c_str(), NVS_READWRITE, &handle) != ESP_OK) {
+        return;
+    }
+    if (nvs_erase_key(handle, key_.c_str()) == ESP_OK) {
+        nvs_commit(handle);
+    }
+    nvs_close(handle);
+}
+#endif
+
+EC800FileProfileStorage::EC800FileProfileStorage(const std::string& path) : path_(path) {
+}
+
+bool EC800FileProfileStorage::Load(EC800BootProfile& profile) {
+    FILE* file = fopen(path_.c_str(), "rb");
+    if (file == nullptr) {
+        return false;
+    }
+    std::string data(EC800_BOOT_PROFILE_MAX_SIZE + 1, '\0');
+    data.resize(fread(&data[0], 1, data.size(), file));
+    fclose(file);
+    return profile.Deserialize(data);
+}
+
+bool EC800FileProfileStorage::Save(const EC800BootProfile& profile) {
+    auto temp_path = path_ + ".tmp";
+    FILE* file = fopen(temp_path.c_str(), "wb");
+    if (file == nullptr) {
+        ESP_LOGE(TAG, "Failed to open %s", temp_path.c_str());
+        return false;
+    }
+    auto data = profile.Serialize();
+    bool ok = fwrite(data.data(), 1, data.size(), file) == data.size();
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(temp_path.c_str(), path_.c_str()) != 0) {
+        ESP_LOGE(TAG, "Failed to write %s", path_.c_str());
+        remove(temp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+void EC800FileProfileStorage::Erase() {
+    remove(path_.c_str());
+}
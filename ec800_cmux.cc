@@ -0,0 +1,244 @@
+#include "ec800_cmux.h"
+#include <esp_log.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+static const char *TAG = "EC800Cmux";
+
+
+EC800CmuxChannel::EC800CmuxChannel(EC800Cmux& mux, uint8_t dlci) : mux_(mux), dlci_(dlci) {
+}
+
+int EC800CmuxChannel::Write(const char* data, size_t length, int timeout_ms) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    size_t sent = 0;
+    while (sent < length) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            bool ready = cv_.wait_until(lock, deadline, [this] {
+                return !open_ || (!tx_stopped_ && !mux_.aggregate_stopped_);
+            });
+            if (!open_) {
+                return -1;
+            }
+            if (!ready) {
+                ESP_LOGW(TAG, "DLCI %d write timeout, flow stopped", dlci_);
+                return sent > 0 ? (int)sent : -1;
+            }
+        }
+        size_t chunk = std::min(length - sent, (size_t)CMUX_FRAME_SIZE);
+        if (mux_.WriteFrame(dlci_, CMUX_UIH, (const uint8_t*)data + sent, chunk) < 0) {
+            return -1;
+        }
+        sent += chunk;
+    }
+    return sent;
+}
+
+void EC800CmuxChannel::Receive(const uint8_t* data, size_t length) {
+    if (!on_receive_) {
+        ESP_LOGW(TAG, "DLCI %d has no receiver, dropping %u bytes", dlci_, (unsigned)length);
+        return;
+    }
+    on_receive_((const char*)data, length);
+}
+
+void EC800CmuxChannel::SetOpen(bool open) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        open_ = open;
+        if (open) {
+            tx_stopped_ = false;
+        }
+    }
+    cv_.notify_all();
+}
+
+void EC800CmuxChannel::SetTxStopped(bool stopped) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tx_stopped_ = stopped;
+    }
+    cv_.notify_all();
+}
+
+EC800Cmux::EC800Cmux(Writer writer, size_t channel_count) : writer_(std::move(writer)) {
+    channel_count = std::min(std::max(channel_count, (size_t)1), (size_t)CMUX_MAX_CHANNELS);
+    for (size_t dlci = 0; dlci <= channel_count; dlci++) {
+        channels_.emplace_back(new EC800CmuxChannel(*this, dlci));
+    }
+    codec_.OnFrame([this](const EC800CmuxFrame& frame) {
+        OnFrame(frame);
+    });
+}
+
+bool EC800Cmux::Open() {
+    closed_ = false;
+    aggregate_stopped_ = false;
+    for (size_t dlci = 0; dlci < channels_.size(); dlci++) {
+        if (!OpenDlci(dlci)) {
+            ESP_LOGE(TAG, "Failed to open DLCI %u", (unsigned)dlci);
+            return false;
+        }
+        if (dlci != EC800_CMUX_CONTROL_DLCI) {
+            // Signal DTR/RTS on the new channel, some firmwares stay silent without it
+            SendMsc(dlci, false);
+        }
+    }
+    ESP_LOGI(TAG, "CMUX open with %u channels", (unsigned)channel_count());
+    return true;
+}
+
+bool EC800Cmux::OpenDlci(uint8_t dlci) {
+    auto& channel = channels_[dlci];
+    WriteFrame(dlci, CMUX_SABM | CMUX_PF, nullptr, 0);
+    std::unique_lock<std::mutex> lock(channel->mutex_);
+    return channel->cv_.wait_for(lock, std::chrono::milliseconds(CMUX_OPEN_TIMEOUT_MS), [&channel] {
+        return channel->open_;
+    });
+}
+
+bool EC800Cmux::Close(int timeout_ms) {
+    if (closed_) {
+        return true;
+    }
+    closed_ = true;
+    WriteControlMessage(CMUX_MSG_CLD | CMUX_CR, nullptr, 0);
+    for (size_t dlci = EC800_CMUX_AT_DLCI; dlci < channels_.size(); dlci++) {
+        channels_[dlci]->SetOpen(false);
+    }
+    // The control channel stays open until the CLD response, see OnControlMessage()
+    auto& control = channels_[EC800_CMUX_CONTROL_DLCI];
+    bool acked;
+    {
+        std::unique_lock<std::mutex> lock(control->mutex_);
+        acked = control->cv_.wait_for(lock, std::chrono::milliseconds(timeout_ms), [&control] {
+            return !control->open_;
+        });
+    }
+    control->SetOpen(false);
+    if (!acked) {
+        ESP_LOGW(TAG, "CMUX close not acknowledged");
+    }
+    return acked;
+}
+
+EC800CmuxChannel* EC800Cmux::channel(int dlci) {
+    if (dlci <= EC800_CMUX_CONTROL_DLCI || dlci >= (int)channels_.size()) {
+        return nullptr;
+    }
+    return channels_[dlci].get();
+}
+
+void EC800Cmux::Input(const char* data, size_t length) {
+    codec_.Decode((const uint8_t*)data, length);
+}
+
+int EC800Cmux::WriteFrame(uint8_t dlci, uint8_t control, const uint8_t* data, size_t length) {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    tx_frame_.clear();
+    EC800CmuxCodec::Encode(tx_frame_, dlci, control, data, length);
+    return writer_(tx_frame_.data(), tx_frame_.size());
+}
+
+void EC800Cmux::WriteControlMessage(uint8_t type, const uint8_t* values, size_t length) {
+    uint8_t message[2 + 8];
+    length = std::min(length, sizeof(message) - 2);
+    message[0] = type;
+    message[1] = (length << 1) | CMUX_EA;
+    if (length > 0) {
+        memcpy(message + 2, values, length);
+    }
+    WriteFrame(EC800_CMUX_CONTROL_DLCI, CMUX_UIH, message, length + 2);
+}
+
+void EC800Cmux::SendMsc(uint8_t dlci, bool stop) {
+    uint8_t values[2];
+    values[0] = (dlci << 2) | CMUX_CR | CMUX_EA;
+    values[1] = CMUX_EA | CMUX_V24_RTC | CMUX_V24_RTR | CMUX_V24_DV | (stop ? CMUX_V24_FC : 0);
+    WriteControlMessage(CMUX_MSG_MSC | CMUX_CR, values, sizeof(values));
+}
+
+void EC800Cmux::OnFrame(const EC800CmuxFrame& frame) {
+    if (frame.dlci >= channels_.size()) {
+        ESP_LOGW(TAG, "Frame for unknown DLCI %d", frame.dlci);
+        return;
+    }
+    auto& channel = channels_[frame.dlci];
+    switch (frame.type()) {
+    case CMUX_UIH:
+    case CMUX_UI:
+        if (frame.dlci == EC800_CMUX_CONTROL_DLCI) {
+            OnControlMessage(frame.data, frame.length);
+        } else {
+            channel->Receive(frame.data, frame.length);
+        }
+        break;
+    case CMUX_UA:
+        channel->SetOpen(!closed_);
+        break;
+    case CMUX_DM:
+    case CMUX_DISC:
+        channel->SetOpen(false);
+        if (frame.type() == CMUX_DISC) {
+            WriteFrame(frame.dlci, CMUX_UA | CMUX_PF, nullptr, 0);
+        }
+        break;
+    default:
+        ESP_LOGW(TAG, "Unhandled frame 0x%02x on DLCI %d", frame.control, frame.dlci);
+        break;
+    }
+}
+
+void EC800Cmux::OnControlMessage(const uint8_t* data, size_t length) {
+    if (length < 2) {
+        return;
+    }
+    uint8_t type = data[0];
+    bool command = type & CMUX_CR;
+    size_t value_length = data[1] >> 1;
+    const uint8_t* values = data + 2;
+    if (value_length > length - 2) {
+        return;
+    }
+
+    switch (type & ~CMUX_CR) {
+    case CMUX_MSG_MSC:
+        if (command && value_length >= 2) {
+            uint8_t dlci = values[0] >> 2;
+            if (dlci > EC800_CMUX_CONTROL_DLCI && dlci < channels_.size()) {
+                channels_[dlci]->SetTxStopped(values[1] & CMUX_V24_FC);
+            }
+        }
+        break;
+    case CMUX_MSG_FCON:
+    case CMUX_MSG_FCOFF:
+        if (command) {
+            aggregate_stopped_ = (type & ~CMUX_CR) == CMUX_MSG_FCOFF;
+            for (auto& channel : channels_) {
+                channel->cv_.notify_all();
+            }
+        }
+        break;
+    case CMUX_MSG_CLD:
+        if (!command) {
+            ESP_LOGI(TAG, "CMUX closed");
+            channels_[EC800_CMUX_CONTROL_DLCI]->SetOpen(false);
+        }
+        break;
+    case CMUX_MSG_TEST:
+        break;
+    default:
+        if (command) {
+            // Not supported command, answer with NSC carrying the type
+            WriteControlMessage(CMUX_MSG_NSC, &type, 1);
+        }
+        return;
+    }
+
+    // Acknowledge commands by echoing them back as responses
+    if (command) {
+        WriteControlMessage(type & ~CMUX_CR, values, value_length);
+    }
+}
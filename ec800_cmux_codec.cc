@@ -0,0 +1,174 @@
+#include "ec800_cmux_codec.h"
+#include <algorithm>
+#include <cstring>
+
+// CRC-8 as in 27.010 annex B: polynomial x^8+x^2+x+1, reflected (0xE0), initial 0xFF
+static constexpr uint8_t FcsEntry(uint8_t value) {
+    for (int i = 0; i < 8; i++) {
+        value = (value & 1) ? (value >> 1) ^ 0xE0 : value >> 1;
+    }
+    return value;
+}
+
+struct FcsTable {
+    uint8_t values[256];
+    constexpr FcsTable() : values() {
+        for (int i = 0; i < 256; i++) {
+            values[i] = FcsEntry(i);
+        }
+    }
+};
+
+static constexpr FcsTable fcs_table;
+#define CMUX_FCS_GOOD 0xCF
+
+static inline uint8_t FcsUpdate(uint8_t fcs, uint8_t byte) {
+    return fcs_table.values[fcs ^ byte];
+}
+
+uint8_t EC800CmuxCodec::Fcs8(const uint8_t* data, size_t length) {
+    uint8_t fcs = 0xFF;
+    while (length--) {
+        fcs = FcsUpdate(fcs, *data++);
+    }
+    return 0xFF - fcs;
+}
+
+void EC800CmuxCodec::Encode(std::string& out, uint8_t dlci, uint8_t control, const uint8_t* data, size_t length, bool command) {
+    uint8_t header[4];
+    size_t header_length = 0;
+    header[header_length++] = (dlci << 2) | (command ? CMUX_CR : 0) | CMUX_EA;
+    header[header_length++] = control;
+    if (length < 128) {
+        header[header_length++] = (length << 1) | CMUX_EA;
+    } else {
+        header[header_length++] = length << 1;
+        header[header_length++] = length >> 7;
+    }
+
+    uint8_t fcs = 0xFF;
+    for (size_t i = 0; i < header_length; i++) {
+        fcs = FcsUpdate(fcs, header[i]);
+    }
+    if ((control & ~CMUX_PF) != CMUX_UIH) {
+        for (size_t i = 0; i < length; i++) {
+            fcs = FcsUpdate(fcs, data[i]);
+        }
+    }
+
+    out.reserve(out.size() + length + 7);
+    out.push_back((char)CMUX_FLAG);
+    out.append((const char*)header, header_length);
+    out.append((const char*)data, length);
+    out.push_back((char)(0xFF - fcs));
+    out.push_back((char)CMUX_FLAG);
+}
+
+void EC800CmuxCodec::Decode(const uint8_t* data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        uint8_t byte = data[i];
+        switch (state_) {
+        case State::Flag:
+            if (byte == CMUX_FLAG) {
+                state_ = State::Address;
+            }
+            break;
+        case State::Address:
+            // Consecutive flags: closing flag of the previous frame and opening flag of this one
+            if (byte == CMUX_FLAG) {
+                break;
+            }
+            header_length_ = 0;
+            header_[header_length_++] = byte;
+            state_ = State::Control;
+            break;
+        case State::Control:
+            header_[header_length_++] = byte;
+            state_ = State::Length;
+            break;
+        case State::Length:
+            header_[header_length_++] = byte;
+            length_ = byte >> 1;
+            if (byte & CMUX_EA) {
+                BeginData();
+            } else {
+                state_ = State::Length2;
+            }
+            break;
+        case State::Length2:
+            header_[header_length_++] = byte;
+            length_ |= (size_t)byte << 7;
+            BeginData();
+            break;
+        case State::Data: {
+            // Copy as much of the information field as this read holds
+            size_t chunk = std::min(length_ - received_, length - i);
+            memcpy(data_ + received_, data + i, chunk);
+            received_ += chunk;
+            i += chunk - 1;
+            if (received_ == length_) {
+                state_ = State::Fcs;
+            }
+            break;
+        }
+        case State::Fcs:
+            fcs_ = byte;
+            state_ = State::End;
+            break;
+        case State::End:
+            if (byte == CMUX_FLAG) {
+                EndFrame();
+                state_ = State::Address;
+            } else {
+                // Lost sync, wait for the next flag
+                fcs_error_count_++;
+                state_ = State::Flag;
+            }
+            break;
+        }
+    }
+}
+
+void EC800CmuxCodec::BeginData() {
+    received_ = 0;
+    if (length_ > sizeof(data_)) {
+        overrun_count_++;
+        state_ = State::Flag;
+    } else {
+        state_ = length_ > 0 ? State::Data : State::Fcs;
+    }
+}
+
+void EC800CmuxCodec::EndFrame() {
+    uint8_t fcs = 0xFF;
+    for (size_t i = 0; i < header_length_; i++) {
+        fcs = FcsUpdate(fcs, header_[i]);
+    }
+    if ((header_[1] & ~CMUX_PF) != CMUX_UIH) {
+        for (size_t i = 0; i < length_; i++) {
+            fcs = FcsUpdate(fcs, data_[i]);
+        }
+    }
+    if (FcsUpdate(fcs, fcs_) != CMUX_FCS_GOOD) {
+        fcs_error_count_++;
+        return;
+    }
+
+    frame_count_++;
+    if (on_frame_) {
+        EC800CmuxFrame frame;
+        frame.dlci = header_[0] >> 2;
+        frame.control = header_[1];
+        frame.command = header_[0] & CMUX_CR;
+        frame.data = data_;
+        frame.length = length_;
+        on_frame_(frame);
+    }
+}
+
+void EC800CmuxCodec::Reset() {
+    state_ = State::Flag;
+    header_length_ = 0;
+    length_ = 0;
+    received_ = 0;
+}
@@ -0,0 +1,56 @@
+#include "ec800_dns_cache.h"
+#include <esp_timer.h>
+#include <algorithm>
+
+EC800DnsCache::EC800DnsCache(size_t capacity) : capacity_(capacity) {
+}
+
+bool EC800DnsCache::Lookup(const std::string& host, std::string& address) const {
+    auto it = entries_.find(host);
+    if (it == entries_.end() || it->second.addresses.empty() || esp_timer_get_time() >= it->second.expires_us) {
+        return false;
+    }
+    address = it->second.addresses.front();
+    return true;
+}
+
+void EC800DnsCache::Store(const std::string& host, std::vector<std::string> addresses, int ttl_s) {
+    if (addresses.empty()) {
+        return;
+    }
+    if (ttl_s <= 0) {
+        ttl_s = DNS_CACHE_DEFAULT_TTL_S;
+    }
+    ttl_s = std::min(ttl_s, DNS_CACHE_MAX_TTL_S);
+
+    if (entries_.find(host) == entries_.end() && entries_.size() >= capacity_) {
+        auto oldest = std::min_element(entries_.begin(), entries_.end(), [](const auto& a, const auto& b) {
+            return a.second.expires_us < b.second.expires_us;
+        });
+        entries_.erase(oldest);
+    }
+    entries_[host] = Entry{std::move(addresses), esp_timer_get_time() + ttl_s * 1000000LL};
+}
+
+void EC800DnsCache::Invalidate(const std::string& host) {
+    entries_.erase(host);
+}
+
+void EC800DnsCache::Clear() {
+    entries_.clear();
+}
+
+bool EC800DnsCache::IsAddress(std::string_view host) {
+    if (host.find(':') != std::string_view::npos) {
+        return true;
+    }
+    int dots = 0;
+    for (char c : host) {
+        if (c == '.') {
+            dots++;
+        } else if (c < '0' || c > '9') {
+            return false;
+        }
+    }
+    return dots == 3;
+}
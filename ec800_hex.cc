@@ -0,0 +1,134 @@
+#include "ec800_hex.h"
+#include <cstdint>
+#include <cstring>
+
+#if !defined(ESP_PLATFORM) && defined(__SSSE3__)
+#include <tmmintrin.h>
+#define EC800_HEX_SSSE3 1
+#endif
+
+static const char hex_chars[] = "0123456789ABCDEF";
+// Marks a non-hex character; any valid value ORed together stays below 0x10
+#define HEX_INVALID 0xFF
+
+struct HexTables {
+    // Two output characters per input byte
+    char encode[256][2];
+    uint8_t decode[256];
+
+    constexpr HexTables() : encode(), decode() {
+        for (int i = 0; i < 256; i++) {
+            encode[i][0] = hex_chars[i >> 4];
+            encode[i][1] = hex_chars[i & 0x0F];
+            decode[i] = HEX_INVALID;
+        }
+        for (int i = 0; i < 10; i++) {
+            decode['0' + i] = i;
+        }
+        for (int i = 0; i < 6; i++) {
+            decode['A' + i] = 10 + i;
+            decode['a' + i] = 10 + i;
+        }
+    }
+};
+
+static constexpr HexTables hex_tables;
+
+#ifdef EC800_HEX_SSSE3
+// 16 bytes -> 32 characters
+static size_t EncodeSsse3(char* out, const uint8_t* data, size_t length) {
+    const __m128i digits = _mm_loadu_si128((const __m128i*)hex_chars);
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i in = _mm_loadu_si128((const __m128i*)(data + i));
+        __m128i high = _mm_shuffle_epi8(digits, _mm_and_si128(_mm_srli_epi16(in, 4), nibble));
+        __m128i low = _mm_shuffle_epi8(digits, _mm_and_si128(in, nibble));
+        _mm_storeu_si128((__m128i*)(out + i * 2), _mm_unpacklo_epi8(high, low));
+        _mm_storeu_si128((__m128i*)(out + i * 2 + 16), _mm_unpackhi_epi8(high, low));
+    }
+    return i;
+}
+
+// 32 characters -> 16 bytes; returns the characters consumed, stops at the first invalid block
+static size_t DecodeSsse3(uint8_t* out, const char* hex, size_t length) {
+    const __m128i zero_char = _mm_set1_epi8('0');
+    const __m128i a_char = _mm_set1_epi8('a');
+    const __m128i lower = _mm_set1_epi8(0x20);
+    const __m128i minus_one = _mm_set1_epi8(-1);
+    const __m128i ten = _mm_set1_epi8(10);
+    const __m128i six = _mm_set1_epi8(6);
+    const __m128i weights = _mm_set1_epi16(0x0110);  // high nibble * 16 + low nibble
+
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m128i values[2];
+        int valid = 0xFFFF;
+        for (int half = 0; half < 2; half++) {
+            __m128i in = _mm_loadu_si128((const __m128i*)(hex + i + half * 16));
+            __m128i digit = _mm_sub_epi8(in, zero_char);
+            __m128i is_digit = _mm_and_si128(_mm_cmpgt_epi8(digit, minus_one), _mm_cmplt_epi8(digit, ten));
+            __m128i alpha = _mm_sub_epi8(_mm_or_si128(in, lower), a_char);
+            __m128i is_alpha = _mm_and_si128(_mm_cmpgt_epi8(alpha, minus_one), _mm_cmplt_epi8(alpha, six));
+            valid &= _mm_movemask_epi8(_mm_or_si128(is_digit, is_alpha));
+            __m128i value = _mm_or_si128(_mm_and_si128(is_digit, digit), _mm_and_si128(is_alpha, _mm_add_epi8(alpha, ten)));
+            values[half] = _mm_maddubs_epi16(value, weights);
+        }
+        if (valid != 0xFFFF) {
+            break;
+        }
+        // Both inputs are read before the store, so in-place decoding is safe
+        _mm_storeu_si128((__m128i*)(out + i / 2), _mm_packus_epi16(values[0], values[1]));
+    }
+    return i;
+}
+#endif
+
+void EC800Hex::Encode(char* out, const char* data, size_t length) {
+    auto in = (const uint8_t*)data;
+    size_t i = 0;
+#ifdef EC800_HEX_SSSE3
+    i = EncodeSsse3(out, in, length);
+#endif
+    for (; i + 4 <= length; i += 4) {
+        char* dest = out + i * 2;
+        memcpy(dest, hex_tables.encode[in[i]], 2);
+        memcpy(dest + 2, hex_tables.encode[in[i + 1]], 2);
+        memcpy(dest + 4, hex_tables.encode[in[i + 2]], 2);
+        memcpy(dest + 6, hex_tables.encode[in[i + 3]], 2);
+    }
+    for (; i < length; i++) {
+        memcpy(out + i * 2, hex_tables.encode[in[i]], 2);
+    }
+}
+
+bool EC800Hex::Decode(char* out, const char* hex, size_t length) {
+    if (length % 2 != 0) {
+        return false;
+    }
+    auto in = (const uint8_t*)hex;
+    auto dest = (uint8_t*)out;
+    const uint8_t* table = hex_tables.decode;
+    size_t i = 0;
+#ifdef EC800_HEX_SSSE3
+    i = DecodeSsse3(dest, hex, length);
+#endif
+    // Errors are collected and checked once, the loop itself has no branches per byte
+    uint8_t invalid = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint8_t n0 = table[in[i]], n1 = table[in[i + 1]], n2 = table[in[i + 2]], n3 = table[in[i + 3]];
+        uint8_t n4 = table[in[i + 4]], n5 = table[in[i + 5]], n6 = table[in[i + 6]], n7 = table[in[i + 7]];
+        invalid |= n0 | n1 | n2 | n3 | n4 | n5 | n6 | n7;
+        uint8_t* d = dest + i / 2;
+        d[0] = (n0 << 4) | n1;
+        d[1] = (n2 << 4) | n3;
+        d[2] = (n4 << 4) | n5;
+        d[3] = (n6 << 4) | n7;
+    }
+    for (; i < length; i += 2) {
+        uint8_t high = table[in[i]], low = table[in[i + 1]];
+        invalid |= high | low;
+        dest[i / 2] = (high << 4) | low;
+    }
+    return invalid < 0x10;
+}
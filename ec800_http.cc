@@ -9,47 +9,86 @@ static const char *TAG = "EC800Http";
 EC800Http::EC800Http(EC800AtModem& modem) : modem_(modem) {
     event_group_handle_ = xEventGroupCreate();
 
-    command_callback_it_ = modem_.RegisterCommandResponseCallback([this](const std::string& command, const std::vector<AtArgumentValueEC>& arguments) {
-        if (command == "MHTTPURC") {
-            if (arguments[1].int_value == http_id_) {
-                auto& type = arguments[0].string_value;
-                if (type == "header") {
-                    body_.clear();
-                    status_code_ = arguments[2].int_value;
-                    ParseResponseHeaders(modem_.DecodeHex(arguments[4].string_value));
-                    xEventGroupSetBits(event_group_handle_, EC800_HTTP_EVENT_HEADERS_RECEIVED);
-                } else if (type == "content") {
-                    // +MHTTPURC: "content",<httpid>,<content_len>,<sum_len>,<cur_len>,<data>
-                    std::string decoded_data;
-                    modem_.DecodeHexAppend(decoded_data, arguments[5].string_value.c_str(), arguments[5].string_value.length());
-
-                    std::lock_guard<std::mutex> lock(mutex_);
-                    body_.append(decoded_data);
-                    if (arguments[3].int_value >= arguments[2].int_value) {
-                        eof_ = true;
-                    }
-                    body_offset_ += arguments[4].int_value;
-                    if (arguments[3].int_value > body_offset_) {
-                        ESP_LOGE(TAG, "body_offset_: %zu, arguments[3].int_value: %d", body_offset_, arguments[3].int_value);
-                        Close();
-                        return;
-                    }
-                    cv_.notify_one();  // 使用条件变量通知
-                } else if (type == "err") {
-                    error_code_ = arguments[2].int_value;
-                    xEventGroupSetBits(event_group_handle_, EC800_HTTP_EVENT_ERROR);
-                }
-            }
-        } else if (command == "QIACT") {
-            // http_id_ = arguments[0].int_value;
-            // xEventGroupSetBits(event_group_handle_, EC800_HTTP_EVENT_INITIALIZED);
-        } else if (command == "FIFO_OVERFLOW") {
+    urc_handlers_.push_back(modem_.RegisterUrcHandler("FIFO_OVERFLOW", EC800_URC_ANY_ID, [this](std::string_view command, const AtArgumentListEC& arguments) {
+        // Only a response whose body was cut is lost
+        if (EC800AtModem::OverflowDamaged(arguments, EC800ConnectionKind::Http, http_id_)) {
             xEventGroupSetBits(event_group_handle_, EC800_HTTP_EVENT_ERROR);
-            Close();
-        } else if (command == "QHTTPREAD") {
-            xEventGroupSetBits(event_group_handle_, EC800_HTTP_EVENT_HEADERS_RECEIVED);
+            modem_.Defer([this]() { Close(); }, this);
         }
-    });
+    }));
+    urc_handlers_.push_back(modem_.RegisterUrcHandler("QHTTPREAD", EC800_URC_ANY_ID, [this](std::string_view command, const AtArgumentListEC& arguments) {
+        xEventGroupSetBits(event_group_handle_, EC800_HTTP_EVENT_HEADERS_RECEIVED);
+    }));
+}
+
+// MHTTPURC lines carry the id of their session; a handler registered before the id is
+// known would be registered for any id and see the URCs of every other instance
+void EC800Http::Subscribe() {
+    if (http_id_ < 0 || !session_handlers_.empty()) {
+        return;
+    }
+    session_handlers_.push_back(modem_.RegisterUrcHandler("MHTTPURC", http_id_, [this](std::string_view command, const AtArgumentListEC& arguments) {
+        if (arguments[1].int_value() == http_id_) {
+            auto type = arguments[0].string_value();
+            if (type == "header") {
+                body_.clear();
+                status_code_ = arguments[2].int_value();
+                ParseResponseHeaders(modem_.DecodeHex(arguments[4].string_value()));
+                xEventGroupSetBits(event_group_handle_, EC800_HTTP_EVENT_HEADERS_RECEIVED);
+            } else if (type == "err") {
+                error_code_ = arguments[2].int_value();
+                xEventGroupSetBits(event_group_handle_, EC800_HTTP_EVENT_ERROR);
+            }
+        }
+    }));
+    // +MHTTPURC: "content",<httpid>,<content_len>,<sum_len>,<cur_len>,<data>, decoded straight into body_
+    EcUrcStreamHandler content;
+    content.begin = [this](const AtArgumentListEC& header) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        chunk_ours_ = header[1].int_value() == http_id_;
+        chunk_total_ = header[2].int_value();
+        chunk_sum_ = header[3].int_value();
+        chunk_length_ = header[4].int_value();
+    };
+    content.data = [this](const char* data, size_t length) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (chunk_ours_) {
+            body_.append(data, length);
+        }
+    };
+    content.end = [this](bool ok) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!chunk_ours_) {
+                return;
+            }
+            if (chunk_sum_ >= chunk_total_) {
+                eof_ = true;
+            }
+            body_offset_ += chunk_length_;
+            if (!ok || chunk_sum_ > (int)body_offset_) {
+                ESP_LOGE(TAG, "body_offset_: %zu, sum_len: %d, valid: %d", body_offset_, chunk_sum_, ok);
+                ok = false;
+            }
+        }
+        if (!ok) {
+            modem_.Defer([this]() { Close(); }, this);
+            return;
+        }
+        cv_.notify_one();  // 使用条件变量通知
+    };
+    urc_streams_.push_back(modem_.RegisterUrcStream("MHTTPURC", "content", http_id_, 5, std::move(content)));
+}
+
+void EC800Http::Unsubscribe() {
+    for (auto id : session_handlers_) {
+        modem_.UnregisterUrcHandler(id);
+    }
+    session_handlers_.clear();
+    for (auto id : urc_streams_) {
+        modem_.UnregisterUrcStream(id);
+    }
+    urc_streams_.clear();
 }
 
 int EC800Http::Read(char* buffer, size_t buffer_size) {
@@ -81,7 +120,11 @@ EC800Http::~EC800Http() {
     if (connected_) {
         Close();
     }
-    modem_.UnregisterCommandResponseCallback(command_callback_it_);
+    Unsubscribe();
+    for (auto id : urc_handlers_) {
+        modem_.UnregisterUrcHandler(id);
+    }
+    modem_.CancelDeferred(this);
     vEventGroupDelete(event_group_handle_);
 }
 
@@ -133,46 +176,32 @@ bool EC800Http::Open(const std::string& method, const std::string& url, const st
 
     //设置需要访问的URL,步骤:配置PDP上下文->设置URL长度，超时时间->等待模组回复CONNECT->发送URL
     //配置PDP上下文ID为1
-    sprintf(command,"AT+QHTTPCFG=\"%s\",%d","contextid",1);
-    modem_.Command(command);
-    //启动输出HTTP(S)响应头信息
-    sprintf(command,"AT+QHTTPCFG=\"%s\",%d","responseheader",0);
-    modem_.Command(command);
-    //查询PDP上下文状态
-    sprintf(command,"AT+QIACT?");
-    if (!modem_.Command(command)) {
+    //配置只在变化时下发, 模组重启后重新下发; 变化的配置合并成一行发送
+    //PDP上下文ID为1, 不输出HTTP(S)响应头信息
+    std::vector<std::pair<std::string, std::string>> settings = {
+        {"QHTTPCFG contextid", "AT+QHTTPCFG=\"contextid\",1"},
+        {"QHTTPCFG responseheader", "AT+QHTTPCFG=\"responseheader\",0"},
+    };
+    //查询PDP上下文状态, 已知地址时不再查询
+    if (modem_.ip_address().empty() && !modem_.Command("AT+QIACT?")) {
         ESP_LOGE(TAG, "查询PDP上下文状态失败");
         return false;
     }
 
     //假如是HTTPS协议，需要配置SSL
     if(protocol_ == "https") {
-        sprintf(command,"AT+QHTTPCFG=\"sslctxid\",1");
-        modem_.Command(command);
-        sprintf(command,"AT+QSSLCFG=\"sslversion\",1,1");
-        modem_.Command(command);
-        sprintf(command,"AT+QSSLCFG=\"ciphersuite\",1,0x0005");
-        modem_.Command(command);
-        sprintf(command,"AT+QSSLCFG=\"seclevel\",1,0");
-        modem_.Command(command);
+        settings.push_back({"QHTTPCFG sslctxid", "AT+QHTTPCFG=\"sslctxid\",1"});
+        settings.push_back({"QSSLCFG sslversion 1", "AT+QSSLCFG=\"sslversion\",1,1"});
+        settings.push_back({"QSSLCFG ciphersuite 1", "AT+QSSLCFG=\"ciphersuite\",1,0x0005"});
+        settings.push_back({"QSSLCFG seclevel 1", "AT+QSSLCFG=\"seclevel\",1,0"});
     }
+    modem_.Configure(settings);
 
-    sprintf(command,"AT+QHTTPURL=%d,%d",host_len,80);
-    modem_.Command(command);
-    while (!modem_.http_connect_flag_)
-    {
-        vTaskDelay(1000 / portTICK_PERIOD_MS);
-        timeout--;
-        if (timeout == 0) {
-            ESP_LOGE(TAG, "等待模组回复CONNECT超时");
-            return false;
-        }
-    }
-
-    // 创建HTTP连接
+    // 等待模组回复 CONNECT 后写入 URL
     char http_url[256];
-    sprintf(http_url, "%s://%s%s", protocol_.c_str(), host_.c_str(),path_.c_str());
-    if (!modem_.Command(http_url)) {
+    snprintf(http_url, sizeof(http_url), "%s://%s%s", protocol_.c_str(), host_.c_str(),path_.c_str());
+    sprintf(command,"AT+QHTTPURL=%d,%d",(int)strlen(http_url),80);
+    if (!modem_.CommandWithData(command, http_url, timeout * 1000)) {
         ESP_LOGE(TAG, "创建HTTP连接失败");
         return false;
     }
@@ -185,6 +214,7 @@ bool EC800Http::Open(const std::string& method, const std::string& url, const st
 
     connected_ = true;
     ESP_LOGI(TAG, "HTTP 连接已创建，ID: %d", http_id_);
+    Subscribe();
 
     // Set HEX encoding OFF
     // sprintf(command, "AT+MHTTPCFG=\"encoding\",%d,0,0", http_id_);
@@ -197,8 +227,7 @@ bool EC800Http::Open(const std::string& method, const std::string& url, const st
     // Set headers
     for (const auto& header : headers_) {
         auto line = header.first + ": " + header.second;
-        sprintf(command, "AT+QHTTPCFG=\"header\",%s", line.c_str());
-        modem_.Command(command);
+        modem_.Configure("QHTTPCFG header " + header.first, "AT+QHTTPCFG=\"header\"," + line);
     }
 
     // if (!content.empty() && method_ == "POST") {
@@ -230,8 +259,7 @@ bool EC800Http::Open(const std::string& method, const std::string& url, const st
         modem_.Command(command);
     } else if(strcmp(methods[method_value],"POST") == 0) {
         sprintf(command, "AT+QHTTPPOST=%d,80,80", content.length());
-        modem_.Command(command);
-        modem_.Command(content);
+        modem_.CommandWithData(command, content, 80 * 1000);
     }
     sprintf(command, "AT+QHTTPREAD=80");
     modem_.Command(command);
@@ -291,6 +319,7 @@ void EC800Http::Close() {
     char command[32];
     sprintf(command, "AT+MHTTPDEL=%d", http_id_);
     modem_.Command(command);
+    Unsubscribe();
 
     connected_ = false;
     eof_ = true;
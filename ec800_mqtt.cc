@@ -1,79 +1,131 @@
 #include "ec800_mqtt.h"
+#include "ec800_supervisor.h"
 #include <esp_log.h>
 static const char *TAG = "EC800Mqtt";
 #define MQTT_OPENED_EVENT BIT3
-EC800Mqtt::EC800Mqtt(EC800AtModem& modem, int mqtt_id) : modem_(modem), mqtt_id_(mqtt_id) {
+#define MQTT_OPEN_FAILED_EVENT BIT4
+EC800Mqtt::EC800Mqtt(EC800AtModem& modem, int mqtt_id)
+    : modem_(modem), mqtt_id_(modem.AllocateConnectionId(EC800ConnectionKind::Mqtt, mqtt_id)) {
     event_group_handle_ = xEventGroupCreate();
+    // Without a client index nothing is registered, Connect() fails
+    if (mqtt_id_ < 0) {
+        return;
+    }
 
-    command_callback_it_ = modem_.RegisterCommandResponseCallback([this](const std::string command, const std::vector<AtArgumentValueEC>& arguments) {
-        if (command == "MQTTURC" && arguments.size() >= 2) {
-            if (arguments[1].int_value == mqtt_id_) {
-                auto type = arguments[0].string_value;
-                if (type == "conn") {
-                    if (arguments[2].int_value == 0) {
-                        xEventGroupSetBits(event_group_handle_, MQTT_CONNECTED_EVENT);
-                    } else {
-                        if (connected_) {
-                            connected_ = false;
-                            if (on_disconnected_callback_) {
-                                on_disconnected_callback_();
-                            }
-                        }
-                        xEventGroupSetBits(event_group_handle_, MQTT_DISCONNECTED_EVENT);
+    urc_handlers_.push_back(modem_.RegisterUrcHandler("MQTTURC", mqtt_id_, [this](std::string_view command, const AtArgumentListEC& arguments) {
+        auto type = arguments[0].string_value();
+        if (type == "conn") {
+            if (arguments[2].int_value() == 0) {
+                xEventGroupSetBits(event_group_handle_, MQTT_CONNECTED_EVENT);
+            } else {
+                if (connected_) {
+                    connected_ = false;
+                    if (on_disconnected_callback_) {
+                        on_disconnected_callback_();
                     }
-                    ESP_LOGI(TAG, "MQTT connection state: %s", ErrorToString(arguments[2].int_value).c_str());
-                } else if (type == "suback") {
-                } else if (type == "publish" && arguments.size() >= 7) {
-                    auto topic = arguments[3].string_value;
-                    if (arguments[4].int_value == arguments[5].int_value) {
-                        if (on_message_callback_) {
-                            on_message_callback_(topic, modem_.DecodeHex(arguments[6].string_value));
-                        }
-                    } else {
-                        message_payload_.append(modem_.DecodeHex(arguments[6].string_value));
-                        if (message_payload_.size() >= arguments[4].int_value && on_message_callback_) {
-                            on_message_callback_(topic, message_payload_);
-                            message_payload_.clear();
-                        }
-                    }
-                } else {
-                    ESP_LOGI(TAG, "unhandled MQTT event: %s", type.c_str());
                 }
+                xEventGroupSetBits(event_group_handle_, MQTT_DISCONNECTED_EVENT);
+            }
+            ESP_LOGI(TAG, "MQTT connection state: %s", ErrorToString(arguments[2].int_value()).c_str());
+        } else if (type == "suback") {
+        } else {
+            ESP_LOGI(TAG, "unhandled MQTT event: %.*s", (int)type.size(), type.data());
+        }
+    }));
+    // +MQTTURC: "publish",<id>,<msgid>,<topic>,<total_len>,<len>,<hex>, decoded straight into message_payload_
+    EcUrcStreamHandler publish;
+    publish.begin = [this](const AtArgumentListEC& header) {
+        message_topic_ = header[3].string_value();
+        message_length_ = header[4].int_value();
+    };
+    publish.data = [this](const char* data, size_t length) {
+        message_payload_.append(data, length);
+    };
+    publish.end = [this](bool ok) {
+        if (!ok) {
+            ESP_LOGE(TAG, "Invalid publish payload");
+            message_payload_.clear();
+            return;
+        }
+        if (message_payload_.size() >= message_length_) {
+            if (on_message_callback_) {
+                on_message_callback_(message_topic_, message_payload_);
             }
-        } else if (command == "QMTCONN" && arguments.size() == 2) {
-            connected_ = arguments[1].int_value != 4;
+            message_payload_.clear();
+        }
+    };
+    urc_streams_.push_back(modem_.RegisterUrcStream("MQTTURC", "publish", mqtt_id_, 6, std::move(publish)));
+    urc_handlers_.push_back(modem_.RegisterUrcHandler("QMTCONN", mqtt_id_, [this](std::string_view command, const AtArgumentListEC& arguments) {
+        if (arguments.size() == 2) {
+            connected_ = arguments[1].int_value() != 4;
             xEventGroupSetBits(event_group_handle_, MQTT_INITIALIZED_EVENT);
-        } else if (command == "QMTCONN" && arguments.size() >= 3) {
-            if (arguments[0].int_value == mqtt_id_) {
-                if (arguments[1].int_value == 0 && arguments[2].int_value == 0) {
-                    ESP_LOGI(TAG, "MQTT connection state: %s", ErrorToString(arguments[2].int_value).c_str());
-                    xEventGroupSetBits(event_group_handle_, MQTT_CONNECTED_EVENT);
-                } else {
-                    if (connected_) {
-                        connected_ = false;
-                        if (on_disconnected_callback_) {
-                            on_disconnected_callback_();
-                        }
+        } else if (arguments.size() >= 3) {
+            if (arguments[1].int_value() == 0 && arguments[2].int_value() == 0) {
+                ESP_LOGI(TAG, "MQTT connection state: %s", ErrorToString(arguments[2].int_value()).c_str());
+                xEventGroupSetBits(event_group_handle_, MQTT_CONNECTED_EVENT);
+            } else {
+                if (connected_) {
+                    connected_ = false;
+                    if (on_disconnected_callback_) {
+                        on_disconnected_callback_();
                     }
-                    xEventGroupSetBits(event_group_handle_, MQTT_DISCONNECTED_EVENT);
                 }
+                xEventGroupSetBits(event_group_handle_, MQTT_DISCONNECTED_EVENT);
             }
-        } else if (command == "QMTOPEN") {
-            if (arguments[0].int_value == mqtt_id_) {
-                if (arguments[1].int_value == 0)
-                    xEventGroupSetBits(event_group_handle_, MQTT_OPENED_EVENT);
-                }
-                ESP_LOGI(TAG, "MQTT open state: %s", ErrorToString(arguments[1].int_value).c_str());
+        }
+    }));
+    urc_handlers_.push_back(modem_.RegisterUrcHandler("QMTOPEN", mqtt_id_, [this](std::string_view command, const AtArgumentListEC& arguments) {
+        if (arguments.size() >= 2) {
+            if (arguments[1].int_value() == 0) {
+                xEventGroupSetBits(event_group_handle_, MQTT_OPENED_EVENT);
+            } else {
+                xEventGroupSetBits(event_group_handle_, MQTT_OPEN_FAILED_EVENT);
+            }
+            ESP_LOGI(TAG, "MQTT open state: %s", ErrorToString(arguments[1].int_value()).c_str());
+        }
+    }));
+    urc_handlers_.push_back(modem_.RegisterUrcHandler("FIFO_OVERFLOW", EC800_URC_ANY_ID, [this](std::string_view command, const AtArgumentListEC& arguments) {
+        // The cut publish was already dropped by its stream, the session itself is intact
+        if (EC800AtModem::OverflowDamaged(arguments, EC800ConnectionKind::Mqtt, mqtt_id_)) {
+            ESP_LOGW(TAG, "Lost a message on client %d", mqtt_id_);
+            message_payload_.clear();
+        }
+    }));
+    urc_handlers_.push_back(modem_.RegisterUrcHandler("MODEM_RESET", EC800_URC_ANY_ID, [this](std::string_view command, const AtArgumentListEC& arguments) {
+        // The session died with the module, Restore() brings it back
+        if (connected_) {
+            connected_ = false;
+            if (on_disconnected_callback_) {
+                on_disconnected_callback_();
             }
-    });
+        }
+        xEventGroupSetBits(event_group_handle_, MQTT_DISCONNECTED_EVENT);
+    }));
+    if (auto supervisor = modem_.supervisor()) {
+        supervisor->AddRestoreHandler(this, [this]() { return Restore(); });
+    }
 }
 
 EC800Mqtt::~EC800Mqtt() {
-    modem_.UnregisterCommandResponseCallback(command_callback_it_);
+    if (auto supervisor = modem_.supervisor()) {
+        supervisor->RemoveRestoreHandler(this);
+    }
+    for (auto id : urc_handlers_) {
+        modem_.UnregisterUrcHandler(id);
+    }
+    for (auto id : urc_streams_) {
+        modem_.UnregisterUrcStream(id);
+    }
+    modem_.CancelDeferred(this);
     vEventGroupDelete(event_group_handle_);
+    modem_.ReleaseConnectionId(EC800ConnectionKind::Mqtt, mqtt_id_);
 }
 
 bool EC800Mqtt::Connect(const std::string broker_address, int broker_port, const std::string client_id, const std::string username, const std::string password) {
+    if (mqtt_id_ < 0) {
+        ESP_LOGE(TAG, "No client index");
+        return false;
+    }
     broker_address_ = broker_address;
     broker_port_ = broker_port;
     client_id_ = client_id;
@@ -91,25 +143,36 @@ bool EC800Mqtt::Connect(const std::string broker_address, int broker_port, const
     //     }
     // }
 
-    if (broker_port_ == 8883) {
-        modem_.Command(std::string("AT+QMTCFG=\"SSL\",") + std::to_string(mqtt_id_) + ",1,1",3000);
-    }
-    vTaskDelay(2000 / portTICK_PERIOD_MS);
+    // Settings the module still holds from an earlier connect are skipped, the rest go out
+    // as one line
+    auto id = std::to_string(mqtt_id_);
+    std::vector<std::pair<std::string, std::string>> settings = {
+        {"QMTCFG SSL " + id, "AT+QMTCFG=\"SSL\"," + id + (broker_port_ == 8883 ? ",1,1" : ",0")},
+        {"QMTCFG version " + id, "AT+QMTCFG=\"version\"," + id + ",4"},
+        {"QMTCFG aliauth " + id, "AT+QMTCFG=\"aliauth\"," + id},
+        // Keep alive
+        {"QMTCFG qmtping " + id, "AT+QMTCFG=\"qmtping\"," + id + "," + std::to_string(keep_alive_seconds_)},
+    };
+    modem_.Configure(settings, 3000);
     // Set clean session
     // if (!modem_.Command(std::string("AT+MQTTCFG=\"clean\",") + std::to_string(mqtt_id_) + ",1")) {
     //     ESP_LOGE(TAG, "Failed to set MQTT clean session");
     //     return false;
     // }
 
-    modem_.Command(std::string("AT+QMTCFG=\"version\",") + std::to_string(mqtt_id_) + ",4",3000);
 
-    modem_.Command(std::string("AT+QMTCFG=\"aliauth\",") + std::to_string(mqtt_id_),3000);
-
-    // Set keep alive
-    modem_.Command(std::string("AT+QMTCFG=\"qmtping\",") + std::to_string(mqtt_id_) + "," + std::to_string(keep_alive_seconds_),3000);
-
-    modem_.Command("AT+QMTOPEN=" + std::to_string(mqtt_id_) + ",\"" + broker_address_ + "\"," + std::to_string(broker_port_),3000);
-    xEventGroupWaitBits(event_group_handle_, MQTT_OPENED_EVENT, pdTRUE, pdFALSE, pdMS_TO_TICKS(MQTT_CONNECT_TIMEOUT_MS));
+    // A cached broker address saves the modem's own lookup. TLS keeps the name for SNI and
+    // the certificate check; a stale address is retried once by name.
+    std::string address = broker_port_ == 8883 ? broker_address_ : modem_.ResolveCached(broker_address_);
+    xEventGroupClearBits(event_group_handle_, MQTT_OPENED_EVENT | MQTT_OPEN_FAILED_EVENT);
+    modem_.Command("AT+QMTOPEN=" + std::to_string(mqtt_id_) + ",\"" + address + "\"," + std::to_string(broker_port_),3000);
+    bits = xEventGroupWaitBits(event_group_handle_, MQTT_OPENED_EVENT | MQTT_OPEN_FAILED_EVENT, pdTRUE, pdFALSE, pdMS_TO_TICKS(MQTT_CONNECT_TIMEOUT_MS));
+    if (!(bits & MQTT_OPENED_EVENT) && address != broker_address_) {
+        ESP_LOGW(TAG, "Failed to open %s, retrying with %s", address.c_str(), broker_address_.c_str());
+        modem_.InvalidateDns(broker_address_);
+        modem_.Command("AT+QMTOPEN=" + std::to_string(mqtt_id_) + ",\"" + broker_address_ + "\"," + std::to_string(broker_port_),3000);
+        xEventGroupWaitBits(event_group_handle_, MQTT_OPENED_EVENT | MQTT_OPEN_FAILED_EVENT, pdTRUE, pdFALSE, pdMS_TO_TICKS(MQTT_CONNECT_TIMEOUT_MS));
+    }
     // 创建MQTT连接
     modem_.Command("AT+QMTCONN=" + std::to_string(mqtt_id_) + ",\"" + client_id_ + "\",\"" + username_ + "\",\"" + password_ + "\"",3000);
     // if (!modem_.Command(command)) {
@@ -125,9 +188,10 @@ bool EC800Mqtt::Connect(const std::string broker_address, int broker_port, const
     }
 
     // Set HEX encoding
-    modem_.Command("AT+QMTCFG=\"dataformat\"," + std::to_string(mqtt_id_) + ",1,1");
+    modem_.Configure("QMTCFG dataformat " + id, "AT+QMTCFG=\"dataformat\"," + id + ",1,1");
 
     connected_ = true;
+    session_ = true;
     if (on_connected_callback_) {
         on_connected_callback_();
     }
@@ -136,7 +200,7 @@ bool EC800Mqtt::Connect(const std::string broker_address, int broker_port, const
 
 bool EC800Mqtt::IsConnected() {
     // 检查这个 id 是否已经连接
-    modem_.Command(std::string("AT+QMTCONN=") + std::to_string(mqtt_id_));
+    modem_.Command(std::string("AT+QMTCONN=") + std::to_string(mqtt_id_), DEFAULT_COMMAND_TIMEOUT, AtCommandPriority::Background);
     auto bits = xEventGroupWaitBits(event_group_handle_, MQTT_INITIALIZED_EVENT, pdTRUE, pdFALSE, pdMS_TO_TICKS(MQTT_CONNECT_TIMEOUT_MS));
     if (!(bits & MQTT_INITIALIZED_EVENT)) {
         ESP_LOGE(TAG, "Failed to initialize MQTT connection");
@@ -146,6 +210,8 @@ bool EC800Mqtt::IsConnected() {
 }
 
 void EC800Mqtt::Disconnect() {
+    session_ = false;
+    subscriptions_.clear();
     if (!connected_) {
         return;
     }
@@ -159,8 +225,8 @@ bool EC800Mqtt::Publish(const std::string topic, const std::string payload, int
     std::string command = "AT+QMTPUBEX=" + std::to_string(mqtt_id_) + "," + std::to_string(mqtt_id_) + ",";
     command += std::to_string(qos) + ",0," + "\"" + topic + "\",";
     command += std::to_string(payload.size());
-    modem_.Command(command);;
-    return modem_.Command(modem_.EncodeHex(payload));
+    // dataformat 1,1: 负载以十六进制写入 '>' 提示符之后
+    return modem_.CommandWithData(command, modem_.EncodeHex(payload), DEFAULT_COMMAND_TIMEOUT, AtCommandPriority::Realtime);
 }
 
 bool EC800Mqtt::Subscribe(const std::string topic, int qos) {
@@ -168,7 +234,11 @@ bool EC800Mqtt::Subscribe(const std::string topic, int qos) {
         return false;
     }
     std::string command = "AT+MQTTSUB=" + std::to_string(mqtt_id_) + "," + std::to_string(mqtt_id_) + ",\"" + topic + "\"," + std::to_string(qos);
-    return modem_.Command(command);
+    if (!modem_.Command(command)) {
+        return false;
+    }
+    subscriptions_[topic] = qos;
+    return true;
 }
 
 bool EC800Mqtt::Unsubscribe(const std::string topic) {
@@ -176,9 +246,29 @@ bool EC800Mqtt::Unsubscribe(const std::string topic) {
         return false;
     }
     std::string command = "AT+MQTTUNSUB=" + std::to_string(mqtt_id_) + "," + std::to_string(mqtt_id_) + ",\"" + topic + "\"";
+    subscriptions_.erase(topic);
     return modem_.Command(command);
 }
 
+bool EC800Mqtt::Restore() {
+    if (!session_ || connected_) {
+        return true;
+    }
+    // Connect() and Subscribe() would rebuild the list while it is walked
+    auto subscriptions = subscriptions_;
+    if (!Connect(broker_address_, broker_port_, client_id_, username_, password_)) {
+        return false;
+    }
+    bool ok = true;
+    for (auto& [topic, qos] : subscriptions) {
+        if (!Subscribe(topic, qos)) {
+            ESP_LOGE(TAG, "Failed to resubscribe to %s", topic.c_str());
+            ok = false;
+        }
+    }
+    return ok;
+}
+
 std::string EC800Mqtt::ErrorToString(int error_code) {
     switch (error_code) {
         case 0:
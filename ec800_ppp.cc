@@ -0,0 +1,157 @@
+#include "ec800_ppp.h"
+#include "ec800_supervisor.h"
+#include <esp_log.h>
+#include <esp_netif_ppp.h>
+
+static const char *TAG = "EC800Ppp";
+
+
+EC800Ppp::EC800Ppp(EC800AtModem& modem) : modem_(modem) {
+    event_group_handle_ = xEventGroupCreate();
+    driver_.ppp = this;
+    driver_.base.post_attach = PostAttach;
+}
+
+EC800Ppp::~EC800Ppp() {
+    Stop();
+    if (ip_event_handler_ != nullptr) {
+        esp_event_handler_instance_unregister(IP_EVENT, ESP_EVENT_ANY_ID, ip_event_handler_);
+    }
+    if (ppp_event_handler_ != nullptr) {
+        esp_event_handler_instance_unregister(NETIF_PPP_STATUS, ESP_EVENT_ANY_ID, ppp_event_handler_);
+    }
+    if (netif_ != nullptr) {
+        esp_netif_destroy(netif_);
+    }
+    vEventGroupDelete(event_group_handle_);
+}
+
+bool EC800Ppp::CreateNetif() {
+    if (netif_ != nullptr) {
+        return true;
+    }
+    esp_netif_config_t config = ESP_NETIF_DEFAULT_PPP();
+    netif_ = esp_netif_new(&config);
+    if (netif_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to create PPP netif");
+        return false;
+    }
+    esp_netif_ppp_config_t ppp_config = {};
+    ppp_config.ppp_error_event_enabled = true;
+    esp_netif_ppp_set_params(netif_, &ppp_config);
+    ESP_ERROR_CHECK(esp_netif_attach(netif_, &driver_));
+
+    ESP_ERROR_CHECK(esp_event_handler_instance_register(IP_EVENT, ESP_EVENT_ANY_ID, OnIpEvent, this, &ip_event_handler_));
+    ESP_ERROR_CHECK(esp_event_handler_instance_register(NETIF_PPP_STATUS, ESP_EVENT_ANY_ID, OnPppEvent, this, &ppp_event_handler_));
+    return true;
+}
+
+bool EC800Ppp::Start(const std::string& apn, int timeout_ms) {
+    if (connected_) {
+        return true;
+    }
+    if (!CreateNetif()) {
+        return false;
+    }
+
+    if (!apn.empty()) {
+        modem_.Command("AT+CGDCONT=1,\"IP\",\"" + apn + "\"");
+    }
+
+    xEventGroupClearBits(event_group_handle_, EC800_PPP_CONNECTED | EC800_PPP_DISCONNECTED | EC800_PPP_TERMINATED);
+
+    // 拨号, 模组回复 CONNECT 后串口传输 PPP 帧, 由 lwIP 解帧
+    bool ok = modem_.EnterDataMode("ATD*99#", [this](const char* data, size_t length) {
+        esp_netif_receive(netif_, (void*)data, length, nullptr);
+    }, [this]() {
+        // NO CARRIER, the modem is back in command mode
+        connected_ = false;
+        xEventGroupSetBits(event_group_handle_, EC800_PPP_DISCONNECTED | EC800_PPP_TERMINATED);
+    }, timeout_ms);
+    if (!ok) {
+        ESP_LOGE(TAG, "Failed to dial PPP");
+        return false;
+    }
+
+    esp_netif_action_start(netif_, nullptr, 0, nullptr);
+    auto bits = xEventGroupWaitBits(event_group_handle_, EC800_PPP_CONNECTED | EC800_PPP_DISCONNECTED, pdFALSE, pdFALSE, pdMS_TO_TICKS(timeout_ms));
+    if (!(bits & EC800_PPP_CONNECTED)) {
+        ESP_LOGE(TAG, "PPP negotiation failed");
+        Stop();
+        return false;
+    }
+    ESP_LOGI(TAG, "PPP connected, IP: %s", ip_address_.c_str());
+    return true;
+}
+
+void EC800Ppp::Stop() {
+    if (netif_ == nullptr || (!modem_.data_mode() && !connected_)) {
+        return;
+    }
+    // lwIP sends LCP Terminate-Request and reports the link down once it is acknowledged
+    esp_netif_action_stop(netif_, nullptr, 0, nullptr);
+    if (modem_.data_mode()) {
+        xEventGroupWaitBits(event_group_handle_, EC800_PPP_TERMINATED, pdFALSE, pdFALSE, pdMS_TO_TICKS(PPP_STOP_TIMEOUT_MS));
+    }
+    if (modem_.data_mode()) {
+        modem_.ExitDataMode();
+        modem_.Command("ATH");
+    }
+    connected_ = false;
+    ip_address_.clear();
+    ESP_LOGI(TAG, "PPP stopped");
+}
+
+esp_err_t EC800Ppp::PostAttach(esp_netif_t* netif, esp_netif_iodriver_handle args) {
+    auto driver = (NetifDriver*)args;
+    driver->base.netif = netif;
+    esp_netif_driver_ifconfig_t driver_ifconfig = {};
+    driver_ifconfig.handle = driver;
+    driver_ifconfig.transmit = Transmit;
+    return esp_netif_set_driver_config(netif, &driver_ifconfig);
+}
+
+// lwIP hands over complete HDLC-framed bytes
+esp_err_t EC800Ppp::Transmit(void* handle, void* buffer, size_t length) {
+    auto ppp = ((NetifDriver*)handle)->ppp;
+    if (ppp->modem_.WriteRaw((const char*)buffer, length) < 0) {
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+void EC800Ppp::OnIpEvent(void* arg, esp_event_base_t base, int32_t event_id, void* event_data) {
+    auto ppp = (EC800Ppp*)arg;
+    if (event_id == IP_EVENT_PPP_GOT_IP) {
+        auto event = (ip_event_got_ip_t*)event_data;
+        if (event->esp_netif != ppp->netif_) {
+            return;
+        }
+        char ip[16];
+        ppp->ip_address_ = esp_ip4addr_ntoa(&event->ip_info.ip, ip, sizeof(ip));
+        ppp->connected_ = true;
+        xEventGroupSetBits(ppp->event_group_handle_, EC800_PPP_CONNECTED);
+    } else if (event_id == IP_EVENT_PPP_LOST_IP) {
+        ppp->connected_ = false;
+        xEventGroupSetBits(ppp->event_group_handle_, EC800_PPP_DISCONNECTED);
+    }
+}
+
+// The link is down when lwIP reports an error; NETIF_PPP_ERRORUSER ends the LCP terminate
+// started by esp_netif_action_stop()
+void EC800Ppp::OnPppEvent(void* arg, esp_event_base_t base, int32_t event_id, void* event_data) {
+    auto ppp = (EC800Ppp*)arg;
+    if (event_id > NETIF_PPP_ERRORNONE && event_id < NETIF_PPP_PHASE_DEAD) {
+        if (event_id != NETIF_PPP_ERRORUSER) {
+            ESP_LOGW(TAG, "PPP error %ld", (long)event_id);
+        }
+        // LCP echoes went unanswered: the module may hang in data mode where the
+        // supervisor cannot see it
+        auto supervisor = ppp->modem_.supervisor();
+        if (event_id == NETIF_PPP_ERRORPEERDEAD && supervisor != nullptr) {
+            supervisor->Trigger();
+        }
+        ppp->connected_ = false;
+        xEventGroupSetBits(ppp->event_group_handle_, EC800_PPP_DISCONNECTED | EC800_PPP_TERMINATED);
+    }
+}
@@ -0,0 +1,54 @@
+#include "ec800_reconnector.h"
+#include "ec800_supervisor.h"
+
+
+EC800Reconnector::EC800Reconnector(EC800AtModem& modem, std::function<bool()> on_reset, ConnectFunction connect)
+    : modem_(modem), on_reset_(std::move(on_reset)), connect_(std::move(connect)) {
+}
+
+EC800Reconnector::~EC800Reconnector() {
+    Stop();
+}
+
+void EC800Reconnector::Start() {
+    if (started_) {
+        return;
+    }
+    started_ = true;
+    urc_handler_ = modem_.RegisterUrcHandler("MODEM_RESET", EC800_URC_ANY_ID, [this](std::string_view command, const AtArgumentListEC& arguments) {
+        if (on_reset_()) {
+            pending_ = true;
+        }
+    });
+    if (auto supervisor = modem_.supervisor()) {
+        supervisor->AddRestoreHandler(this, [this]() { return Restore(); });
+    }
+}
+
+void EC800Reconnector::Stop() {
+    if (!started_) {
+        return;
+    }
+    started_ = false;
+    if (auto supervisor = modem_.supervisor()) {
+        supervisor->RemoveRestoreHandler(this);
+    }
+    modem_.UnregisterUrcHandler(urc_handler_);
+    modem_.CancelDeferred(this);
+}
+
+void EC800Reconnector::Remember(const std::string& host, int port) {
+    host_ = host;
+    port_ = port;
+    pending_ = false;
+}
+
+bool EC800Reconnector::Restore() {
+    if (!pending_) {
+        return true;
+    }
+    pending_ = false;
+    // Connect() calls Remember() with what it is given, which must not be host_ itself
+    std::string host = host_;
+    return connect_(host, port_);
+}
@@ -0,0 +1,95 @@
+#include "ec800_ring_buffer.h"
+#include <algorithm>
+#include <cstring>
+
+EC800RingBuffer::EC800RingBuffer(size_t capacity) : buffer_(capacity) {
+}
+
+char* EC800RingBuffer::WritePointer(size_t* length) {
+    size_t tail = (head_ + size_) % buffer_.size();
+    if (size_ == buffer_.size()) {
+        *length = 0;
+    } else if (tail >= head_) {
+        *length = buffer_.size() - tail;
+    } else {
+        *length = head_ - tail;
+    }
+    return buffer_.data() + tail;
+}
+
+void EC800RingBuffer::Commit(size_t length) {
+    size_ = std::min(size_ + length, buffer_.size());
+    if (size_ > high_water_mark_) {
+        high_water_mark_ = size_;
+    }
+}
+
+size_t EC800RingBuffer::Write(const char* data, size_t length) {
+    size_t written = 0;
+    while (written < length) {
+        size_t writable;
+        char* ptr = WritePointer(&writable);
+        if (writable == 0) {
+            break;
+        }
+        size_t chunk = std::min(writable, length - written);
+        memcpy(ptr, data + written, chunk);
+        Commit(chunk);
+        written += chunk;
+    }
+    return written;
+}
+
+const char* EC800RingBuffer::ReadPointer(size_t* length) const {
+    *length = std::min(size_, buffer_.size() - head_);
+    return buffer_.data() + head_;
+}
+
+const char* EC800RingBuffer::Linearize(size_t length) {
+    if (head_ + std::min(length, size_) > buffer_.size()) {
+        // The requested range wraps; rotate once so the read position starts at 0.
+        // This happens at most once per buffer capacity of received data.
+        std::rotate(buffer_.begin(), buffer_.begin() + head_, buffer_.end());
+        head_ = 0;
+    }
+    return buffer_.data() + head_;
+}
+
+void EC800RingBuffer::Consume(size_t length) {
+    length = std::min(length, size_);
+    size_ -= length;
+    scan_offset_ = scan_offset_ > length ? scan_offset_ - length : 0;
+    // Restart at the beginning whenever the buffer drains so lines rarely wrap
+    head_ = size_ == 0 ? 0 : (head_ + length) % buffer_.size();
+}
+
+void EC800RingBuffer::Clear() {
+    head_ = 0;
+    size_ = 0;
+    scan_offset_ = 0;
+}
+
+size_t EC800RingBuffer::FindLineEnd() {
+    while (scan_offset_ + 1 < size_) {
+        // Search the contiguous run starting at scan_offset_ for '\r'
+        size_t start = (head_ + scan_offset_) % buffer_.size();
+        size_t run = std::min(size_ - scan_offset_, buffer_.size() - start);
+        auto found = (const char*)memchr(buffer_.data() + start, '\r', run);
+        if (found == nullptr) {
+            scan_offset_ += run;
+            continue;
+        }
+        size_t offset = scan_offset_ + (found - (buffer_.data() + start));
+        if (offset + 1 >= size_) {
+            // '\r' is the last byte, wait for more data
+            scan_offset_ = offset;
+            return npos;
+        }
+        if (At(offset + 1) == '\n') {
+            scan_offset_ = offset;
+            return offset;
+        }
+        scan_offset_ = offset + 1;
+    }
+    return npos;
+}
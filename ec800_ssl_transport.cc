@@ -5,65 +5,108 @@
 static const char *TAG = "EC800SslTransport";
 
 
-EC800SslTransport::EC800SslTransport(EC800AtModem& modem, int tcp_id) : modem_(modem), tcp_id_(tcp_id) {
+EC800SslTransport::EC800SslTransport(EC800AtModem& modem, int tcp_id)
+    : modem_(modem), tcp_id_(modem.AllocateConnectionId(EC800ConnectionKind::Socket, tcp_id)),
+      reconnector_(modem, [this]() { return OnModemReset(); }, [this](const std::string& host, int port) {
+          return Connect(host.c_str(), port);
+      }) {
     event_group_handle_ = xEventGroupCreate();
+    // 没有可用的 id 时不注册任何处理, Connect() 会失败
+    if (tcp_id_ < 0) {
+        return;
+    }
 
-    command_callback_it_ = modem_.RegisterCommandResponseCallback([this](const std::string& command, const std::vector<AtArgumentValueEC>& arguments) {
-        if (command == "QISTATE" && arguments.size() >= 2) {
-            if (arguments[0].int_value == tcp_id_) {
-                if (arguments[1].int_value == 3) {
-                    connected_ = true;
-                    xEventGroupClearBits(event_group_handle_, EC800_SSL_TRANSPORT_DISCONNECTED | EC800_SSL_TRANSPORT_ERROR);
-                    xEventGroupSetBits(event_group_handle_, EC800_SSL_TRANSPORT_CONNECTED);
-                } else {
-                    connected_ = false;
-                    xEventGroupSetBits(event_group_handle_, EC800_SSL_TRANSPORT_ERROR);
-                }
-            }
-        } else if (command == "QISTATE" && arguments.size() == 1) {
-            if (arguments[0].int_value == tcp_id_) {
+    urc_handlers_.push_back(modem_.RegisterUrcHandler("QISTATE", tcp_id_, [this](std::string_view command, const AtArgumentListEC& arguments) {
+        if (arguments.size() >= 2) {
+            if (arguments[1].int_value() == 3) {
+                connected_ = true;
+                xEventGroupClearBits(event_group_handle_, EC800_SSL_TRANSPORT_DISCONNECTED | EC800_SSL_TRANSPORT_ERROR);
+                xEventGroupSetBits(event_group_handle_, EC800_SSL_TRANSPORT_CONNECTED);
+            } else {
                 connected_ = false;
-                xEventGroupSetBits(event_group_handle_, EC800_SSL_TRANSPORT_DISCONNECTED);
+                xEventGroupSetBits(event_group_handle_, EC800_SSL_TRANSPORT_ERROR);
             }
-        } else if (command == "QISEND" && arguments.size() >= 2) {
+        } else if (arguments.size() == 1) {
+            connected_ = false;
+            xEventGroupSetBits(event_group_handle_, EC800_SSL_TRANSPORT_DISCONNECTED);
+        }
+    }));
+    urc_handlers_.push_back(modem_.RegisterUrcHandler("QISEND", tcp_id_, [this](std::string_view command, const AtArgumentListEC& arguments) {
+        if (arguments.size() >= 2) {
             xEventGroupSetBits(event_group_handle_, EC800_SSL_TRANSPORT_SEND_COMPLETE);
-        } else if (command == "QIURC" && arguments.size() >= 2) {
-                if (arguments[0].string_value == "recv") {
-                    std::lock_guard<std::mutex> lock(mutex_);
-                    xEventGroupSetBits(event_group_handle_, EC800_SSL_TRANSPORT_RECEIVE);
-                } else if (arguments[0].string_value == "closed") {
-                    connected_ = false;
-                    xEventGroupSetBits(event_group_handle_, EC800_SSL_TRANSPORT_DISCONNECTED);
-                } else {
-                    ESP_LOGE(TAG, "Unknown MIPURC command: %s", arguments[0].string_value.c_str());
-                }
-                modem_.Command(std::string("AT+QIRD=") + std::to_string(tcp_id_) + "," + std::to_string(arguments[1].int_value));
-        } else if (command == "QIRD" && arguments.size() >= 2) {
-                std::lock_guard<std::mutex> lock(mutex_);
-                modem_.DecodeHexAppend(rx_buffer_, arguments[3].string_value.c_str(), arguments[3].string_value.size());
-        } else if (command == "MIPSTATE" && arguments.size() == 5) {
-            if (arguments[0].int_value == tcp_id_) {
-                if (arguments[4].string_value == "INITIAL") {
-                    connected_ = false;
-                } else {
-                    connected_ = true;
-                }
-                xEventGroupSetBits(event_group_handle_, EC800_SSL_TRANSPORT_INITIALIZED);
+        }
+    }));
+    urc_handlers_.push_back(modem_.RegisterUrcHandler("QIURC", tcp_id_, [this](std::string_view command, const AtArgumentListEC& arguments) {
+        if (arguments[0].string_value() == "recv") {
+            // Direct push carries the length and the payload follows, buffer access has to be read out
+            if (arguments.size() < 3) {
+                modem_.RequestRead(tcp_id_);
             }
-        } else if (command == "FIFO_OVERFLOW") {
+        } else if (arguments[0].string_value() == "closed") {
+            connected_ = false;
+            xEventGroupSetBits(event_group_handle_, EC800_SSL_TRANSPORT_DISCONNECTED);
+        } else {
+            ESP_LOGE(TAG, "Unknown MIPURC command: %.*s", (int)arguments[0].string_value().size(), arguments[0].string_value().data());
+        }
+    }));
+    // +QIRD: <a>,<b>,<len>,<hex>, decoded straight into rx_buffer_
+    EcUrcStreamHandler qird;
+    qird.data = [this](const char* data, size_t length) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        rx_buffer_.append(data, length);
+    };
+    qird.end = [this](bool ok) {
+        if (!ok) {
+            ESP_LOGE(TAG, "Invalid QIRD payload");
+        }
+        xEventGroupSetBits(event_group_handle_, EC800_SSL_TRANSPORT_RECEIVE);
+    };
+    urc_streams_.push_back(modem_.RegisterUrcStream("QIRD", "", tcp_id_, 3, std::move(qird)));
+    urc_handlers_.push_back(modem_.RegisterUrcHandler("MIPSTATE", tcp_id_, [this](std::string_view command, const AtArgumentListEC& arguments) {
+        if (arguments.size() == 5) {
+            if (arguments[4].string_value() == "INITIAL") {
+                connected_ = false;
+            } else {
+                connected_ = true;
+            }
+            xEventGroupSetBits(event_group_handle_, EC800_SSL_TRANSPORT_INITIALIZED);
+        }
+    }));
+    urc_handlers_.push_back(modem_.RegisterUrcHandler("FIFO_OVERFLOW", EC800_URC_ANY_ID, [this](std::string_view command, const AtArgumentListEC& arguments) {
+        // 直推模式下丢失的数据无法察觉, 只有缓存模式可以重新读取
+        bool damaged = receive_mode_ == EC800ReceiveMode::DirectPush;
+        if (damaged || EC800AtModem::OverflowDamaged(arguments, EC800ConnectionKind::Socket, tcp_id_)) {
             xEventGroupSetBits(event_group_handle_, EC800_SSL_TRANSPORT_ERROR);
-            Disconnect();
+            modem_.Defer([this]() { Disconnect(); }, this);
+        } else if (connected_) {
+            // A lost "recv" URC leaves the data in the modem buffer
+            modem_.RequestRead(tcp_id_);
         }
-    });
+    }));
+    reconnector_.Start();
 }
 
 EC800SslTransport::~EC800SslTransport() {
-    modem_.UnregisterCommandResponseCallback(command_callback_it_);
+    reconnector_.Stop();
+    modem_.UnregisterPayloadSink(tcp_id_, payload_generation_);
+    for (auto id : urc_streams_) {
+        modem_.UnregisterUrcStream(id);
+    }
+    for (auto id : urc_handlers_) {
+        modem_.UnregisterUrcHandler(id);
+    }
+    modem_.CancelDeferred(this);
+    modem_.ReleaseConnectionId(EC800ConnectionKind::Socket, tcp_id_);
 }
 
 bool EC800SslTransport::Connect(const char* host, int port) {
     char command[64];
 
+    if (tcp_id_ < 0) {
+        ESP_LOGE(TAG, "No connect id");
+        return false;
+    }
+
     // Clear bits
     xEventGroupClearBits(event_group_handle_, EC800_SSL_TRANSPORT_CONNECTED | EC800_SSL_TRANSPORT_DISCONNECTED | EC800_SSL_TRANSPORT_ERROR);
 
@@ -80,45 +123,58 @@ bool EC800SslTransport::Connect(const char* host, int port) {
     if (connected_) {
         Disconnect();
     }
+    reconnector_.Remember(host, port);
 
-    // 场景激活
-    sprintf(command, "AT+QIACT?");
-    if (!modem_.Command(command)) {
+    // 场景激活, 已知地址时不再查询
+    if (modem_.ip_address().empty() && !modem_.Command("AT+QIACT?")) {
         ESP_LOGE(TAG, "");
         return false;
     }
 
-    // 设置 SSL 配置
-    sprintf(command, "AT+QSSLCFG=\"seclevel\",0,0");
-    if (!modem_.Command(command)) {
+    // 设置 SSL 配置, 未变化时跳过
+    if (!modem_.Configure("QSSLCFG seclevel 0", "AT+QSSLCFG=\"seclevel\",0,0")) {
         ESP_LOGE(TAG, "Failed to set SSL configuration");
         return false;
     }
 
-    // 打开 TCP 连接
-    sprintf(command, "AT+QIOPEN=1,%d,\"TCP\",\"%s\",%d,0,0", tcp_id_, host, port);
-    if (!modem_.Command(command)) {
-        ESP_LOGE(TAG, "Failed to open TCP connection");
-        return false;
-    }
+    // 有缓存的 DNS 结果时直接连地址, 失败后用域名再试一次
+    std::string address = modem_.ResolveCached(host);
+    OpenPayloadSink();
+    while (true) {
+        // 打开 TCP 连接
+        sprintf(command, "AT+QIOPEN=1,%d,\"TCP\",\"%s\",%d,0,%d", tcp_id_, address.c_str(), port, receive_mode_ == EC800ReceiveMode::DirectPush ? 1 : 0);
+        if (!modem_.Command(command)) {
+            ESP_LOGE(TAG, "Failed to open TCP connection");
+            return false;
+        }
 
-    // 查询连接状态
-    sprintf(command, "AT+QISTATE=%d,0", tcp_id_);
-    if (!modem_.Command(command)) {
-        ESP_LOGE(TAG, "Failed to set HEX encoding");
-        return false;
-    }
+        // 查询连接状态
+        sprintf(command, "AT+QISTATE=%d,0", tcp_id_);
+        if (!modem_.Command(command)) {
+            ESP_LOGE(TAG, "Failed to set HEX encoding");
+            return false;
+        }
 
-    // 等待连接完成
-    bits = xEventGroupWaitBits(event_group_handle_, EC800_SSL_TRANSPORT_CONNECTED | EC800_SSL_TRANSPORT_ERROR, pdTRUE, pdFALSE, SSL_CONNECT_TIMEOUT_MS / portTICK_PERIOD_MS);
-    if (bits & EC800_SSL_TRANSPORT_ERROR) {
-        ESP_LOGE(TAG, "Failed to connect to %s:%d", host, port);
-        return false;
+        // 等待连接完成
+        bits = xEventGroupWaitBits(event_group_handle_, EC800_SSL_TRANSPORT_CONNECTED | EC800_SSL_TRANSPORT_ERROR, pdTRUE, pdFALSE, SSL_CONNECT_TIMEOUT_MS / portTICK_PERIOD_MS);
+        if (!(bits & EC800_SSL_TRANSPORT_ERROR)) {
+            return true;
+        }
+        if (address == host) {
+            break;
+        }
+        ESP_LOGW(TAG, "Failed to connect to %s, retrying with %s", address.c_str(), host);
+        modem_.InvalidateDns(host);
+        modem_.Command("AT+QICLOSE=" + std::to_string(tcp_id_));
+        address = host;
     }
-    return true;
+    ESP_LOGE(TAG, "Failed to connect to %s:%d", host, port);
+    return false;
 }
 
 void EC800SslTransport::Disconnect() {
+    reconnector_.Forget();
+    modem_.UnregisterPayloadSink(tcp_id_, payload_generation_);
     if (!connected_) {
         return;
     }
@@ -128,7 +184,71 @@ void EC800SslTransport::Disconnect() {
     modem_.Command(command);
 }
 
+// Payload of an earlier open still in the modem pipe must not end up in this one
+void EC800SslTransport::OpenPayloadSink() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        rx_buffer_.clear();
+    }
+    payload_generation_ = modem_.RegisterPayloadSink(tcp_id_, [this](const char* data, size_t length, size_t remaining) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        rx_buffer_.append(data, length);
+        xEventGroupSetBits(event_group_handle_, EC800_SSL_TRANSPORT_RECEIVE);
+    });
+}
+
+// 模组重启后连接已不存在, 由 Restore() 或上层重新连接
+bool EC800SslTransport::OnModemReset() {
+    if (!connected_) {
+        return false;
+    }
+    connected_ = false;
+    xEventGroupSetBits(event_group_handle_, EC800_SSL_TRANSPORT_DISCONNECTED);
+    return true;
+}
+
+bool EC800SslTransport::Restore() {
+    return reconnector_.Restore();
+}
+
+void EC800SslTransport::SetSendMode(EC800SendMode mode) {
+    send_mode_ = mode;
+}
+
+void EC800SslTransport::SetReceiveMode(EC800ReceiveMode mode) {
+    receive_mode_ = mode;
+}
+
 int EC800SslTransport::Send(const char* data, size_t length) {
+    if (send_mode_ == EC800SendMode::Hex) {
+        return SendHex(data, length);
+    }
+
+    const size_t MAX_PACKET_SIZE = 1460;
+    size_t total_sent = 0;
+    while (total_sent < length) {
+        size_t chunk_size = std::min(length - total_sent, MAX_PACKET_SIZE);
+
+        // AT+QISEND=<id>,<len>, 等待 '>' 后直接写入原始数据, 仅 SEND OK 算发送成功
+        std::string command = "AT+QISEND=" + std::to_string(tcp_id_) + "," + std::to_string(chunk_size);
+        auto send = modem_.CommandWithDataAsync(command, std::string(data + total_sent, chunk_size), SSL_CONNECT_TIMEOUT_MS, AtCommandPriority::Realtime);
+        if (!send->Wait()) {
+            if (send->response() == "SEND FAIL") {
+                // SEND FAIL: 模组发送缓冲区已满, 连接仍然有效
+                ESP_LOGE(TAG, "发送失败, 发送缓冲区已满");
+                return total_sent > 0 ? (int)total_sent : -1;
+            }
+            ESP_LOGE(TAG, "发送数据块失败");
+            connected_ = false;
+            xEventGroupSetBits(event_group_handle_, EC800_SSL_TRANSPORT_DISCONNECTED);
+            return -1;
+        }
+        total_sent += chunk_size;
+    }
+    return length;
+}
+
+int EC800SslTransport::SendHex(const char* data, size_t length) {
     const size_t MAX_PACKET_SIZE = 1460 / 2;
     size_t total_sent = 0;
 
@@ -146,7 +266,7 @@ int EC800SslTransport::Send(const char* data, size_t length) {
         // 直接在command字符串上进行十六进制编码
         modem_.EncodeHexAppend(command, data + total_sent, chunk_size);
 
-        if (!modem_.Command(command)) {
+        if (!modem_.Command(command, DEFAULT_COMMAND_TIMEOUT, AtCommandPriority::Realtime)) {
             ESP_LOGE(TAG, "发送数据块失败");
             connected_ = false;
             xEventGroupSetBits(event_group_handle_, EC800_SSL_TRANSPORT_DISCONNECTED);
@@ -154,8 +274,8 @@ int EC800SslTransport::Send(const char* data, size_t length) {
         }
 
         command.clear();
-        command = "AT+QISEND=0,0";
-        modem_.Command(command);
+        command = "AT+QISEND=" + std::to_string(tcp_id_) + ",0";
+        modem_.Command(command, DEFAULT_COMMAND_TIMEOUT, AtCommandPriority::Realtime);
 
         auto bits = xEventGroupWaitBits(event_group_handle_, EC800_SSL_TRANSPORT_SEND_COMPLETE, pdTRUE, pdFALSE, pdMS_TO_TICKS(SSL_CONNECT_TIMEOUT_MS));
         if (!(bits & EC800_SSL_TRANSPORT_SEND_COMPLETE)) {
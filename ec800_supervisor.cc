@@ -0,0 +1,191 @@
+#include "ec800_supervisor.h"
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <algorithm>
+
+static const char* TAG = "EC800Supervisor";
+
+static const char* LevelName(EC800RecoveryLevel level) {
+    switch (level) {
+    case EC800RecoveryLevel::Probe:
+        return "probe";
+    case EC800RecoveryLevel::Reset:
+        return "reset";
+    case EC800RecoveryLevel::Reattach:
+        return "re-attach";
+    default:
+        return "none";
+    }
+}
+
+EC800Supervisor::EC800Supervisor(EC800AtModem& modem, std::function<void()> hard_reset)
+    : modem_(modem), hard_reset_(std::move(hard_reset)) {
+    event_group_handle_ = xEventGroupCreate();
+    modem_.SetSupervisor(this);
+}
+
+EC800Supervisor::~EC800Supervisor() {
+    Stop();
+    if (modem_.supervisor() == this) {
+        modem_.SetSupervisor(nullptr);
+    }
+    vEventGroupDelete(event_group_handle_);
+}
+
+void EC800Supervisor::Start() {
+    if (task_handle_ != nullptr) {
+        return;
+    }
+    xEventGroupClearBits(event_group_handle_, SUPERVISOR_EVENT_STOP | SUPERVISOR_EVENT_STOPPED);
+    xTaskCreate([](void* arg) {
+        auto supervisor = (EC800Supervisor*)arg;
+        supervisor->Task();
+        xEventGroupSetBits(supervisor->event_group_handle_, SUPERVISOR_EVENT_STOPPED);
+        vTaskDelete(NULL);
+    }, "modem_supervisor", SUPERVISOR_TASK_STACK_SIZE, this, SUPERVISOR_TASK_PRIORITY, &task_handle_);
+}
+
+void EC800Supervisor::Stop() {
+    if (task_handle_ == nullptr) {
+        return;
+    }
+    // A recovery in progress is finished first
+    xEventGroupSetBits(event_group_handle_, SUPERVISOR_EVENT_STOP);
+    xEventGroupWaitBits(event_group_handle_, SUPERVISOR_EVENT_STOPPED, pdTRUE, pdFALSE, portMAX_DELAY);
+    task_handle_ = nullptr;
+}
+
+void EC800Supervisor::Trigger() {
+    xEventGroupSetBits(event_group_handle_, SUPERVISOR_EVENT_TRIGGER);
+}
+
+void EC800Supervisor::AddRestoreHandler(const void* owner, std::function<bool()> restore) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    restore_handlers_.push_back({owner, std::move(restore)});
+}
+
+// Waits for a restore of `owner` that is running
+void EC800Supervisor::RemoveRestoreHandler(const void* owner) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    restore_handlers_.erase(std::remove_if(restore_handlers_.begin(), restore_handlers_.end(), [owner](const RestoreHandler& handler) {
+        return handler.owner == owner;
+    }), restore_handlers_.end());
+}
+
+EC800RecoveryStats EC800Supervisor::GetStats() {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    return stats_;
+}
+
+void EC800Supervisor::Task() {
+    while (true) {
+        auto bits = xEventGroupWaitBits(event_group_handle_, SUPERVISOR_EVENT_TRIGGER | SUPERVISOR_EVENT_STOP, pdTRUE, pdFALSE,
+            pdMS_TO_TICKS(SUPERVISOR_CHECK_MS));
+        if (bits & SUPERVISOR_EVENT_STOP) {
+            break;
+        }
+        if (esp_timer_get_time() < next_attempt_us_) {
+            continue;
+        }
+        bool hung = (bits & SUPERVISOR_EVENT_TRIGGER) || modem_.consecutive_timeouts() >= SUPERVISOR_TIMEOUT_THRESHOLD;
+        bool probed = false;
+        // The only sign of life in data mode, where commands are held until the pipe is left
+        if (!hung && esp_timer_get_time() - modem_.last_receive_time_us() > SUPERVISOR_SILENCE_MS * 1000LL) {
+            hung = !Probe();
+            probed = true;
+        }
+        if (hung) {
+            Recover(probed);
+        }
+    }
+}
+
+bool EC800Supervisor::Probe() {
+    if (modem_.data_mode()) {
+        // Escape to command mode and go back into the pipe. A module that restarted in
+        // data mode answers AT but has no pipe to resume.
+        return modem_.ExitDataMode() && modem_.ResumeDataMode(SUPERVISOR_RESUME_TIMEOUT_MS);
+    }
+    for (int i = 0; i < SUPERVISOR_PROBE_ATTEMPTS; i++) {
+        if (modem_.Command("AT", SUPERVISOR_PROBE_TIMEOUT_MS, AtCommandPriority::Realtime)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void EC800Supervisor::Recover(bool probed) {
+    ESP_LOGW(TAG, "Modem not responding (%u timeouts in a row), recovering", (unsigned)modem_.consecutive_timeouts());
+    recovering_ = true;
+    // Timeouts of this incident must not count toward the next one, nor those of our probes
+    modem_.ResetConsecutiveTimeouts();
+    int64_t start_us = esp_timer_get_time();
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        stats_.incidents++;
+    }
+    auto level = Escalate(probed);
+    int64_t elapsed_us = esp_timer_get_time() - start_us;
+    modem_.ResetConsecutiveTimeouts();
+
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    stats_.last_level = level;
+    if (level == EC800RecoveryLevel::Probe || level == EC800RecoveryLevel::Reattach) {
+        if (level == EC800RecoveryLevel::Probe) {
+            stats_.probe_recoveries++;
+        }
+        stats_.last_recovery_us = elapsed_us;
+        stats_.max_recovery_us = std::max(stats_.max_recovery_us, elapsed_us);
+        stats_.total_recovery_us += elapsed_us;
+        ESP_LOGI(TAG, "Recovered by %s in %lld ms", LevelName(level), (long long)(elapsed_us / 1000));
+    } else {
+        stats_.failures++;
+        next_attempt_us_ = esp_timer_get_time() + SUPERVISOR_RETRY_MS * 1000LL;
+        ESP_LOGE(TAG, "Recovery failed at %s after %lld ms, retrying in %d s", LevelName(level), (long long)(elapsed_us / 1000),
+            SUPERVISOR_RETRY_MS / 1000);
+    }
+    recovering_ = false;
+}
+
+EC800RecoveryLevel EC800Supervisor::Escalate(bool probed) {
+    if (!probed && Probe()) {
+        return EC800RecoveryLevel::Probe;
+    }
+
+    ESP_LOGW(TAG, "No answer to AT, restarting the module");
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        stats_.resets++;
+    }
+    modem_.Reset();
+    bool up = modem_.ResyncUart(SUPERVISOR_BOOT_TIMEOUT_MS);
+    if (!up && hard_reset_) {
+        ESP_LOGW(TAG, "Module did not come back, hard reset");
+        {
+            std::lock_guard<std::mutex> lock(stats_mutex_);
+            stats_.hard_resets++;
+        }
+        hard_reset_();
+        up = modem_.ResyncUart(SUPERVISOR_BOOT_TIMEOUT_MS);
+    }
+    if (!up) {
+        return EC800RecoveryLevel::None;
+    }
+
+    if (modem_.WaitForNetworkReady(SUPERVISOR_ATTACH_TIMEOUT_MS) != 0) {
+        return EC800RecoveryLevel::Reset;
+    }
+    uint32_t restore_failures = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& handler : restore_handlers_) {
+            if (!handler.restore()) {
+                restore_failures++;
+            }
+        }
+    }
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    stats_.reattaches++;
+    stats_.restore_failures += restore_failures;
+    return EC800RecoveryLevel::Reattach;
+}
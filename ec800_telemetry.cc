@@ -0,0 +1,160 @@
+#include "ec800_telemetry.h"
+#include <esp_log.h>
+#include <esp_err.h>
+#include <cstdlib>
+
+static const char* TAG = "EC800Telemetry";
+
+static const char* kRefreshCommands[EC800_TELEMETRY_FIELD_COUNT] = {
+    "AT+CSQ",
+    "AT+QENG=\"servingcell\"",
+    "AT+COPS?",
+    "AT+CEREG?",
+};
+
+// Cell id and TAC are reported as hex strings
+static uint32_t HexValue(const AtArgumentViewEC& argument) {
+    std::string value(argument.string_value());
+    return strtoul(value.c_str(), nullptr, 16);
+}
+
+EC800Telemetry::EC800Telemetry(EC800AtModem& modem) : modem_(modem) {
+    snapshot_ = std::make_shared<EC800TelemetrySnapshot>();
+
+    urc_handlers_.push_back(modem_.RegisterUrcHandler("CSQ", EC800_URC_ANY_ID, [this](std::string_view command, const AtArgumentListEC& arguments) {
+        if (arguments.size() >= 2) {
+            Update(EC800TelemetryField::Csq, [&](EC800TelemetrySnapshot& snapshot) {
+                snapshot.csq = arguments[0].int_value(99);
+                snapshot.ber = arguments[1].int_value(99);
+            });
+        }
+    }));
+    // +QIND: "csq",<rssi>,<ber> after AT+QINDCFG="csq",1
+    urc_handlers_.push_back(modem_.RegisterUrcHandler("QIND", EC800_URC_ANY_ID, [this](std::string_view command, const AtArgumentListEC& arguments) {
+        if (arguments.size() >= 3 && arguments[0] == "csq") {
+            Update(EC800TelemetryField::Csq, [&](EC800TelemetrySnapshot& snapshot) {
+                snapshot.csq = arguments[1].int_value(99);
+                snapshot.ber = arguments[2].int_value(99);
+            });
+        }
+    }));
+    // +QENG: "servingcell",<state>,"LTE",<is_tdd>,<MCC>,<MNC>,<cellID>,<PCID>,<earfcn>,<band>,
+    //        <ul_bw>,<dl_bw>,<TAC>,<RSRP>,<RSRQ>,<RSSI>,<SINR>,...
+    urc_handlers_.push_back(modem_.RegisterUrcHandler("QENG", EC800_URC_ANY_ID, [this](std::string_view command, const AtArgumentListEC& arguments) {
+        if (arguments.size() < AtArgumentListEC::kMaxArguments || arguments[0] != "servingcell" || arguments[2] != "LTE") {
+            return;
+        }
+        // The list is full, the last field holds <RSSI>,<SINR>,... unsplit
+        AtArgumentListEC tail(arguments[AtArgumentListEC::kMaxArguments - 1].string_value());
+        Update(EC800TelemetryField::ServingCell, [&](EC800TelemetrySnapshot& snapshot) {
+            snapshot.cell_id = HexValue(arguments[6]);
+            snapshot.pci = arguments[7].int_value();
+            snapshot.earfcn = arguments[8].int_value();
+            snapshot.band = arguments[9].int_value();
+            snapshot.tac = HexValue(arguments[12]);
+            snapshot.rsrp = arguments[13].int_value(0);
+            snapshot.rsrq = arguments[14].int_value(0);
+            snapshot.sinr = tail.size() >= 2 ? tail[1].int_value(0) : 0;
+        });
+    }));
+    urc_handlers_.push_back(modem_.RegisterUrcHandler("COPS", EC800_URC_ANY_ID, [this](std::string_view command, const AtArgumentListEC& arguments) {
+        if (arguments.size() >= 3) {
+            Update(EC800TelemetryField::Operator, [&](EC800TelemetrySnapshot& snapshot) {
+                snapshot.operator_name = arguments[2].string_value();
+            });
+        }
+    }));
+    // "+CEREG: <stat>[,"<tac>","<ci>",<act>]" as URC, "+CEREG: <n>,<stat>[,...]" as answer
+    urc_handlers_.push_back(modem_.RegisterUrcHandler("CEREG", EC800_URC_ANY_ID, [this](std::string_view command, const AtArgumentListEC& arguments) {
+        if (arguments.empty()) {
+            return;
+        }
+        size_t stat = (arguments.size() == 1 || arguments[1].quoted) ? 0 : 1;
+        Update(EC800TelemetryField::Registration, [&](EC800TelemetrySnapshot& snapshot) {
+            snapshot.registration_state = arguments[stat].int_value(0);
+            if (arguments.size() >= stat + 3) {
+                snapshot.tac = HexValue(arguments[stat + 1]);
+                snapshot.cell_id = HexValue(arguments[stat + 2]);
+            }
+        });
+    }));
+}
+
+EC800Telemetry::~EC800Telemetry() {
+    Stop();
+    for (auto id : urc_handlers_) {
+        modem_.UnregisterUrcHandler(id);
+    }
+}
+
+void EC800Telemetry::Start() {
+    if (timer_ != nullptr) {
+        return;
+    }
+    // Signal changes and cell details arrive on their own where the firmware supports it
+    modem_.CommandAsync("AT+QINDCFG=\"csq\",1", DEFAULT_COMMAND_TIMEOUT, AtCommandPriority::Background);
+    modem_.CommandAsync("AT+CEREG=2", DEFAULT_COMMAND_TIMEOUT, AtCommandPriority::Background);
+
+    esp_timer_create_args_t timer_args = {};
+    timer_args.callback = [](void* arg) {
+        ((EC800Telemetry*)arg)->Refresh();
+    };
+    timer_args.arg = this;
+    timer_args.dispatch_method = ESP_TIMER_TASK;
+    timer_args.name = "modem_telemetry";
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &timer_));
+    ESP_ERROR_CHECK(esp_timer_start_periodic(timer_, TELEMETRY_TICK_MS * 1000));
+}
+
+void EC800Telemetry::Stop() {
+    if (timer_ == nullptr) {
+        return;
+    }
+    esp_timer_stop(timer_);
+    // Wait for a tick that is still running
+    std::lock_guard<std::mutex> lock(refresh_mutex_);
+    esp_timer_delete(timer_);
+    timer_ = nullptr;
+}
+
+void EC800Telemetry::SetTtl(EC800TelemetryField field, int ttl_ms) {
+    std::lock_guard<std::mutex> lock(refresh_mutex_);
+    ttl_ms_[(int)field] = ttl_ms;
+}
+
+std::shared_ptr<const EC800TelemetrySnapshot> EC800Telemetry::snapshot() const {
+    return std::atomic_load(&snapshot_);
+}
+
+bool EC800Telemetry::IsFresh(EC800TelemetryField field) const {
+    auto updated_at = snapshot()->updated_at(field);
+    return updated_at > 0 && esp_timer_get_time() - updated_at <= ttl_ms_[(int)field] * 1000LL;
+}
+
+// Runs on the receive task; copy, modify, publish
+template <typename Function>
+void EC800Telemetry::Update(EC800TelemetryField field, Function update) {
+    std::lock_guard<std::mutex> lock(update_mutex_);
+    auto snapshot = std::make_shared<EC800TelemetrySnapshot>(*std::atomic_load(&snapshot_));
+    update(*snapshot);
+    snapshot->update_time_us[(int)field] = esp_timer_get_time();
+    std::atomic_store(&snapshot_, std::shared_ptr<const EC800TelemetrySnapshot>(std::move(snapshot)));
+}
+
+// Queue a background poll for every stale field, never waits for the modem
+void EC800Telemetry::Refresh() {
+    std::lock_guard<std::mutex> lock(refresh_mutex_);
+    if (timer_ == nullptr || modem_.data_mode()) {
+        return;
+    }
+    for (int i = 0; i < EC800_TELEMETRY_FIELD_COUNT; i++) {
+        auto field = (EC800TelemetryField)i;
+        if (IsFresh(field) || (refresh_[i] && !refresh_[i]->done())) {
+            continue;
+        }
+        if (refresh_[i] && !refresh_[i]->ok()) {
+            ESP_LOGD(TAG, "%s failed", kRefreshCommands[i]);
+        }
+        refresh_[i] = modem_.CommandAsync(kRefreshCommands[i], DEFAULT_COMMAND_TIMEOUT, AtCommandPriority::Background);
+    }
+}
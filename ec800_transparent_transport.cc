@@ -0,0 +1,159 @@
+#include "ec800_transparent_transport.h"
+#include <esp_log.h>
+#include <cstring>
+
+static const char *TAG = "EC800TransparentTransport";
+
+
+EC800TransparentTransport::EC800TransparentTransport(EC800AtModem& modem, int tcp_id)
+    : modem_(modem), tcp_id_(modem.AllocateConnectionId(EC800ConnectionKind::Socket, tcp_id)),
+      reconnector_(modem, [this]() { return OnModemReset(); }, [this](const std::string& host, int port) {
+          return Connect(host.c_str(), port);
+      }) {
+    event_group_handle_ = xEventGroupCreate();
+    if (tcp_id_ < 0) {
+        return;
+    }
+
+    urc_handlers_.push_back(modem_.RegisterUrcHandler("FIFO_OVERFLOW", EC800_URC_ANY_ID, [this](std::string_view command, const AtArgumentListEC& arguments) {
+        // 透传数据没有校验, 丢失的字节无法察觉也无法重读, 只能断开
+        if (!connected_ || !modem_.data_mode()) {
+            return;
+        }
+        ESP_LOGE(TAG, "Data lost in a receive overflow, closing the connection");
+        connected_ = false;
+        xEventGroupSetBits(event_group_handle_, EC800_TRANSPARENT_TRANSPORT_ERROR | EC800_TRANSPARENT_TRANSPORT_DISCONNECTED);
+        modem_.Defer([this]() { Disconnect(); }, this);
+    }));
+    reconnector_.Start();
+}
+
+EC800TransparentTransport::~EC800TransparentTransport() {
+    reconnector_.Stop();
+    Disconnect();
+    for (auto id : urc_handlers_) {
+        modem_.UnregisterUrcHandler(id);
+    }
+    modem_.CancelDeferred(this);
+    vEventGroupDelete(event_group_handle_);
+    modem_.ReleaseConnectionId(EC800ConnectionKind::Socket, tcp_id_);
+}
+
+bool EC800TransparentTransport::Connect(const char* host, int port) {
+    char command[128];
+
+    if (tcp_id_ < 0) {
+        ESP_LOGE(TAG, "No connect id");
+        return false;
+    }
+    if (opened_) {
+        Disconnect();
+    }
+    reconnector_.Remember(host, port);
+    xEventGroupClearBits(event_group_handle_, EC800_TRANSPARENT_TRANSPORT_DISCONNECTED | EC800_TRANSPARENT_TRANSPORT_ERROR |
+        EC800_TRANSPARENT_TRANSPORT_RECEIVE);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        rx_buffer_.clear();
+    }
+
+    // 场景激活
+    if (!modem_.Command("AT+QIACT?")) {
+        ESP_LOGE(TAG, "Failed to query PDP context");
+        return false;
+    }
+
+    // 打开 TCP 连接, 透传模式, 模组回复 CONNECT 后串口即为数据通道
+    snprintf(command, sizeof(command), "AT+QIOPEN=1,%d,\"TCP\",\"%s\",%d,0,2", tcp_id_, host, port);
+    opened_ = true;
+    bool ok = modem_.EnterDataMode(command, [this](const char* data, size_t length) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        rx_buffer_.append(data, length);
+        xEventGroupSetBits(event_group_handle_, EC800_TRANSPARENT_TRANSPORT_RECEIVE);
+    }, [this]() {
+        connected_ = false;
+        xEventGroupSetBits(event_group_handle_, EC800_TRANSPARENT_TRANSPORT_DISCONNECTED);
+    }, TRANSPARENT_CONNECT_TIMEOUT_MS);
+    if (!ok) {
+        ESP_LOGE(TAG, "Failed to connect to %s:%d", host, port);
+        return false;
+    }
+    connected_ = true;
+    return true;
+}
+
+void EC800TransparentTransport::Disconnect() {
+    reconnector_.Forget();
+    if (connected_) {
+        connected_ = false;
+        xEventGroupSetBits(event_group_handle_, EC800_TRANSPARENT_TRANSPORT_DISCONNECTED);
+    }
+    // 对端关闭后模组中的 socket 仍然存在, 需要 AT+QICLOSE 释放
+    if (!opened_) {
+        return;
+    }
+    opened_ = false;
+    modem_.ExitDataMode();
+    modem_.Command("AT+QICLOSE=" + std::to_string(tcp_id_));
+}
+
+// 模组重启后 socket 已不存在, 无需 AT+QICLOSE
+bool EC800TransparentTransport::OnModemReset() {
+    opened_ = false;
+    if (!connected_) {
+        return false;
+    }
+    connected_ = false;
+    xEventGroupSetBits(event_group_handle_, EC800_TRANSPARENT_TRANSPORT_DISCONNECTED);
+    return true;
+}
+
+bool EC800TransparentTransport::Restore() {
+    return reconnector_.Restore();
+}
+
+bool EC800TransparentTransport::Suspend() {
+    return connected_ && modem_.ExitDataMode();
+}
+
+bool EC800TransparentTransport::Resume() {
+    return connected_ && modem_.ResumeDataMode(TRANSPARENT_CONNECT_TIMEOUT_MS);
+}
+
+int EC800TransparentTransport::Send(const char* data, size_t length) {
+    if (!connected_) {
+        ESP_LOGE(TAG, "未连接");
+        return -1;
+    }
+    int ret = modem_.WriteRaw(data, length);
+    if (ret < 0) {
+        ESP_LOGE(TAG, "发送数据失败, 不在透传模式");
+    }
+    return ret;
+}
+
+int EC800TransparentTransport::Receive(char* buffer, size_t bufferSize) {
+    while (true) {
+        if (xEventGroupGetBits(event_group_handle_) & EC800_TRANSPARENT_TRANSPORT_ERROR) {
+            // What is buffered is followed by a gap, the stream cannot be continued
+            ESP_LOGE(TAG, "Failed to receive data, stream is incomplete");
+            return -1;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!rx_buffer_.empty()) {
+                size_t length = std::min(bufferSize, rx_buffer_.size());
+                memcpy(buffer, rx_buffer_.data(), length);
+                rx_buffer_.erase(0, length);
+                return length;
+            }
+        }
+        if (!connected_) {
+            return 0;
+        }
+        auto bits = xEventGroupWaitBits(event_group_handle_, EC800_TRANSPARENT_TRANSPORT_RECEIVE | EC800_TRANSPARENT_TRANSPORT_DISCONNECTED, pdTRUE, pdFALSE, portMAX_DELAY);
+        if (bits & EC800_TRANSPARENT_TRANSPORT_DISCONNECTED) {
+            return (xEventGroupGetBits(event_group_handle_) & EC800_TRANSPARENT_TRANSPORT_ERROR) ? -1 : 0;
+        }
+    }
+}
@@ -5,66 +5,91 @@
 #define TAG "EC800Udp"
 
 
-EC800Udp::EC800Udp(EC800AtModem& modem, int udp_id) : modem_(modem), udp_id_(udp_id) {
+EC800Udp::EC800Udp(EC800AtModem& modem, int udp_id)
+    : modem_(modem), udp_id_(modem.AllocateConnectionId(EC800ConnectionKind::Socket, udp_id)),
+      reconnector_(modem, [this]() { return OnModemReset(); }, [this](const std::string& host, int port) {
+          return Connect(host, port);
+      }) {
     event_group_handle_ = xEventGroupCreate();
+    // 没有可用的 id 时不注册任何处理, Connect() 会失败
+    if (udp_id_ < 0) {
+        return;
+    }
 
-    command_callback_it_ = modem_.RegisterCommandResponseCallback([this](const std::string& command, const std::vector<AtArgumentValueEC>& arguments) {
-        if (command == "QISTATE" && arguments.size() == 2) {
-            if (arguments[0].int_value == udp_id_) {
-                if (arguments[1].int_value == 0) {
-                    connected_ = true;
-                    xEventGroupClearBits(event_group_handle_, EC800_UDP_DISCONNECTED | EC800_UDP_ERROR);
-                    xEventGroupSetBits(event_group_handle_, EC800_UDP_CONNECTED);
-                } else {
-                    connected_ = false;
-                    xEventGroupSetBits(event_group_handle_, EC800_UDP_ERROR);
-                }
-            }
-        } else if (command == "QISTATE" && arguments.size() == 1) {
-            if (arguments[0].int_value == udp_id_) {
+    urc_handlers_.push_back(modem_.RegisterUrcHandler("QISTATE", udp_id_, [this](std::string_view command, const AtArgumentListEC& arguments) {
+        if (arguments.size() == 2) {
+            if (arguments[1].int_value() == 0) {
+                connected_ = true;
+                xEventGroupClearBits(event_group_handle_, EC800_UDP_DISCONNECTED | EC800_UDP_ERROR);
+                xEventGroupSetBits(event_group_handle_, EC800_UDP_CONNECTED);
+            } else {
                 connected_ = false;
-                xEventGroupSetBits(event_group_handle_, EC800_UDP_DISCONNECTED);
+                xEventGroupSetBits(event_group_handle_, EC800_UDP_ERROR);
             }
-        } else if (command == "QISEND" && arguments.size() == 2) {
-            if (arguments[0].int_value == udp_id_) {
-                xEventGroupSetBits(event_group_handle_, EC800_UDP_SEND_COMPLETE);
+        } else if (arguments.size() == 1) {
+            connected_ = false;
+            xEventGroupSetBits(event_group_handle_, EC800_UDP_DISCONNECTED);
+        }
+    }));
+    urc_handlers_.push_back(modem_.RegisterUrcHandler("QISEND", udp_id_, [this](std::string_view command, const AtArgumentListEC& arguments) {
+        if (arguments.size() == 2) {
+            xEventGroupSetBits(event_group_handle_, EC800_UDP_SEND_COMPLETE);
+        }
+    }));
+    urc_handlers_.push_back(modem_.RegisterUrcHandler("QIURC", udp_id_, [this](std::string_view command, const AtArgumentListEC& arguments) {
+        if (arguments[0].string_value() == "recv") {
+            // Direct push carries the length and the payload follows, buffer access has to be read out
+            if (arguments.size() < 3) {
+                modem_.RequestRead(udp_id_);
             }
-        } else if (command == "QIURC" && arguments.size() == 2) {
-                if (arguments[0].string_value == "rudp") {
-                    if (message_callback_) {
-                        message_callback_(modem_.DecodeHex(arguments[3].string_value));
-                    }
-                } else if (arguments[0].string_value == "closed") {
-                    connected_ = false;
-                    xEventGroupSetBits(event_group_handle_, EC800_UDP_DISCONNECTED);
-                } else {
-                    ESP_LOGE(TAG, "Unknown MIPURC command: %s", arguments[0].string_value.c_str());
-                }
-                modem_.Command(std::string("AT+QIRD=") + std::to_string(udp_id_) + "," + std::to_string(arguments[1].int_value));
-        } else if (command == "MIPSTATE" && arguments.size() == 5) {
-            if (arguments[0].int_value == udp_id_) {
-                if (arguments[4].string_value == "INITIAL") {
-                    connected_ = false;
-                } else {
-                    connected_ = true;
-                }
-                xEventGroupSetBits(event_group_handle_, EC800_UDP_INITIALIZED);
+        } else if (arguments[0].string_value() == "closed") {
+            connected_ = false;
+            xEventGroupSetBits(event_group_handle_, EC800_UDP_DISCONNECTED);
+        } else {
+            ESP_LOGE(TAG, "Unknown MIPURC command: %.*s", (int)arguments[0].string_value().size(), arguments[0].string_value().data());
+        }
+    }));
+    urc_handlers_.push_back(modem_.RegisterUrcHandler("MIPSTATE", udp_id_, [this](std::string_view command, const AtArgumentListEC& arguments) {
+        if (arguments.size() == 5) {
+            if (arguments[4].string_value() == "INITIAL") {
+                connected_ = false;
+            } else {
+                connected_ = true;
             }
-        } else if (command == "FIFO_OVERFLOW") {
-            xEventGroupSetBits(event_group_handle_, EC800_UDP_ERROR);
-            Disconnect();
+            xEventGroupSetBits(event_group_handle_, EC800_UDP_INITIALIZED);
         }
-    });
+    }));
+    urc_handlers_.push_back(modem_.RegisterUrcHandler("FIFO_OVERFLOW", EC800_URC_ANY_ID, [this](std::string_view command, const AtArgumentListEC& arguments) {
+        // Losing a datagram is fine for UDP, only drop the one that was cut
+        if (EC800AtModem::OverflowDamaged(arguments, EC800ConnectionKind::Socket, udp_id_)) {
+            datagram_.clear();
+        }
+        if (connected_ && receive_mode_ == EC800ReceiveMode::Buffer) {
+            modem_.RequestRead(udp_id_);
+        }
+    }));
+    reconnector_.Start();
 }
 
 EC800Udp::~EC800Udp() {
+    reconnector_.Stop();
     Disconnect();
-    modem_.UnregisterCommandResponseCallback(command_callback_it_);
+    modem_.UnregisterPayloadSink(udp_id_, payload_generation_);
+    for (auto id : urc_handlers_) {
+        modem_.UnregisterUrcHandler(id);
+    }
+    modem_.CancelDeferred(this);
+    modem_.ReleaseConnectionId(EC800ConnectionKind::Socket, udp_id_);
 }
 
 bool EC800Udp::Connect(const std::string& host, int port) {
     char command[64];
 
+    if (udp_id_ < 0) {
+        ESP_LOGE(TAG, "No connect id");
+        return false;
+    }
+
     // Clear bits
     xEventGroupClearBits(event_group_handle_, EC800_UDP_CONNECTED | EC800_UDP_DISCONNECTED | EC800_UDP_ERROR);
 
@@ -81,32 +106,47 @@ bool EC800Udp::Connect(const std::string& host, int port) {
     if (connected_) {
         Disconnect();
     }
+    reconnector_.Remember(host, port);
+
+    // 有缓存的 DNS 结果时直接连地址, 失败后用域名再试一次
+    std::string address = modem_.ResolveCached(host);
+    OpenPayloadSink();
+    while (true) {
+        // 打开 TCP 连接
+        sprintf(command, "AT+QIOPEN=1,%d,\"TCP\",\"%s\",%d,0,%d", udp_id_, address.c_str(), port, receive_mode_ == EC800ReceiveMode::DirectPush ? 1 : 0);
+        if (!modem_.Command(command)) {
+            ESP_LOGE(TAG, "Failed to open UDP connection");
+            return false;
+        }
 
-    // 打开 TCP 连接
-    sprintf(command, "AT+QIOPEN=1,%d,\"TCP\",\"%s\",%d,0,0", udp_id_, host.c_str(), port);
-    if (!modem_.Command(command)) {
-        ESP_LOGE(TAG, "Failed to open UDP connection");
-        return false;
-    }
-
-    // 查询连接状态
-    sprintf(command, "AT+QISTATE=%d,0", udp_id_);
-    if (!modem_.Command(command)) {
-        ESP_LOGE(TAG, "Failed to set HEX encoding");
-        return false;
-    }
+        // 查询连接状态
+        sprintf(command, "AT+QISTATE=%d,0", udp_id_);
+        if (!modem_.Command(command)) {
+            ESP_LOGE(TAG, "Failed to set HEX encoding");
+            return false;
+        }
 
-    // 等待连接完成
-    bits = xEventGroupWaitBits(event_group_handle_, EC800_UDP_CONNECTED | EC800_UDP_ERROR, pdTRUE, pdFALSE, UDP_CONNECT_TIMEOUT_MS / portTICK_PERIOD_MS);
-    if (bits & EC800_UDP_ERROR) {
-        ESP_LOGE(TAG, "Failed to connect to %s:%d", host.c_str(), port);
-        return false;
+        // 等待连接完成
+        bits = xEventGroupWaitBits(event_group_handle_, EC800_UDP_CONNECTED | EC800_UDP_ERROR, pdTRUE, pdFALSE, UDP_CONNECT_TIMEOUT_MS / portTICK_PERIOD_MS);
+        if (!(bits & EC800_UDP_ERROR)) {
+            return true;
+        }
+        if (address == host) {
+            break;
+        }
+        ESP_LOGW(TAG, "Failed to connect to %s, retrying with %s", address.c_str(), host.c_str());
+        modem_.InvalidateDns(host);
+        modem_.Command("AT+QICLOSE=" + std::to_string(udp_id_));
+        address = host;
     }
-    return true;
+    ESP_LOGE(TAG, "Failed to connect to %s:%d", host.c_str(), port);
+    return false;
 }
 
 
 void EC800Udp::Disconnect() {
+    reconnector_.Forget();
+    modem_.UnregisterPayloadSink(udp_id_, payload_generation_);
     if (!connected_) {
         return;
     }
@@ -114,8 +154,45 @@ void EC800Udp::Disconnect() {
     modem_.Command("AT+QICLOSE=" + std::to_string(udp_id_));
 }
 
+bool EC800Udp::OnModemReset() {
+    if (!connected_) {
+        return false;
+    }
+    connected_ = false;
+    datagram_.clear();
+    xEventGroupSetBits(event_group_handle_, EC800_UDP_DISCONNECTED);
+    return true;
+}
+
+bool EC800Udp::Restore() {
+    return reconnector_.Restore();
+}
+
+// One datagram per "recv" URC or QIRD response, delivered once complete. A datagram of an
+// earlier open still in the modem pipe is dropped.
+void EC800Udp::OpenPayloadSink() {
+    datagram_.clear();
+    payload_generation_ = modem_.RegisterPayloadSink(udp_id_, [this](const char* data, size_t length, size_t remaining) {
+        datagram_.append(data, length);
+        if (remaining == 0) {
+            if (message_callback_) {
+                message_callback_(datagram_);
+            }
+            datagram_.clear();
+        }
+    });
+}
+
+void EC800Udp::SetSendMode(EC800SendMode mode) {
+    send_mode_ = mode;
+}
+
+void EC800Udp::SetReceiveMode(EC800ReceiveMode mode) {
+    receive_mode_ = mode;
+}
+
 int EC800Udp::Send(const std::string& data) {
-    const size_t MAX_PACKET_SIZE = 1460 / 2;
+    const size_t MAX_PACKET_SIZE = send_mode_ == EC800SendMode::Binary ? 1460 : 1460 / 2;
 
     if (!connected_) {
         ESP_LOGE(TAG, "未连接");
@@ -127,20 +204,30 @@ int EC800Udp::Send(const std::string& data) {
         return -1;
     }
 
+    if (send_mode_ == EC800SendMode::Binary) {
+        // AT+QISEND=<id>,<len>, 等待 '>' 后直接写入原始数据
+        std::string command = "AT+QISEND=" + std::to_string(udp_id_) + "," + std::to_string(data.size());
+        if (!modem_.CommandWithData(command, data, DEFAULT_COMMAND_TIMEOUT, AtCommandPriority::Realtime)) {
+            ESP_LOGE(TAG, "发送数据块失败");
+            return -1;
+        }
+        return data.size();
+    }
+
     // 在循环外预先分配command
     std::string command = "AT+QISENDEX=" + std::to_string(udp_id_) + "," ;
 
     // 直接在command字符串上进行十六进制编码
     modem_.EncodeHexAppend(command, data.c_str(), data.size());
 
-    if (!modem_.Command(command, 100)) {
+    if (!modem_.Command(command, 100, AtCommandPriority::Realtime)) {
         ESP_LOGE(TAG, "发送数据块失败");
         return -1;
     }
 
     command.clear();
-    command = "AT+QISEND=0,0";
-    modem_.Command(command);
+    command = "AT+QISEND=" + std::to_string(udp_id_) + ",0";
+    modem_.Command(command, DEFAULT_COMMAND_TIMEOUT, AtCommandPriority::Realtime);
 
     return data.size();
 }
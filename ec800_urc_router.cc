@@ -0,0 +1,56 @@
+#include "ec800_urc_router.h"
+
+EC800UrcRouter::HandlerId EC800UrcRouter::Register(std::string_view urc, int connection_id, EcCommandResponseViewCallback handler) {
+    HandlerId id = next_id_++;
+    routes_.emplace(Key(EcUrcHash(urc), connection_id), Route{id, std::string(urc), std::move(handler)});
+    return id;
+}
+
+void EC800UrcRouter::Unregister(HandlerId id) {
+    for (auto it = routes_.begin(); it != routes_.end(); ++it) {
+        if (it->second.id == id) {
+            routes_.erase(it);
+            return;
+        }
+    }
+}
+
+size_t EC800UrcRouter::Dispatch(uint32_t hash, std::string_view urc, int connection_id, const AtArgumentListEC& arguments) {
+    size_t count = 0;
+    if (connection_id != EC800_URC_ANY_ID) {
+        count += DispatchKey(Key(hash, connection_id), urc, arguments);
+    }
+    count += DispatchKey(Key(hash, EC800_URC_ANY_ID), urc, arguments);
+    return count;
+}
+
+std::vector<EcCommandResponseViewCallback> EC800UrcRouter::Handlers(uint32_t hash, std::string_view urc, int connection_id) const {
+    std::vector<EcCommandResponseViewCallback> handlers;
+    auto collect = [&](uint64_t key) {
+        auto range = routes_.equal_range(key);
+        for (auto it = range.first; it != range.second; ++it) {
+            if (it->second.urc == urc) {
+                handlers.push_back(it->second.handler);
+            }
+        }
+    };
+    if (connection_id != EC800_URC_ANY_ID) {
+        collect(Key(hash, connection_id));
+    }
+    collect(Key(hash, EC800_URC_ANY_ID));
+    return handlers;
+}
+
+size_t EC800UrcRouter::DispatchKey(uint64_t key, std::string_view urc, const AtArgumentListEC& arguments) {
+    size_t count = 0;
+    auto range = routes_.equal_range(key);
+    for (auto it = range.first; it != range.second; ++it) {
+        // Guard against hash collisions with names nobody subscribed to
+        if (it->second.urc != urc) {
+            continue;
+        }
+        it->second.handler(urc, arguments);
+        count++;
+    }
+    return count;
+}
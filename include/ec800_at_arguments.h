@@ -0,0 +1,47 @@
+#ifndef EC800_AT_ARGUMENTS_H
+#define EC800_AT_ARGUMENTS_H
+
+#include <array>
+#include <cstddef>
+#include <string_view>
+
+// One argument of a "+XXX: a,b,c" line, viewing the receive buffer.
+// Numbers are parsed on demand and never throw.
+struct AtArgumentViewEC {
+    std::string_view raw;
+    bool quoted = false;
+
+    std::string_view string_value() const { return raw; }
+    bool ToInt(int& value) const;
+    bool ToDouble(double& value) const;
+    // Parsed value, or default_value if the argument is not a number
+    int int_value(int default_value = -1) const;
+    double double_value(double default_value = 0) const;
+
+    bool operator==(std::string_view other) const { return raw == other; }
+    bool operator!=(std::string_view other) const { return raw != other; }
+};
+
+// Fixed-capacity argument list. Splits on commas outside of quotes; if there are
+// more than kMaxArguments fields the last one keeps the rest of the line.
+class AtArgumentListEC {
+public:
+    static constexpr size_t kMaxArguments = 16;
+
+    AtArgumentListEC() = default;
+    explicit AtArgumentListEC(std::string_view values) { Parse(values); }
+
+    void Parse(std::string_view values);
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    const AtArgumentViewEC& operator[](size_t index) const { return arguments_[index]; }
+    const AtArgumentViewEC* begin() const { return arguments_.data(); }
+    const AtArgumentViewEC* end() const { return arguments_.data() + size_; }
+
+private:
+    std::array<AtArgumentViewEC, kMaxArguments> arguments_;
+    size_t size_ = 0;
+};
+
+#endif // EC800_AT_ARGUMENTS_H
@@ -0,0 +1,96 @@
+#ifndef EC800_AT_COMMAND_H
+#define EC800_AT_COMMAND_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+
+enum class AtCommandResult {
+    Pending,
+    Ok,
+    Error,
+    Timeout,
+    // Background command discarded while the link was busy
+    Dropped
+};
+
+// Scheduling class; a queued command of a higher class is always written first
+enum class AtCommandPriority {
+    Realtime,       // data path: QIRD, QISEND, MQTT publish
+    Interactive,    // default
+    Background,     // housekeeping polls, deferred while data flows and droppable
+};
+
+#define AT_COMMAND_PRIORITY_COUNT 3
+
+// One queued AT command and everything the modem answered to it.
+// Created by EC800AtModem::CommandAsync(), completed by the receive task.
+class EC800AtCommand {
+public:
+    typedef std::function<void(EC800AtCommand& command)> CompletionCallback;
+
+    EC800AtCommand(std::string command, int timeout_ms, AtCommandPriority priority = AtCommandPriority::Interactive, CompletionCallback on_complete = nullptr);
+
+    const std::string& command() const { return command_; }
+    // Written verbatim once the modem answers with the '>' or CONNECT prompt
+    const std::string& data() const { return data_; }
+    int timeout_ms() const { return timeout_ms_; }
+    AtCommandPriority priority() const { return priority_; }
+
+    AtCommandResult result();
+    bool done() { return result() != AtCommandResult::Pending; }
+    bool ok() { return result() == AtCommandResult::Ok; }
+    // +CME ERROR code, or -1
+    int error_code() const { return error_code_; }
+    // Information text received before the final result code: the "+VERB: " lines of the
+    // command's own verb, and bare text lines for commands that answer that way (ATI,
+    // AT+CGSN ...). URCs and unsolicited text such as RDY are not included.
+    const std::vector<std::string>& response_lines() const { return response_lines_; }
+    // First information line, or empty
+    std::string response() const { return response_lines_.empty() ? std::string() : response_lines_.front(); }
+    // The command line as echoed by the module while ATE1 is on, empty otherwise
+    const std::string& echo() const { return echo_; }
+
+    // Block until the command completes; returns ok(). A negative timeout waits forever.
+    bool Wait(int timeout_ms = -1);
+
+    // Timestamps in microseconds (esp_timer clock), 0 if not reached yet
+    int64_t enqueue_time_us() const { return enqueue_time_us_; }
+    int64_t write_time_us() const { return write_time_us_; }
+    int64_t complete_time_us() const { return complete_time_us_; }
+
+private:
+    friend class EC800AtModem;
+
+    void AppendLine(std::string_view line);
+    // First completion wins, later ones (e.g. a timeout racing a late OK) are ignored
+    bool Complete(AtCommandResult result, int error_code = -1);
+    void SignalPrompt();
+    // True once prompted, false if the command completed or timed out first
+    bool WaitForPrompt(int timeout_ms);
+
+    std::string command_;
+    std::string data_;
+    bool prompted_ = false;
+    int timeout_ms_;
+    AtCommandPriority priority_;
+    CompletionCallback on_complete_;
+    std::vector<std::string> response_lines_;
+    std::string echo_;
+    AtCommandResult result_ = AtCommandResult::Pending;
+    int error_code_ = -1;
+    int64_t enqueue_time_us_ = 0;
+    int64_t write_time_us_ = 0;
+    int64_t complete_time_us_ = 0;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+};
+
+typedef std::shared_ptr<EC800AtCommand> EC800AtCommandHandle;
+
+#endif // EC800_AT_COMMAND_H
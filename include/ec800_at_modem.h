@@ -3,10 +3,16 @@
 
 #include <cstddef>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <list>
+#include <map>
+#include <unordered_map>
 #include <functional>
 #include <mutex>
+#include <deque>
+#include <atomic>
+#include <condition_variable>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <freertos/queue.h>
@@ -14,14 +20,91 @@
 #include <driver/gpio.h>
 #include <driver/uart.h>
 
-#define AT_EVENT_DATA_AVAILABLE BIT1
-#define AT_EVENT_COMMAND_DONE BIT2
-#define AT_EVENT_COMMAND_ERROR BIT3
+#include "ec800_ring_buffer.h"
+#include "ec800_at_arguments.h"
+#include "ec800_urc_router.h"
+#include "ec800_at_command.h"
+#include "ec800_at_stats.h"
+#include "ec800_cmux.h"
+#include "ec800_hex.h"
+#include "ec800_boot_profile.h"
+#include "ec800_dns_cache.h"
+
+class EC800Supervisor;
+
 #define AT_EVENT_NETWORK_READY BIT4
+// SIM or registration state changed, wakes WaitForNetworkReady()
+#define AT_EVENT_NETWORK_STATE BIT5
+
+// The receive task reads, parses and runs URC handlers, size its stack for the handlers
+#ifndef AT_RECEIVE_TASK_STACK_SIZE
+#define AT_RECEIVE_TASK_STACK_SIZE (4096 * 2)
+#endif
+#ifndef AT_RECEIVE_TASK_PRIORITY
+#define AT_RECEIVE_TASK_PRIORITY 5
+#endif
+// Runs work handed over by URC handlers through Defer()
+#ifndef AT_DEFER_TASK_STACK_SIZE
+#define AT_DEFER_TASK_STACK_SIZE 4096
+#endif
+#ifndef AT_DEFER_TASK_PRIORITY
+#define AT_DEFER_TASK_PRIORITY 5
+#endif
+#define AT_DEFER_QUEUE_LIMIT 16
+#ifndef AT_COMMAND_TASK_STACK_SIZE
+#define AT_COMMAND_TASK_STACK_SIZE 4096
+#endif
+#ifndef AT_COMMAND_TASK_PRIORITY
+#define AT_COMMAND_TASK_PRIORITY 5
+#endif
 
 #define DEFAULT_COMMAND_TIMEOUT 3000
 #define DEFAULT_BAUD_RATE 115200
 #define DEFAULT_UART_NUM UART_NUM_1
+#define DEFAULT_APN "UNINET"
+
+// Adaptive pacing between a final result code and the next command write
+#define AT_COMMAND_GAP_MIN_US 1000
+#define AT_COMMAND_GAP_MAX_US 50000
+// Background commands wait until no realtime command was written for this long
+#define AT_BACKGROUND_DEFER_MS 200
+// ... and are dropped when they could not be sent within this time
+#define AT_BACKGROUND_MAX_WAIT_MS 10000
+#define AT_BACKGROUND_QUEUE_LIMIT 8
+// A command whose '>' prompt did not come in time is cancelled with ESC; the module gets
+// this long to answer before the next command is written
+#define AT_PROMPT_CANCEL_MS 500
+// Silence required before and after the "+++" escape sequence
+#define AT_DATA_MODE_GUARD_MS 1000
+// CGATT? fallback poll in case an attach URC was missed
+#define AT_ATTACH_POLL_MS 10000
+// Maximum response time of AT+QIACT
+#define AT_PDP_ACTIVATE_TIMEOUT_MS 150000
+// AT+CFUN=1,1 answers right before the module restarts; a hung module does not answer at all
+#define AT_RESET_TIMEOUT_MS 1000
+// A boot message this long after Reset() belongs to that restart, which was announced already
+#define AT_RESET_BOOT_WINDOW_MS 30000
+// Link test run at every step of NegotiateBaudRate(): with ATE1 the module echoes a long
+// harmless command (a file listing of a name that does not exist), which has to come
+// back byte for byte
+#define AT_LINK_TEST_COMMAND "AT+QFLST="
+#define AT_LINK_TEST_PATTERN_LENGTH 256
+#define AT_LINK_TEST_ROUNDS 16
+// Framing errors and corrupt payloads tolerated per window before stepping the baud rate down
+#define AT_LINK_ERROR_THRESHOLD 8
+#define AT_LINK_ERROR_WINDOW_MS 10000
+// How long Resolve() waits by default, and after which an unanswered AT+QIDNSGIP is
+// given up so the next lookup can start (the module answers within 60 s)
+#define AT_DNS_RESOLVE_TIMEOUT_MS 15000
+#define AT_DNS_LOOKUP_TIMEOUT_MS 60000
+// Bytes asked for per AT+QIRD, one turn of the read scheduler
+#define AT_READ_CHUNK_SIZE 1500
+// Longest concatenated "AT+A;+B;..." line CommandBatch() builds
+#define AT_BATCH_LINE_MAX 256
+// RX FIFO level at which RTS tells the modem to pause
+#define AT_UART_RTS_THRESHOLD 100
+// Hex characters decoded per call into a streamed URC payload handler
+#define AT_STREAM_CHUNK_SIZE 256
 
 struct AtArgumentValueEC {
     enum class Type {
@@ -37,26 +120,282 @@ struct AtArgumentValueEC {
 
 typedef std::function<void(const std::string& command, const std::vector<AtArgumentValueEC>& arguments)> EcCommandResponseCallback;
 
+// How socket payloads are handed to the modem
+enum class EC800SendMode {
+    Binary,     // AT+QISEND=<id>,<len>, raw bytes after the '>' prompt
+    Hex,        // AT+QISENDEX=<id>,<hex>, twice the UART bytes
+};
+
+// How received socket payloads reach the host, the <access_mode> of AT+QIOPEN
+enum class EC800ReceiveMode {
+    Buffer,     // "recv" URC, then AT+QIRD to fetch the data
+    DirectPush, // "recv" URC carries the length, raw payload follows in the stream
+};
+
+// Raw socket payload for one connection, delivered in chunks straight from the receive
+// buffer. `remaining` is 0 on the last chunk of a segment or datagram.
+typedef std::function<void(const char* data, size_t length, size_t remaining)> EcPayloadSink;
+// Bytes received while the UART is a transparent data pipe
+typedef std::function<void(const char* data, size_t length)> EcRawDataCallback;
+
+// Connect id namespaces of the module
+enum class EC800ConnectionKind {
+    Socket,     // AT+QIOPEN <connectID> 0..11, TCP and UDP alike
+    Mqtt,       // AT+QMTOPEN <client_idx> 0..5
+    Http,       // MHTTPURC <httpid>, handed out by the module rather than this pool
+};
+
+#define EC800_CONNECTION_KIND_COUNT 3
+#define EC800_SOCKET_ID_COUNT 12
+#define EC800_MQTT_ID_COUNT 6
+// Pass instead of an id to let the modem pick a free one; distinct from EC800_URC_ANY_ID
+// and from the -1 an exhausted pool returns
+#define EC800_AUTO_CONNECTION_ID (-2)
+
+struct EC800SocketStats {
+    int connection_id;
+    int read_weight;
+    // Reads waiting for their turn, the one in flight included
+    size_t read_depth;
+    uint32_t reads;
+    uint64_t bytes_read;
+    // Longest time a read waited between being requested and written
+    uint32_t max_read_wait_us;
+};
+
+// Milestones of a cold start, in the order they are normally reached
+enum class EC800StartupStage {
+    UartUp,         // first AT answered
+    SimReady,       // +CPIN: READY
+    Registered,     // +CEREG stat 1 or 5
+    PdpActive,      // context 1 active
+    IpAssigned,     // address read back with AT+QIACT?
+};
+
+#define EC800_STARTUP_STAGE_COUNT 5
+
+// esp_timer time of the first time each stage was reached since power on or the last
+// MATREADY, 0 if not reached
+struct EC800StartupTimeline {
+    int64_t time_us[EC800_STARTUP_STAGE_COUNT];
+
+    int64_t at(EC800StartupStage stage) const { return time_us[(int)stage]; }
+};
+
+struct EC800LinkTestResult {
+    int baud_rate;
+    bool ok;
+    // Command and response bytes over the test duration, modem latency included
+    uint32_t bytes_per_second;
+    // Mismatched or failed rounds plus UART framing errors seen during the test
+    uint32_t errors;
+};
+
+// UART event that delivered a "+..." line to the return of its handlers, or with the
+// latency probe enabled, first RX edge of the burst to the return of its handlers
+struct AtUrcLatencyStats {
+    uint32_t count;
+    uint32_t min_us;
+    uint32_t max_us;
+    uint64_t total_us;
+};
+
+struct AtCommandQueueStats {
+    size_t depth;
+    size_t max_depth;
+    uint32_t enqueued;
+    uint32_t dropped;
+};
+
+struct EC800AtBatchResult {
+    bool ok;
+    // First command that did not succeed, -1 if all did
+    int failed_index;
+    // One per command; Pending for commands that were never run
+    std::vector<AtCommandResult> results;
+};
+
 class EC800AtModem {
 public:
     EC800AtModem(int tx_pin = GPIO_NUM_17, int rx_pin = GPIO_NUM_18, size_t rx_buffer_size = 2048);
     ~EC800AtModem();
 
     std::string EncodeHex(const std::string& data);
-    std::string DecodeHex(const std::string& data);
+    // Empty on invalid input
+    std::string DecodeHex(std::string_view data);
     void EncodeHexAppend(std::string& dest, const char* data, size_t length);
-    void DecodeHexAppend(std::string& dest, const char* data, size_t length);
+    // False on an odd length or a non-hex character, `dest` is left unchanged then
+    bool DecodeHexAppend(std::string& dest, const char* data, size_t length);
 
-    bool Command(const std::string command, int timeout_ms = DEFAULT_COMMAND_TIMEOUT);
+    // Queue a command; the handle completes with its own response lines and result. With a
+    // timeout of 0 the command is only sent: the handle completes once it is written and the
+    // queue moves on without waiting for the module's answer.
+    EC800AtCommandHandle CommandAsync(std::string command, int timeout_ms = DEFAULT_COMMAND_TIMEOUT,
+        AtCommandPriority priority = AtCommandPriority::Interactive, EC800AtCommand::CompletionCallback on_complete = nullptr);
+    // Queue a command that is followed by a payload once the modem prompts with '>' or CONNECT
+    EC800AtCommandHandle CommandWithDataAsync(std::string command, std::string data, int timeout_ms = DEFAULT_COMMAND_TIMEOUT,
+        AtCommandPriority priority = AtCommandPriority::Interactive, EC800AtCommand::CompletionCallback on_complete = nullptr);
+    bool CommandWithData(std::string command, std::string data, int timeout_ms = DEFAULT_COMMAND_TIMEOUT,
+        AtCommandPriority priority = AtCommandPriority::Interactive);
+    // CommandAsync() and wait for the result. On the receive task, i.e. inside a URC handler or
+    // payload callback, the command is only queued and false returned; use Defer() there.
+    // A timeout of 0 sends without waiting and returns false, as it did before the queue.
+    bool Command(const std::string command, int timeout_ms = DEFAULT_COMMAND_TIMEOUT, AtCommandPriority priority = AtCommandPriority::Interactive);
+    // Send a module setting unless the last command sent under `key` was the same and
+    // succeeded. The cache is dropped on Reset() and MATREADY, when the module forgets them.
+    bool Configure(const std::string& key, const std::string& command, int timeout_ms = DEFAULT_COMMAND_TIMEOUT);
+    // Several {key, command} settings, the changed ones sent as one CommandBatch()
+    bool Configure(const std::vector<std::pair<std::string, std::string>>& settings, int timeout_ms = DEFAULT_COMMAND_TIMEOUT);
+    void ClearConfigCache();
+    uint32_t config_skip_count() const { return config_skip_count_; }
+    // Run several independent commands with as few round trips as possible. Consecutive
+    // extended commands ("AT+...") are joined into one "AT+A;+B" line, the others are queued
+    // back to back, each line still waiting for the result of the one before. When a joined
+    // line fails, the commands not known to have run are replayed one by one to find the
+    // culprit; set commands answer nothing, so batch only settings that are safe to repeat.
+    // Waits for all of them; `timeout_ms` applies per command.
+    EC800AtBatchResult CommandBatch(const std::vector<std::string>& commands, int timeout_ms = DEFAULT_COMMAND_TIMEOUT,
+        AtCommandPriority priority = AtCommandPriority::Interactive);
+    size_t command_queue_depth();
+    AtCommandQueueStats GetCommandQueueStats(AtCommandPriority priority);
+    // Per-verb counts and write-to-result latency histograms
+    std::vector<AtVerbStats> GetCommandStats() { return command_stats_.Snapshot(); }
+    void ResetCommandStats() { command_stats_.Reset(); }
+    AtUrcLatencyStats GetUrcLatencyStats();
+    void ResetUrcLatencyStats();
+    // Timestamp URCs on the first falling edge of the RX pin instead of the UART event, so
+    // the driver and the reader's wake-up are measured too. An interrupt per edge, for
+    // measurements only; the stats are reset.
+    bool EnableUrcLatencyProbe();
+    bool urc_latency_probe() const { return urc_latency_probe_; }
+    // Lowest free stack of the receive task so far, in bytes as ESP-IDF counts stacks
+    size_t receive_task_stack_free() const { return uxTaskGetStackHighWaterMark(receive_task_handle_); }
+    UBaseType_t receive_task_priority() const { return uxTaskPriorityGet(receive_task_handle_); }
+    void SetReceiveTaskPriority(UBaseType_t priority) { vTaskPrioritySet(receive_task_handle_, priority); }
     std::list<EcCommandResponseCallback>::iterator RegisterCommandResponseCallback(EcCommandResponseCallback callback);
     void UnregisterCommandResponseCallback(std::list<EcCommandResponseCallback>::iterator iterator);
+    std::list<EcCommandResponseViewCallback>::iterator RegisterCommandResponseCallback(EcCommandResponseViewCallback callback);
+    void UnregisterCommandResponseCallback(std::list<EcCommandResponseViewCallback>::iterator iterator);
+    // Subscribe to one URC name, optionally only for one connection id (EC800_URC_ANY_ID for all)
+    EC800UrcRouter::HandlerId RegisterUrcHandler(std::string_view urc, int connection_id, EcCommandResponseViewCallback handler);
+    void UnregisterUrcHandler(EC800UrcRouter::HandlerId id);
+    // Stream the hex payload at argument `payload_index` of `urc` lines into `handler`, only for
+    // lines whose first argument equals `type` if it is not empty. Matching lines bypass the
+    // URC handlers and response callbacks.
+    EC800UrcRouter::HandlerId RegisterUrcStream(std::string_view urc, std::string_view type, int connection_id,
+        size_t payload_index, EcUrcStreamHandler handler);
+    void UnregisterUrcStream(EC800UrcRouter::HandlerId id);
+    // Run `work` on the modem's deferred work task. URC handlers and payload callbacks run on
+    // the receive task and must hand anything that waits for a command result over to here.
+    // Work runs in order; `owner` tags it for CancelDeferred(). False if the queue is full.
+    bool Defer(std::function<void()> work, const void* owner = nullptr);
+    // Drop queued work of `owner` and wait for its running work to return, and for a running
+    // MODEM_RESET notification, whose handlers are called without the modem's lock. Call it
+    // in the owner's destructor after unregistering its handlers.
+    void CancelDeferred(const void* owner);
+    // Receive the payload following "+QIURC: \"recv\",<id>,<len>" and "+QIRD: <len>[,<ip>,<port>]".
+    // Register once per open of the connection; the returned generation keeps a payload that
+    // started under an earlier open from reaching this one. Unregistering an older generation
+    // leaves a newer sink in place.
+    uint32_t RegisterPayloadSink(int connection_id, EcPayloadSink sink);
+    void UnregisterPayloadSink(int connection_id, uint32_t generation);
 
+    // Take a free connect id, `preferred` if it is free. Ids are reused in the order they
+    // were released, so late URCs of a closed connection rarely reach the next owner.
+    // -1 if the pool is exhausted.
+    int AllocateConnectionId(EC800ConnectionKind kind, int preferred = EC800_AUTO_CONNECTION_ID);
+    // Also drops the socket's pending reads
+    void ReleaseConnectionId(EC800ConnectionKind kind, int connection_id);
+    // Buffer access mode: fetch what the modem holds for a socket, e.g. after a "recv" URC.
+    // Sockets take turns, one AT+QIRD at a time and `weight` reads per turn (SetReadWeight),
+    // and each socket is read until the modem reports it empty.
+    void RequestRead(int connection_id);
+    void SetReadWeight(int connection_id, int weight);
+    std::vector<EC800SocketStats> GetSocketStats();
+
+    // Transparent access: send `command` (e.g. AT+QIOPEN with access mode 2) and, once the
+    // modem answers CONNECT, turn the UART into a raw pipe. Commands fail with Dropped while
+    // it is, and received bytes go to on_data until ExitDataMode() or NO CARRIER (on_closed).
+    // NO CARRIER only counts when the guard time of silence follows it.
+    bool EnterDataMode(const std::string& command, EcRawDataCallback on_data, std::function<void()> on_closed = nullptr,
+        int timeout_ms = DEFAULT_COMMAND_TIMEOUT);
+    int WriteRaw(const char* data, size_t length);
+    // "+++" with guard times, then wait for its OK; the connection stays open and can be
+    // resumed with ATO
+    bool ExitDataMode();
+    bool ResumeDataMode(int timeout_ms = DEFAULT_COMMAND_TIMEOUT);
+    bool data_mode() const { return data_mode_; }
+
+    // Switch the UART to 27.010 multiplexing (AT+CMUX=0). AT commands and URCs move to
+    // DLCI 1 and data mode (PPP, transparent) to DLCI 2, so commands keep running while the
+    // pipe is open. At least two channels are opened. With three channels or more DLCI 3
+    // becomes a second AT lane: realtime commands keep DLCI 1 to themselves and interactive
+    // and background ones run next to them, so a slow command no longer holds up the data
+    // path. The channel count is fixed by the first call.
+    bool EnableCmux(size_t channel_count = 3);
+    void DisableCmux();
+    bool cmux_active() const { return cmux_active_; }
+    EC800CmuxChannel* GetCmuxChannel(int dlci) { return cmux_active_ ? cmux_->channel(dlci) : nullptr; }
+
+    // Also called on RDY, the EC800 boot message
     void OnMaterialReady(std::function<void()> callback);
+    // Restart the module with AT+CFUN=1,1. Cached settings, DNS answers and the network
+    // state are dropped and connections get the pseudo URC "MODEM_RESET" from the deferred
+    // work task, once per restart: the boot message that follows does not repeat it.
     void Reset();
+    // Find the module again after a restart: detect its baud rate within timeout_ms and
+    // switch back to the rate used before
+    bool ResyncUart(int timeout_ms);
+    // Commands that timed out in a row, reset by any answer from the module
+    uint32_t consecutive_timeouts() const { return consecutive_timeouts_; }
+    void ResetConsecutiveTimeouts() { consecutive_timeouts_ = 0; }
+    // The supervisor watching this modem, nullptr if none. Connections created while one is
+    // attached register their Restore() with it.
+    EC800Supervisor* supervisor() const { return supervisor_; }
+    void SetSupervisor(EC800Supervisor* supervisor) { supervisor_ = supervisor; }
+    // esp_timer time of the last byte received, 0 if none yet
+    int64_t last_receive_time_us() const { return last_receive_time_us_; }
     void ResetConnections();
     void SetDebug(bool debug);
     bool SetBaudRate(int new_baud_rate);
-    int WaitForNetworkReady();
+    // Step up from the current rate towards max_baud_rate and keep the fastest rate whose
+    // link test is clean. Afterwards the rate steps down on its own when framing errors or
+    // corrupt payloads pile up. Run it before any traffic; returns the rate in use.
+    int NegotiateBaudRate(int max_baud_rate = 921600);
+    std::vector<EC800LinkTestResult> GetLinkTestResults();
+    int baud_rate() const { return baud_rate_; }
+    uint32_t link_error_count() const { return link_error_count_; }
+    // Wait for +CEREG/+CGEV to report the attach, then bring up PDP context 1.
+    // 0 on success, -1 SIM not ready, -2 registration denied, -3 PDP context not configured or activated,
+    // -4 not attached within timeout_ms (a negative timeout waits forever).
+    int WaitForNetworkReady(int timeout_ms = -1);
+    EC800StartupTimeline GetStartupTimeline() const;
+    // One line with each stage's offset from boot and from the previous stage
+    void LogStartupTimeline();
+
+    // Keep baud rate, identity, firmware and APN across reboots. The stored profile is
+    // loaded right away and used as a first guess; SetBaudRate() validates it in the
+    // background. `storage` must outlive the modem.
+    void SetBootProfileStorage(EC800BootProfileStorage* storage);
+    EC800BootProfile boot_profile();
+    // Write the profile if it changed since the last save. Called by SetBaudRate() and
+    // WaitForNetworkReady(), never from the receive task.
+    bool SaveBootProfile();
+    void ClearBootProfile();
+    // APN for the PDP context, DEFAULT_APN until set
+    void SetApn(const std::string& apn);
+
+    // Modem-side DNS (AT+QIDNSGIP on context 1) with a TTL cache. Returns the address of
+    // `host`, looking it up if it is not cached, or an empty string on failure. IP literals
+    // come back unchanged. On the receive task only the cache is consulted.
+    std::string Resolve(const std::string& host, int timeout_ms = AT_DNS_RESOLVE_TIMEOUT_MS);
+    // Cached address of `host`, or `host` itself so the modem resolves it while connecting.
+    // Never waits; a missing or expired entry is looked up in the background for next time.
+    std::string ResolveCached(const std::string& host);
+    // Drop the entry of `host`, e.g. after a connect to its cached address failed
+    void InvalidateDns(const std::string& host);
+    // Hosts to look up as soon as the PDP context is up, so the first connects find them cached
+    void SetPreResolveHosts(std::vector<std::string> hosts);
 
     std::string GetImei();
     std::string GetIccid();
@@ -64,44 +403,284 @@ public:
     std::string GetCarrierName();
     int GetCsq();
 
-    const std::string& ip_address() const { return ip_address_; }
+    std::string ip_address() const;
     bool network_ready() const { return network_ready_; }
     int registration_state() const { return registration_state_; }
     int pin_ready() const { return pin_ready_; }
+    size_t rx_buffer_high_water_mark() const { return at_channel_.rx_buffer.high_water_mark(); }
+    size_t rx_buffer_capacity() const { return at_channel_.rx_buffer.capacity(); }
+    size_t rx_overflow_count() const { return rx_overflow_count_; }
+    // UART driver overflows. Each one flushes the input and resyncs the parser, then sends
+    // the pseudo URC "FIFO_OVERFLOW" with one quoted list per EC800ConnectionKind of the ids
+    // known to have lost data, e.g. "1,3","","". No arguments in data mode or CMUX: PPP and
+    // 27.010 frames resync on their own, a transparent socket fails since its stream has a
+    // gap. Other connections only may have missed a "recv" notification.
+    uint32_t fifo_overflow_count() const { return fifo_overflow_count_; }
+    uint32_t buffer_full_count() const { return buffer_full_count_; }
+    uint32_t overflow_damage_count() const { return overflow_damage_count_; }
+    // Whether a FIFO_OVERFLOW notification lists `connection_id` of `kind` as damaged
+    static bool OverflowDamaged(const AtArgumentListEC& arguments, EC800ConnectionKind kind, int connection_id);
+
+    // RTS/CTS on both ends (AT+IFC=2,2), the modem pauses instead of overrunning the FIFO
+    bool EnableHardwareFlowControl(int rts_pin, int cts_pin);
+    bool hardware_flow_control() const { return hardware_flow_control_; }
 
     bool http_connect_flag_ = false;
 private:
+    // Unit tests in test/ drive the parsers directly
+    friend class EC800AtModemTest;
+
+    // One AT command interpreter of the module: the plain UART or a CMUX DLCI. Each has its
+    // own line parser and its own commands in flight; the parser state is only touched by
+    // ReceiveTask().
+    struct AtChannel {
+        AtChannel(int dlci, size_t buffer_size) : dlci(dlci), rx_buffer(buffer_size) {}
+
+        int dlci;
+        EC800RingBuffer rx_buffer;
+        // Drop input up to the next line end, it is the tail of a line cut by an overflow
+        bool discard_line = false;
+        // Transparent data pipe, the line parser is bypassed. The tail that could be the start
+        // of NO CARRIER is held back until more data or the guard time of silence decides.
+        std::atomic<bool> raw{false};
+        size_t raw_held = 0;
+        int64_t raw_receive_time_us = 0;
+        // Written commands waiting for their final result code, oldest first. Results are
+        // matched in order; a command sent with a 0 timeout stays here only to absorb its own.
+        std::mutex in_flight_mutex;
+        std::deque<EC800AtCommandHandle> in_flight;
+        std::atomic<int> in_flight_connection_id{EC800_URC_ANY_ID};
+        std::atomic<bool> in_flight_wants_prompt{false};
+        // Hex payload being streamed
+        std::shared_ptr<EcUrcStreamHandler> stream;
+        bool stream_ok = true;
+        int stream_connection_id = EC800_URC_ANY_ID;
+        EC800ConnectionKind stream_kind = EC800ConnectionKind::Socket;
+        // Length-delimited payload still expected in the stream
+        size_t payload_remaining = 0;
+        int payload_connection_id = EC800_URC_ANY_ID;
+        uint32_t payload_generation = 0;
+        // Pacing of the channel's command task
+        int64_t last_result_time_us = 0;
+        int64_t command_gap_us = AT_COMMAND_GAP_MIN_US;
+        TaskHandle_t command_task = nullptr;
+    };
+
     std::mutex mutex_;
-    std::mutex command_mutex_;
     bool debug_ = true;
     bool network_ready_ = false;
+    // Written by the receive task, read by any caller
+    mutable std::mutex ip_mutex_;
     std::string ip_address_;
     std::string iccid_;
     std::string carrier_name_;
     int csq_ = -1;
     int registration_state_ = 0;
     int pin_ready_ = 0;
+    std::atomic<int64_t> startup_time_us_[EC800_STARTUP_STAGE_COUNT] = {};
 
-    std::string rx_buffer_;
     size_t rx_buffer_size_;
+    // The UART, or DLCI 1 while multiplexing; carries the URCs and the realtime commands
+    AtChannel at_channel_;
+    // DLCI 2 while multiplexing: data mode commands (run by their caller) and the raw pipe
+    std::unique_ptr<AtChannel> data_channel_;
+    // DLCI 3 while multiplexing with three channels or more, see EnableCmux()
+    std::unique_ptr<AtChannel> lane_channel_;
+    size_t rx_overflow_count_ = 0;
+    std::atomic<uint32_t> fifo_overflow_count_{0};
+    std::atomic<uint32_t> buffer_full_count_{0};
+    std::atomic<uint32_t> overflow_damage_count_{0};
+    bool hardware_flow_control_ = false;
     uart_port_t uart_num_;
     int tx_pin_;
     int rx_pin_;
-    int baud_rate_;
-    TaskHandle_t event_task_handle_ = nullptr;
+    std::atomic<int> baud_rate_;
+    // Link quality, see NegotiateBaudRate()
+    std::mutex link_mutex_;
+    std::vector<EC800LinkTestResult> link_tests_;
+    std::atomic<uint32_t> link_error_count_{0};
+    uint32_t window_error_count_ = 0;
+    int64_t error_window_start_us_ = 0;
+    bool baud_fallback_enabled_ = false;
+    std::atomic<bool> baud_fallback_running_{false};
+    std::atomic<uint32_t> consecutive_timeouts_{0};
+    std::atomic<int64_t> last_receive_time_us_{0};
     TaskHandle_t receive_task_handle_ = nullptr;
+    TaskHandle_t defer_task_handle_ = nullptr;
     QueueHandle_t event_queue_handle_ = nullptr;
     EventGroupHandle_t event_group_handle_ = nullptr;
-    std::string last_command_;
-    std::string response_;
 
-    void EventTask();
+    // One queue per AtCommandPriority, drained highest class first by CommandTask(). With
+    // lane_active_ the primary channel takes the realtime class and the lane the others.
+    std::mutex queue_mutex_;
+    std::condition_variable queue_cv_;
+    std::deque<EC800AtCommandHandle> command_queues_[AT_COMMAND_PRIORITY_COUNT];
+    AtCommandQueueStats queue_stats_[AT_COMMAND_PRIORITY_COUNT] = {};
+    int64_t last_realtime_write_us_ = 0;
+    bool lane_active_ = false;
+    // Work queued by Defer(), run by DeferTask()
+    struct DeferredWork {
+        const void* owner;
+        std::function<void()> work;
+    };
+    std::mutex defer_mutex_;
+    std::condition_variable defer_cv_;
+    std::deque<DeferredWork> defer_queue_;
+    const void* defer_running_owner_ = nullptr;
+    bool defer_running_ = false;
+    // Counts module restarts; a queued MODEM_RESET of an older one is dropped. Also the
+    // deferred work owner of the notification.
+    std::atomic<uint32_t> restart_generation_{0};
+    std::atomic<int64_t> reset_time_us_{0};
+    // Transparent data pipe: data_mode_ holds back the command queue, AtChannel::raw bypasses the line parser
+    std::mutex data_mode_mutex_;
+    std::atomic<bool> data_mode_{false};
+    std::atomic<bool> data_mode_requested_{false};
+    // at_channel_, or data_channel_ when the pipe was opened while multiplexing
+    std::atomic<AtChannel*> data_mode_channel_{nullptr};
+    std::atomic<EC800Supervisor*> supervisor_{nullptr};
+    int64_t last_raw_write_us_ = 0;
+    std::mutex raw_callback_mutex_;
+    EcRawDataCallback on_raw_data_;
+    std::function<void()> on_data_mode_closed_;
+    // Multiplexer, created once and kept for the modem's lifetime; cmux_opening_ holds the
+    // command queue until the channels are established
+    std::unique_ptr<EC800Cmux> cmux_;
+    std::atomic<bool> cmux_active_{false};
+    std::atomic<bool> cmux_requested_{false};
+    std::atomic<bool> cmux_opening_{false};
+    // Hints from the last boot, see SetBootProfileStorage()
+    std::mutex profile_mutex_;
+    EC800BootProfile boot_profile_;
+    EC800BootProfileStorage* profile_storage_ = nullptr;
+    bool profile_dirty_ = false;
+    bool profile_validated_ = false;
+    // Last successful setting per Configure() key
+    std::mutex config_mutex_;
+    std::unordered_map<std::string, std::string> config_cache_;
+    std::atomic<uint32_t> config_skip_count_{0};
+    // Free connect ids per EC800ConnectionKind, longest free first
+    std::mutex connection_id_mutex_;
+    std::deque<int> free_connection_ids_[EC800_CONNECTION_KIND_COUNT];
+    // Read scheduler, see RequestRead()
+    struct SocketReads {
+        int weight = 1;
+        size_t depth = 0;
+        // Reads served in the current turn
+        int served = 0;
+        int64_t requested_us = 0;
+        uint32_t reads = 0;
+        uint64_t bytes_read = 0;
+        uint32_t max_wait_us = 0;
+    };
+    std::mutex read_mutex_;
+    std::map<int, SocketReads> socket_reads_;
+    int read_cursor_ = EC800_URC_ANY_ID;
+    bool read_in_flight_ = false;
+    // Length announced by the answer to the AT+QIRD in flight, -1 until it arrives
+    std::atomic<int> read_length_{-1};
+    // DNS lookups run one at a time, the dnsgip URCs do not name the host they answer
+    std::mutex dns_mutex_;
+    std::condition_variable dns_cv_;
+    EC800DnsCache dns_cache_;
+    std::vector<std::string> dns_pre_resolve_;
+    std::deque<std::string> dns_queue_;
+    std::string dns_host_;
+    std::vector<std::string> dns_addresses_;
+    int dns_expected_ = 0;
+    int dns_ttl_s_ = 0;
+    int64_t dns_deadline_us_ = 0;
+    EC800AtStats command_stats_;
+    // When the UART event being parsed was received, only touched by ReceiveTask()
+    int64_t rx_event_time_us_ = 0;
+    bool urc_latency_probe_ = false;
+    // First RX edge since the last burst was parsed, 0 if none yet
+    std::atomic<int64_t> rx_edge_time_us_{0};
+    std::mutex urc_latency_mutex_;
+    AtUrcLatencyStats urc_latency_ = {0, UINT32_MAX, 0, 0};
+
     void ReceiveTask();
-    bool ParseResponse();
-    bool DetectBaudRate();
-    void NotifyCommandResponse(const std::string& command, const std::vector<AtArgumentValueEC>& arguments);
+    void ReadUart();
+    void CommandTask(AtChannel& channel);
+    void DeferTask();
+    void StartCommandTask(AtChannel& channel, const char* name);
+    EC800AtCommandHandle NextCommand(AtChannel& channel);
+    void ExecuteCommand(AtChannel& channel, const EC800AtCommandHandle& command);
+    EC800AtCommandHandle Enqueue(EC800AtCommandHandle handle);
+    bool OnReceiveTask(EC800AtCommand& command);
+    bool ParsePrompt(AtChannel& channel);
+    bool ParsePayload(AtChannel& channel);
+    bool ParseRawData(AtChannel& channel);
+    void DeliverRawData(AtChannel& channel, size_t pending);
+    void CheckNoCarrier(AtChannel& channel);
+    bool ParseStream(AtChannel& channel);
+    bool BeginStream(AtChannel& channel);
+    bool RequestDataMode(const std::string& command, int timeout_ms);
+    bool DataCommand(AtChannel& channel, const std::string& command, int timeout_ms);
+    void LeaveDataMode();
+    bool CommandsHeld() const { return (data_mode_ && !cmux_active_) || cmux_opening_; }
+    int WriteUart(AtChannel& channel, const char* data, size_t length);
+    void FeedAtStream(AtChannel& channel, const char* data, size_t length);
+    void RecoverFromOverflow();
+    void ResetParser(AtChannel& channel, std::string (&damaged)[EC800_CONNECTION_KIND_COUNT]);
+    void NotifyOverflow(AtChannel* channel, const std::string (&damaged)[EC800_CONNECTION_KIND_COUNT]);
+    void DropFullBuffer(AtChannel& channel);
+    void BeginPayload(AtChannel& channel, uint32_t hash, const AtArgumentListEC& arguments);
+    void WriteCommand(AtChannel& channel, const EC800AtCommandHandle& command);
+    void CompleteInFlight(AtChannel& channel, AtCommandResult result, int error_code = -1);
+    void DropInFlight(AtChannel& channel, const EC800AtCommandHandle& command);
+    void SignalPromptInFlight(AtChannel& channel);
+    bool AwaitsSendResult(AtChannel& channel);
+    void AppendResponseLine(AtChannel& channel, std::string_view line, std::string_view verb = std::string_view());
+    bool ParseResponse(AtChannel& channel);
+    // Retries until the module answers, or for timeout_ms if it is not negative
+    bool DetectBaudRate(int timeout_ms = -1);
+    void ForgetModuleState();
+    void NotifyModemReset(uint32_t generation);
+    bool SwitchBaudRate(int baud_rate);
+    EC800LinkTestResult TestLink();
+    void RecordLinkError();
+    void StepDownBaudRate();
+    void ValidateBootProfile();
+    void MarkStartupStage(EC800StartupStage stage);
+    void SetIpAddress(std::string_view address);
+    void UpdateBootProfile(std::string EC800BootProfile::*field, const std::string& value);
+    void AddCapability(uint32_t capability);
+    void RememberBaudRate();
+    void IssueNextRead();
+    int NextReadId();
+    void OnReadComplete(int connection_id, bool ok);
+    void QueueDnsLookup(const std::string& host);
+    bool DnsLookupPending(const std::string& host) const;
+    std::string NextDnsLookup();
+    void SendDnsLookup(const std::string& host);
+    void OnDnsResult(const AtArgumentListEC& arguments);
+    void PreResolve();
+    // `channel` is the one the line was received on, nullptr for pseudo URCs
+    void NotifyCommandResponse(std::string_view command, const AtArgumentListEC& arguments, AtChannel* channel = nullptr);
+    int UrcConnectionId(uint32_t hash, const AtArgumentListEC& arguments, const AtChannel* channel) const;
+    static EC800ConnectionKind UrcConnectionKind(uint32_t hash);
 
     std::list<EcCommandResponseCallback> on_data_received_;
+    std::list<EcCommandResponseViewCallback> on_data_received_view_;
+    EC800UrcRouter urc_router_;
+    struct PayloadSink {
+        uint32_t generation;
+        EcPayloadSink sink;
+    };
+    std::unordered_map<int, PayloadSink> payload_sinks_;
+    uint32_t next_payload_generation_ = 1;
+    struct UrcStream {
+        EC800UrcRouter::HandlerId id;
+        uint32_t hash;
+        std::string urc;
+        std::string type;
+        int connection_id;
+        size_t payload_index;
+        std::shared_ptr<EcUrcStreamHandler> handler;
+    };
+    std::vector<UrcStream> urc_streams_;
+    EC800UrcRouter::HandlerId next_stream_id_ = 1;
     std::function<void()> on_material_ready_;
 };
 
@@ -0,0 +1,55 @@
+#ifndef EC800_AT_STATS_H
+#define EC800_AT_STATS_H
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+#include <mutex>
+
+#include "ec800_at_command.h"
+
+#define AT_STATS_MAX_VERBS 32
+#define AT_STATS_VERB_LENGTH 16
+// Latency buckets: <1ms, <2ms, <4ms ... <4096ms, >=4096ms
+#define AT_STATS_LATENCY_BUCKETS 14
+
+struct AtVerbStats {
+    char verb[AT_STATS_VERB_LENGTH];
+    uint32_t count;
+    uint32_t ok;
+    uint32_t error;
+    uint32_t timeout;
+    uint32_t dropped;
+    // UART write to final result code, completed commands only
+    uint32_t latency_min_us;
+    uint32_t latency_max_us;
+    uint64_t latency_total_us;
+    uint32_t latency_histogram[AT_STATS_LATENCY_BUCKETS];
+
+    // Upper bound of a histogram bucket in milliseconds, 0 for the last (open) bucket
+    static uint32_t BucketLimitMs(size_t bucket) { return bucket + 1 < AT_STATS_LATENCY_BUCKETS ? 1u << bucket : 0; }
+};
+
+// Per-verb command outcome and latency counters, keyed by "QISENDEX" for "AT+QISENDEX=...".
+// Fixed table, one short lock per completed command.
+class EC800AtStats {
+public:
+    EC800AtStats();
+
+    void Record(EC800AtCommand& command);
+    std::vector<AtVerbStats> Snapshot();
+    void Reset();
+
+    // "AT+QIRD=0,1500" -> "QIRD", "ATE0" -> "E0", payload lines -> "DATA"
+    static std::string_view Verb(std::string_view command);
+
+private:
+    std::mutex mutex_;
+    uint32_t hashes_[AT_STATS_MAX_VERBS];
+    AtVerbStats stats_[AT_STATS_MAX_VERBS];
+    size_t size_ = 0;
+
+    AtVerbStats& Find(std::string_view verb);
+};
+
+#endif // EC800_AT_STATS_H
@@ -0,0 +1,73 @@
+#ifndef EC800_BENCHMARK_H
+#define EC800_BENCHMARK_H
+
+#include <cstdint>
+#include <atomic>
+#include <vector>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/event_groups.h>
+
+#include "ec800_at_modem.h"
+
+#ifndef BENCHMARK_TASK_STACK_SIZE
+#define BENCHMARK_TASK_STACK_SIZE 4096
+#endif
+#ifndef BENCHMARK_TASK_PRIORITY
+#define BENCHMARK_TASK_PRIORITY 5
+#endif
+// Bytes per AT+QISEND or raw write of the bulk load
+#define BENCHMARK_BULK_CHUNK_SIZE 1024
+// Command measured against the load, answered by the module without touching the network
+#define BENCHMARK_PROBE_COMMAND "AT+CSQ"
+
+#define BENCHMARK_EVENT_STOP BIT0
+#define BENCHMARK_EVENT_STOPPED BIT1
+
+// Timing of one benchmark run, in microseconds
+struct EC800BenchmarkResult {
+    const char* name = "";
+    uint32_t count = 0;
+    uint32_t failed = 0;
+    uint32_t min_us = UINT32_MAX;
+    uint32_t max_us = 0;
+    uint64_t total_us = 0;
+
+    void Add(uint32_t us);
+    uint32_t average_us() const { return count > 0 ? total_us / count : 0; }
+};
+
+// Measurements on the target, run by hand against a live module. Every run logs its
+// result and returns it; compare runs of one build rather than absolute numbers.
+class EC800Benchmark {
+public:
+    EC800Benchmark(EC800AtModem& modem);
+    ~EC800Benchmark();
+
+    // BENCHMARK_PROBE_COMMAND round trips as the caller sees them, enqueue to result
+    EC800BenchmarkResult CommandLatency(int rounds);
+    // The same while a second task keeps the data path busy: raw writes in data mode,
+    // AT+QISEND on the open socket `connection_id` otherwise. Run it once before and once
+    // after EnableCmux() to see what the separate channels buy.
+    EC800BenchmarkResult CommandLatencyUnderLoad(int connection_id, int rounds);
+    // EC800Hex against the byte-wise codec it replaced, `length` payload bytes per round:
+    // encode, reference encode, decode, reference decode. Runs without the module.
+    std::vector<EC800BenchmarkResult> HexCodec(size_t length, int rounds);
+    // "+..." line to the return of its handlers, timed from the UART event and then from the
+    // RX edge (EnableUrcLatencyProbe(), left enabled). The difference is the driver and the
+    // reader's wake-up. Returns the two results in that order.
+    std::vector<EC800BenchmarkResult> UrcLatency(int rounds);
+
+private:
+    EC800AtModem& modem_;
+    EventGroupHandle_t event_group_handle_;
+    int bulk_connection_id_ = 0;
+    std::atomic<uint32_t> bulk_bytes_{0};
+
+    EC800BenchmarkResult MeasureCommands(const char* name, int rounds);
+    EC800BenchmarkResult MeasureUrcs(const char* name, int rounds);
+    void BulkTask();
+    void Log(const EC800BenchmarkResult& result);
+};
+
+#endif // EC800_BENCHMARK_H
@@ -0,0 +1,73 @@
+#ifndef EC800_BOOT_PROFILE_H
+#define EC800_BOOT_PROFILE_H
+
+#include <cstdint>
+#include <string>
+
+// Bumped whenever the serialized layout changes, older profiles are ignored
+#define EC800_BOOT_PROFILE_VERSION 1
+#define EC800_BOOT_PROFILE_MAX_SIZE 512
+
+// Firmware features that were seen working, cleared when the firmware revision changes
+#define EC800_CAPABILITY_IPR 0x01
+#define EC800_CAPABILITY_CMUX 0x02
+#define EC800_CAPABILITY_HW_FLOW 0x04
+
+// What the last boot learned about the module, so the next one can skip baud rate
+// detection and identity queries. Every field is a hint that is validated lazily.
+struct EC800BootProfile {
+    int baud_rate = 0;
+    std::string imei;
+    std::string iccid;
+    std::string firmware;
+    uint32_t capabilities = 0;
+    std::string apn;
+
+    bool empty() const { return baud_rate == 0 && imei.empty() && iccid.empty() && firmware.empty() && apn.empty(); }
+
+    // "key=value" lines, small enough for one NVS blob
+    std::string Serialize() const;
+    // False on a version mismatch or malformed input, the profile is left unchanged then
+    bool Deserialize(const std::string& data);
+};
+
+// Where the profile is persisted between boots
+class EC800BootProfileStorage {
+public:
+    virtual ~EC800BootProfileStorage() {}
+    virtual bool Load(EC800BootProfile& profile) = 0;
+    virtual bool Save(const EC800BootProfile& profile) = 0;
+    virtual void Erase() = 0;
+};
+
+#ifdef ESP_PLATFORM
+// One blob in an NVS namespace; nvs_flash_init() must have been called
+class EC800NvsProfileStorage : public EC800BootProfileStorage {
+public:
+    EC800NvsProfileStorage(const std::string& name_space = "ec800", const std::string& key = "boot_profile");
+
+    bool Load(EC800BootProfile& profile) override;
+    bool Save(const EC800BootProfile& profile) override;
+    void Erase() override;
+
+private:
+    std::string name_space_;
+    std::string key_;
+};
+#endif
+
+// A plain file, for Linux host builds or a mounted VFS partition. Written to "<path>.tmp"
+// and renamed so a power loss never leaves half a profile.
+class EC800FileProfileStorage : public EC800BootProfileStorage {
+public:
+    EC800FileProfileStorage(const std::string& path);
+
+    bool Load(EC800BootProfile& profile) override;
+    bool Save(const EC800BootProfile& profile) override;
+    void Erase() override;
+
+private:
+    std::string path_;
+};
+
+#endif // EC800_BOOT_PROFILE_H
@@ -0,0 +1,112 @@
+#ifndef EC800_CMUX_H
+#define EC800_CMUX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+
+#include "ec800_cmux_codec.h"
+
+#define EC800_CMUX_CONTROL_DLCI 0
+// Channel carrying the modem's AT commands and URCs
+#define EC800_CMUX_AT_DLCI 1
+// Channel for data mode (PPP, transparent sockets)
+#define EC800_CMUX_DATA_DLCI 2
+// Second AT channel for commands that must not queue behind the data path
+#define EC800_CMUX_LANE_DLCI 3
+#define CMUX_MAX_CHANNELS 4
+// N1 of "AT+CMUX=0", the modem's default maximum information field
+#define CMUX_FRAME_SIZE 127
+#define CMUX_OPEN_TIMEOUT_MS 3000
+#define CMUX_WRITE_TIMEOUT_MS 5000
+// How long the modem gets to answer the close down request
+#define CMUX_CLOSE_TIMEOUT_MS 1000
+
+class EC800Cmux;
+
+// One 27.010 virtual channel (DLCI). Received data goes straight to the receive callback,
+// writes follow the modem's flow control.
+class EC800CmuxChannel {
+public:
+    typedef std::function<void(const char* data, size_t length)> ReceiveCallback;
+
+    EC800CmuxChannel(EC800Cmux& mux, uint8_t dlci);
+
+    uint8_t dlci() const { return dlci_; }
+    bool open() const { return open_; }
+
+    // Split into UIH frames; waits while the modem has flow-stopped the channel.
+    // Returns the bytes written or -1.
+    int Write(const char* data, size_t length, int timeout_ms = CMUX_WRITE_TIMEOUT_MS);
+    // Where received data goes; set before the channel is opened
+    void SetReceiveCallback(ReceiveCallback callback) { on_receive_ = std::move(callback); }
+
+    bool tx_flow_stopped() const { return tx_stopped_; }
+
+private:
+    friend class EC800Cmux;
+
+    EC800Cmux& mux_;
+    uint8_t dlci_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    ReceiveCallback on_receive_;
+    bool open_ = false;
+    // Stopped by the modem (MSC FC)
+    bool tx_stopped_ = false;
+
+    void Receive(const uint8_t* data, size_t length);
+    void SetOpen(bool open);
+    void SetTxStopped(bool stopped);
+};
+
+// 3GPP TS 27.010 basic mode multiplexer on top of the UART, started after AT+CMUX=0.
+// Every channel is written in frames of at most CMUX_FRAME_SIZE bytes, so a short command
+// on one channel waits for at most one frame of bulk data on another.
+class EC800Cmux {
+public:
+    typedef std::function<int(const char* data, size_t length)> Writer;
+
+    EC800Cmux(Writer writer, size_t channel_count);
+
+    // Establish the control channel and every DLCI from 1 to channel_count
+    bool Open();
+    // Multiplexer close down, the modem goes back to plain AT mode. Waits for the modem to
+    // acknowledge it, false if it did not within the timeout.
+    bool Close(int timeout_ms = CMUX_CLOSE_TIMEOUT_MS);
+    // DLCI 1 .. channel_count, or nullptr
+    EC800CmuxChannel* channel(int dlci);
+    size_t channel_count() const { return channels_.size() - 1; }
+
+    // Raw bytes from the UART
+    void Input(const char* data, size_t length);
+    const EC800CmuxCodec& codec() const { return codec_; }
+
+private:
+    friend class EC800CmuxChannel;
+
+    Writer writer_;
+    std::mutex write_mutex_;
+    std::string tx_frame_;
+    EC800CmuxCodec codec_;
+    // Index is the DLCI, 0 is the control channel
+    std::vector<std::unique_ptr<EC800CmuxChannel>> channels_;
+    std::atomic<bool> closed_{false};
+    // FCoff from the modem pauses all channels
+    std::atomic<bool> aggregate_stopped_{false};
+
+    int WriteFrame(uint8_t dlci, uint8_t control, const uint8_t* data, size_t length);
+    void WriteControlMessage(uint8_t type, const uint8_t* values, size_t length);
+    void SendMsc(uint8_t dlci, bool stop);
+    bool OpenDlci(uint8_t dlci);
+    void OnFrame(const EC800CmuxFrame& frame);
+    void OnControlMessage(const uint8_t* data, size_t length);
+};
+
+#endif // EC800_CMUX_H
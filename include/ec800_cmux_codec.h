@@ -0,0 +1,97 @@
+#ifndef EC800_CMUX_CODEC_H
+#define EC800_CMUX_CODEC_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <functional>
+
+// 3GPP TS 27.010 basic option framing
+#define CMUX_FLAG 0xF9
+#define CMUX_EA 0x01
+#define CMUX_CR 0x02
+#define CMUX_PF 0x10
+
+// Frame types, without the P/F bit
+#define CMUX_SABM 0x2F
+#define CMUX_UA 0x63
+#define CMUX_DM 0x0F
+#define CMUX_DISC 0x43
+#define CMUX_UIH 0xEF
+#define CMUX_UI 0x03
+
+// Control channel (DLCI 0) message types, EA set and C/R clear
+#define CMUX_MSG_CLD 0xC1   // multiplexer close down
+#define CMUX_MSG_TEST 0x21
+#define CMUX_MSG_FCON 0xA1  // aggregate flow control
+#define CMUX_MSG_FCOFF 0x61
+#define CMUX_MSG_MSC 0xE1   // modem status command, per DLCI flow control
+#define CMUX_MSG_NSC 0x11
+
+// V.24 signals in MSC, FC set means "stop sending on this DLCI"
+#define CMUX_V24_FC 0x02
+#define CMUX_V24_RTC 0x04
+#define CMUX_V24_RTR 0x08
+#define CMUX_V24_DV 0x80
+
+// Largest information field accepted by the decoder
+#define CMUX_MAX_INFO_SIZE 1536
+
+struct EC800CmuxFrame {
+    uint8_t dlci;
+    uint8_t control;    // with the P/F bit
+    bool command;       // C/R bit of the address field
+    const uint8_t* data;
+    size_t length;
+
+    uint8_t type() const { return control & ~CMUX_PF; }
+};
+
+// 27.010 basic mode frame encoder/decoder, FCS-8 over address, control and length
+// (plus information for non-UIH frames). No ESP-IDF dependencies.
+class EC800CmuxCodec {
+public:
+    typedef std::function<void(const EC800CmuxFrame& frame)> FrameCallback;
+
+    static uint8_t Fcs8(const uint8_t* data, size_t length);
+    // Append one frame; `command` sets C/R for frames sent by the initiator
+    static void Encode(std::string& out, uint8_t dlci, uint8_t control, const uint8_t* data, size_t length, bool command = true);
+
+    void OnFrame(FrameCallback callback) { on_frame_ = std::move(callback); }
+    // Feed received bytes in any split; frames with a good FCS reach OnFrame()
+    void Decode(const uint8_t* data, size_t length);
+    void Reset();
+
+    uint32_t frame_count() const { return frame_count_; }
+    uint32_t fcs_error_count() const { return fcs_error_count_; }
+    uint32_t overrun_count() const { return overrun_count_; }
+
+private:
+    enum class State {
+        Flag,
+        Address,
+        Control,
+        Length,
+        Length2,
+        Data,
+        Fcs,
+        End,
+    };
+
+    FrameCallback on_frame_;
+    State state_ = State::Flag;
+    uint8_t header_[4];
+    size_t header_length_ = 0;
+    size_t length_ = 0;
+    size_t received_ = 0;
+    uint8_t fcs_ = 0;
+    uint8_t data_[CMUX_MAX_INFO_SIZE];
+    uint32_t frame_count_ = 0;
+    uint32_t fcs_error_count_ = 0;
+    uint32_t overrun_count_ = 0;
+
+    void BeginData();
+    void EndFrame();
+};
+
+#endif // EC800_CMUX_CODEC_H
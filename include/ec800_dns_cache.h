@@ -0,0 +1,41 @@
+#ifndef EC800_DNS_CACHE_H
+#define EC800_DNS_CACHE_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+
+// Hosts kept at once, the entry closest to expiry makes room
+#define DNS_CACHE_CAPACITY 16
+// Used when the modem reports no TTL, and the upper bound for the one it reports
+#define DNS_CACHE_DEFAULT_TTL_S 300
+#define DNS_CACHE_MAX_TTL_S 3600
+
+// Answers of the modem's resolver by host name. Not thread safe, the modem guards it.
+class EC800DnsCache {
+public:
+    EC800DnsCache(size_t capacity = DNS_CACHE_CAPACITY);
+
+    // First address of an unexpired entry
+    bool Lookup(const std::string& host, std::string& address) const;
+    // ttl_s <= 0 uses DNS_CACHE_DEFAULT_TTL_S
+    void Store(const std::string& host, std::vector<std::string> addresses, int ttl_s);
+    void Invalidate(const std::string& host);
+    void Clear();
+    size_t size() const { return entries_.size(); }
+
+    // Dotted IPv4 or an IPv6 literal, nothing to resolve
+    static bool IsAddress(std::string_view host);
+
+private:
+    struct Entry {
+        std::vector<std::string> addresses;
+        int64_t expires_us;
+    };
+    size_t capacity_;
+    std::unordered_map<std::string, Entry> entries_;
+};
+
+#endif // EC800_DNS_CACHE_H
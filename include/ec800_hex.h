@@ -0,0 +1,19 @@
+#ifndef EC800_HEX_H
+#define EC800_HEX_H
+
+#include <cstddef>
+
+// Hex codec for the AT payload paths (QISENDEX, QIRD, MQTTURC, MHTTPURC).
+// Lookup tables, 4 bytes per iteration and no per-byte branches; hosts built with SSSE3
+// take 16 bytes per iteration. No ESP-IDF dependencies.
+class EC800Hex {
+public:
+    // Write 2 * length uppercase hex characters to `out`
+    static void Encode(char* out, const char* data, size_t length);
+    // Decode `length` hex characters (either case) into length / 2 bytes. `out` may point
+    // to `hex` for in-place decoding. Returns false for an odd length or a non-hex character,
+    // the output is unspecified then.
+    static bool Decode(char* out, const char* hex, size_t length);
+};
+
+#endif // EC800_HEX_H
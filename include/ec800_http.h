@@ -7,6 +7,7 @@
 #include <freertos/event_groups.h>
 
 #include <map>
+#include <vector>
 #include <string>
 #include <functional>
 #include <mutex>
@@ -43,7 +44,10 @@ private:
     int status_code_ = -1;
     int error_code_ = -1;
     std::string rx_buffer_;
-    std::list<EcCommandResponseCallback>::iterator command_callback_it_;
+    std::vector<EC800UrcRouter::HandlerId> urc_handlers_;
+    // Registered for http_id_ while a session is open
+    std::vector<EC800UrcRouter::HandlerId> session_handlers_;
+    std::vector<EC800UrcRouter::HandlerId> urc_streams_;
     std::map<std::string, std::string> headers_;
     std::string url_;
     std::string method_;
@@ -53,10 +57,17 @@ private:
     std::map<std::string, std::string> response_headers_;
     std::string body_;
     size_t body_offset_ = 0;
+    // Header of the "content" chunk being streamed
+    bool chunk_ours_ = false;
+    int chunk_total_ = 0;
+    int chunk_sum_ = 0;
+    int chunk_length_ = 0;
     size_t content_length_ = 0;
     bool eof_ = false;
     bool connected_ = false;
 
+    void Subscribe();
+    void Unsubscribe();
     void ParseResponseHeaders(const std::string& headers);
     std::string ErrorCodeToString(int error_code);
 };
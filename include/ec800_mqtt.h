@@ -9,6 +9,8 @@
 #include <freertos/event_groups.h>
 #include <string>
 #include <functional>
+#include <vector>
+#include <map>
 
 #define MQTT_CONNECT_TIMEOUT_MS 10000
 
@@ -18,7 +20,8 @@
 
 class EC800Mqtt : public Mqtt {
 public:
-    EC800Mqtt(EC800AtModem& modem, int mqtt_id);
+    // EC800_AUTO_CONNECTION_ID takes a free client index from the modem
+    EC800Mqtt(EC800AtModem& modem, int mqtt_id = EC800_AUTO_CONNECTION_ID);
     ~EC800Mqtt();
 
     bool Connect(const std::string broker_address, int broker_port, const std::string client_id, const std::string username, const std::string password);
@@ -27,6 +30,9 @@ public:
     bool Subscribe(const std::string topic, int qos = 0);
     bool Unsubscribe(const std::string topic);
     bool IsConnected();
+    // Bring the session back after the modem restarted: connect with the last parameters and
+    // subscribe to everything that was subscribed. True if there was nothing to restore.
+    bool Restore();
 
 private:
     EC800AtModem& modem_;
@@ -38,9 +44,15 @@ private:
     std::string client_id_;
     std::string username_;
     std::string password_;
+    std::string message_topic_;
     std::string message_payload_;
+    size_t message_length_ = 0;
+    // Session wanted by the application, kept across modem restarts for Restore()
+    bool session_ = false;
+    std::map<std::string, int> subscriptions_;
 
-    std::list<EcCommandResponseCallback>::iterator command_callback_it_;
+    std::vector<EC800UrcRouter::HandlerId> urc_handlers_;
+    std::vector<EC800UrcRouter::HandlerId> urc_streams_;
 
     std::string ErrorToString(int error_code);
 };
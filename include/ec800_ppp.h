@@ -0,0 +1,64 @@
+#ifndef EC800_PPP_H
+#define EC800_PPP_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <esp_netif.h>
+#include <esp_event.h>
+
+#include <string>
+
+#include "ec800_at_modem.h"
+
+#define EC800_PPP_CONNECTED BIT0
+#define EC800_PPP_DISCONNECTED BIT1
+#define EC800_PPP_TERMINATED BIT2
+
+#define PPP_CONNECT_TIMEOUT_MS 30000
+// How long LCP gets to terminate before the data pipe is closed with +++
+#define PPP_STOP_TIMEOUT_MS 3000
+
+// PPP data session over the EC800 UART, exposed as an esp_netif PPP interface.
+// While it runs, the lwIP stack (sockets, mbedTLS, TcpTransport, EspHttp, EspMqtt ...)
+// talks to the network directly. AT commands fail meanwhile unless CMUX is active, which
+// moves the session to DLCI 2.
+// Not yet run end to end: no LCP negotiation against pppd or a module has exercised this
+// glue, only the data mode it rides on is covered by test/.
+class EC800Ppp {
+public:
+    EC800Ppp(EC800AtModem& modem);
+    ~EC800Ppp();
+
+    // Set the APN (optional), dial ATD*99# and wait until IPCP assigns an address
+    bool Start(const std::string& apn = "", int timeout_ms = PPP_CONNECT_TIMEOUT_MS);
+    // Terminate LCP, leave data mode and hang up; the modem accepts AT commands again
+    void Stop();
+
+    bool connected() const { return connected_; }
+    esp_netif_t* netif() const { return netif_; }
+    const std::string& ip_address() const { return ip_address_; }
+
+private:
+    // esp_netif I/O driver, the handle passed back to Transmit()
+    struct NetifDriver {
+        esp_netif_driver_base_t base;
+        EC800Ppp* ppp;
+    };
+
+    EC800AtModem& modem_;
+    EventGroupHandle_t event_group_handle_;
+    esp_netif_t* netif_ = nullptr;
+    NetifDriver driver_ = {};
+    esp_event_handler_instance_t ip_event_handler_ = nullptr;
+    esp_event_handler_instance_t ppp_event_handler_ = nullptr;
+    bool connected_ = false;
+    std::string ip_address_;
+
+    bool CreateNetif();
+    static esp_err_t PostAttach(esp_netif_t* netif, esp_netif_iodriver_handle args);
+    static esp_err_t Transmit(void* handle, void* buffer, size_t length);
+    static void OnIpEvent(void* arg, esp_event_base_t base, int32_t event_id, void* event_data);
+    static void OnPppEvent(void* arg, esp_event_base_t base, int32_t event_id, void* event_data);
+};
+
+#endif // EC800_PPP_H
@@ -0,0 +1,43 @@
+#ifndef EC800_RECONNECTOR_H
+#define EC800_RECONNECTOR_H
+
+#include <string>
+#include <functional>
+
+#include "ec800_at_modem.h"
+
+// Brings a socket back after the module restarted under it. Remembers the last Connect()
+// target, notes the restart on MODEM_RESET and connects again when the supervisor restores
+// sessions, unless the application disconnected in between.
+class EC800Reconnector {
+public:
+    typedef std::function<bool(const std::string& host, int port)> ConnectFunction;
+
+    // `on_reset` drops the connection's state and returns whether it was connected
+    EC800Reconnector(EC800AtModem& modem, std::function<bool()> on_reset, ConnectFunction connect);
+    ~EC800Reconnector();
+
+    // Subscribe to MODEM_RESET and register with the supervisor, if there is one
+    void Start();
+    // Undo Start(); call it first in the owner's destructor, the callbacks use the owner
+    void Stop();
+
+    // From Connect(), and from Disconnect() which means there is nothing to restore
+    void Remember(const std::string& host, int port);
+    void Forget() { pending_ = false; }
+    // True if there was nothing to restore
+    bool Restore();
+
+private:
+    EC800AtModem& modem_;
+    std::function<bool()> on_reset_;
+    ConnectFunction connect_;
+    std::string host_;
+    int port_ = 0;
+    // The module restarted under a connection
+    bool pending_ = false;
+    bool started_ = false;
+    EC800UrcRouter::HandlerId urc_handler_ = 0;
+};
+
+#endif // EC800_RECONNECTOR_H
@@ -0,0 +1,51 @@
+#ifndef EC800_RING_BUFFER_H
+#define EC800_RING_BUFFER_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Fixed-capacity receive buffer for the AT stream.
+// The UART driver writes straight into WritePointer()/Commit(), the parser finds
+// lines with FindLineEnd() and releases them with Consume(). No heap traffic after
+// construction.
+class EC800RingBuffer {
+public:
+    explicit EC800RingBuffer(size_t capacity);
+
+    size_t capacity() const { return buffer_.size(); }
+    size_t size() const { return size_; }
+    size_t free_space() const { return buffer_.size() - size_; }
+    bool empty() const { return size_ == 0; }
+    bool full() const { return size_ == buffer_.size(); }
+    size_t high_water_mark() const { return high_water_mark_; }
+    void ResetHighWaterMark() { high_water_mark_ = size_; }
+
+    // Largest contiguous free region, to be filled and then committed
+    char* WritePointer(size_t* length);
+    void Commit(size_t length);
+    size_t Write(const char* data, size_t length);
+
+    // Largest contiguous readable region from the read position
+    const char* ReadPointer(size_t* length) const;
+    char At(size_t offset) const { return buffer_[(head_ + offset) % buffer_.size()]; }
+    // Make the first `length` bytes contiguous and return a pointer to them
+    const char* Linearize(size_t length);
+    void Consume(size_t length);
+    void Clear();
+
+    // Offset of the next "\r\n" from the read position, or npos.
+    // Bytes already scanned are not looked at again on the next call.
+    size_t FindLineEnd();
+
+    static constexpr size_t npos = std::string::npos;
+
+private:
+    std::vector<char> buffer_;
+    size_t head_ = 0;
+    size_t size_ = 0;
+    size_t scan_offset_ = 0;
+    size_t high_water_mark_ = 0;
+};
+
+#endif // EC800_RING_BUFFER_H
@@ -7,9 +7,11 @@
 #include <freertos/event_groups.h>
 #include "transport.h"
 #include "ec800_at_modem.h"
+#include "ec800_reconnector.h"
 
 #include <mutex>
 #include <string>
+#include <vector>
 
 #define EC800_SSL_TRANSPORT_CONNECTED BIT0
 #define EC800_SSL_TRANSPORT_DISCONNECTED BIT1
@@ -22,7 +24,8 @@
 
 class EC800SslTransport : public Transport {
 public:
-    EC800SslTransport(EC800AtModem& modem, int tcp_id);
+    // EC800_AUTO_CONNECTION_ID takes a free id from the modem
+    EC800SslTransport(EC800AtModem& modem, int tcp_id = EC800_AUTO_CONNECTION_ID);
     ~EC800SslTransport();
 
     bool Connect(const char* host, int port) override;
@@ -30,13 +33,31 @@ public:
     int Send(const char* data, size_t length) override;
     int Receive(char* buffer, size_t bufferSize) override;
 
+    // Binary by default, Hex falls back to AT+QISENDEX
+    void SetSendMode(EC800SendMode mode);
+    // DirectPush by default, takes effect on the next Connect()
+    void SetReceiveMode(EC800ReceiveMode mode);
+    // Connect again with the last host and port if the modem restarted while connected and
+    // the application did not disconnect since. True if there was nothing to restore.
+    bool Restore();
+
 private:
     std::mutex mutex_;
     EC800AtModem& modem_;
     EventGroupHandle_t event_group_handle_;
     int tcp_id_ = 0;
+    uint32_t payload_generation_ = 0;
+    EC800SendMode send_mode_ = EC800SendMode::Binary;
+    EC800ReceiveMode receive_mode_ = EC800ReceiveMode::DirectPush;
     std::string rx_buffer_;
-    std::list<EcCommandResponseCallback>::iterator command_callback_it_;
+    std::vector<EC800UrcRouter::HandlerId> urc_handlers_;
+    std::vector<EC800UrcRouter::HandlerId> urc_streams_;
+    EC800Reconnector reconnector_;
+
+    int SendHex(const char* data, size_t length);
+    void OpenPayloadSink();
+    // MODEM_RESET: true if a connection was lost
+    bool OnModemReset();
 };
 
 #endif // EC800_SSL_TRANSPORT_H
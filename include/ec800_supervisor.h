@@ -0,0 +1,114 @@
+#ifndef EC800_SUPERVISOR_H
+#define EC800_SUPERVISOR_H
+
+#include <cstdint>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/event_groups.h>
+
+#include "ec800_at_modem.h"
+
+#ifndef SUPERVISOR_TASK_STACK_SIZE
+#define SUPERVISOR_TASK_STACK_SIZE 4096
+#endif
+#ifndef SUPERVISOR_TASK_PRIORITY
+#define SUPERVISOR_TASK_PRIORITY 4
+#endif
+#define SUPERVISOR_CHECK_MS 1000
+// Commands timing out in a row before the module counts as hung
+#define SUPERVISOR_TIMEOUT_THRESHOLD 3
+// A UART silent for this long is probed, quiet links are normal otherwise
+#define SUPERVISOR_SILENCE_MS 60000
+#define SUPERVISOR_PROBE_ATTEMPTS 3
+#define SUPERVISOR_PROBE_TIMEOUT_MS 1000
+// ATO after probing a data pipe with the escape sequence
+#define SUPERVISOR_RESUME_TIMEOUT_MS 5000
+// Time a restarted module gets to answer AT, and to attach again
+#define SUPERVISOR_BOOT_TIMEOUT_MS 20000
+#define SUPERVISOR_ATTACH_TIMEOUT_MS 180000
+// Wait after a failed recovery before the next attempt
+#define SUPERVISOR_RETRY_MS 30000
+
+#define SUPERVISOR_EVENT_TRIGGER BIT0
+#define SUPERVISOR_EVENT_STOP BIT1
+#define SUPERVISOR_EVENT_STOPPED BIT2
+
+// How far a recovery had to escalate
+enum class EC800RecoveryLevel {
+    None,
+    Probe,      // AT answered again, nothing was lost
+    Reset,      // module restarted, but it did not attach again
+    Reattach,   // module restarted, attached and sessions restored
+};
+
+struct EC800RecoveryStats {
+    // Hangs detected, and how each one ended
+    uint32_t incidents;
+    uint32_t probe_recoveries;
+    uint32_t resets;
+    uint32_t hard_resets;
+    uint32_t reattaches;
+    uint32_t failures;
+    // Restore handlers that returned false
+    uint32_t restore_failures;
+    EC800RecoveryLevel last_level;
+    // Detection to working again, sessions restored included
+    int64_t last_recovery_us;
+    int64_t max_recovery_us;
+    int64_t total_recovery_us;
+};
+
+// Watches the modem for stuck commands and escalates: an AT probe, then a restart (AT, or
+// `hard_reset` pulsing the reset / power key line when AT gets no answer), then a full
+// re-attach after which the registered owners restore their sessions. Attaches itself to
+// the modem; sockets, transports and MQTT clients created afterwards register themselves.
+// In data mode no commands run, so a silent pipe is probed with +++ and ATO, and a pipe
+// owner whose own timeouts expire (PPP LCP echoes) calls Trigger().
+class EC800Supervisor {
+public:
+    EC800Supervisor(EC800AtModem& modem, std::function<void()> hard_reset = nullptr);
+    ~EC800Supervisor();
+
+    void Start();
+    void Stop();
+    // Recover now, e.g. when a caller saw its own commands fail
+    void Trigger();
+    // Called in registration order after a re-attach, on the supervisor task. Connections
+    // register their own Restore() when created after the supervisor. Return false
+    // if the session could not be brought back. Remove it before the owner goes away;
+    // handlers must not add or remove handlers themselves.
+    void AddRestoreHandler(const void* owner, std::function<bool()> restore);
+    void RemoveRestoreHandler(const void* owner);
+
+    EC800RecoveryStats GetStats();
+    bool recovering() const { return recovering_; }
+
+private:
+    struct RestoreHandler {
+        const void* owner;
+        std::function<bool()> restore;
+    };
+
+    EC800AtModem& modem_;
+    std::function<void()> hard_reset_;
+    EventGroupHandle_t event_group_handle_;
+    TaskHandle_t task_handle_ = nullptr;
+    std::mutex mutex_;
+    std::vector<RestoreHandler> restore_handlers_;
+    std::mutex stats_mutex_;
+    EC800RecoveryStats stats_ = {};
+    std::atomic<bool> recovering_{false};
+    int64_t next_attempt_us_ = 0;
+
+    void Task();
+    bool Probe();
+    // `probed`: Probe() just failed, go straight to the restart
+    void Recover(bool probed);
+    EC800RecoveryLevel Escalate(bool probed);
+};
+
+#endif // EC800_SUPERVISOR_H
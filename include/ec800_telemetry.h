@@ -0,0 +1,90 @@
+#ifndef EC800_TELEMETRY_H
+#define EC800_TELEMETRY_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <esp_timer.h>
+
+#include "ec800_at_modem.h"
+
+// How often stale fields are looked for
+#define TELEMETRY_TICK_MS 1000
+#define TELEMETRY_CSQ_TTL_MS 10000
+#define TELEMETRY_SERVING_CELL_TTL_MS 10000
+#define TELEMETRY_OPERATOR_TTL_MS 60000
+#define TELEMETRY_REGISTRATION_TTL_MS 30000
+
+// Groups of values refreshed by one command each
+enum class EC800TelemetryField {
+    Csq,            // AT+CSQ, +QIND: "csq"
+    ServingCell,    // AT+QENG="servingcell"
+    Operator,       // AT+COPS?
+    Registration,   // AT+CEREG?, +CEREG
+};
+
+#define EC800_TELEMETRY_FIELD_COUNT 4
+
+// Values as last reported by the modem. Each group carries the esp_timer time it was
+// updated at, 0 if it never was.
+struct EC800TelemetrySnapshot {
+    int csq = 99;
+    int ber = 99;
+    // Serving LTE cell, dBm / dB
+    int rsrp = 0;
+    int rsrq = 0;
+    int sinr = 0;
+    int pci = -1;
+    int earfcn = -1;
+    int band = -1;
+    std::string operator_name;
+    int registration_state = 0;
+    // From CEREG (with AT+CEREG=2) or QENG
+    uint32_t cell_id = 0;
+    uint32_t tac = 0;
+    int64_t update_time_us[EC800_TELEMETRY_FIELD_COUNT] = {};
+
+    int64_t updated_at(EC800TelemetryField field) const { return update_time_us[(int)field]; }
+};
+
+// Modem telemetry for dashboards. Values come from URCs and from low priority background
+// polls of whatever is older than its TTL; readers get an immutable snapshot without
+// touching the UART or waiting for the receive task.
+class EC800Telemetry {
+public:
+    EC800Telemetry(EC800AtModem& modem);
+    ~EC800Telemetry();
+
+    // Enable the unsolicited indications and start the background refresh
+    void Start();
+    void Stop();
+    void SetTtl(EC800TelemetryField field, int ttl_ms);
+
+    std::shared_ptr<const EC800TelemetrySnapshot> snapshot() const;
+    // Updated within its TTL
+    bool IsFresh(EC800TelemetryField field) const;
+    int csq() const { return snapshot()->csq; }
+    std::string operator_name() const { return snapshot()->operator_name; }
+
+private:
+    EC800AtModem& modem_;
+    std::vector<EC800UrcRouter::HandlerId> urc_handlers_;
+    // Readers load it atomically, writers publish a modified copy under update_mutex_
+    std::shared_ptr<const EC800TelemetrySnapshot> snapshot_;
+    std::mutex update_mutex_;
+    int ttl_ms_[EC800_TELEMETRY_FIELD_COUNT] = {
+        TELEMETRY_CSQ_TTL_MS, TELEMETRY_SERVING_CELL_TTL_MS, TELEMETRY_OPERATOR_TTL_MS, TELEMETRY_REGISTRATION_TTL_MS
+    };
+    // Poll in flight per field, a new one is only queued once it is done
+    std::mutex refresh_mutex_;
+    EC800AtCommandHandle refresh_[EC800_TELEMETRY_FIELD_COUNT];
+    esp_timer_handle_t timer_ = nullptr;
+
+    template <typename Function>
+    void Update(EC800TelemetryField field, Function update);
+    void Refresh();
+};
+
+#endif // EC800_TELEMETRY_H
@@ -0,0 +1,56 @@
+#ifndef EC800_TRANSPARENT_TRANSPORT_H
+#define EC800_TRANSPARENT_TRANSPORT_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include "transport.h"
+#include "ec800_at_modem.h"
+#include "ec800_reconnector.h"
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define EC800_TRANSPARENT_TRANSPORT_DISCONNECTED BIT1
+#define EC800_TRANSPARENT_TRANSPORT_ERROR BIT2
+#define EC800_TRANSPARENT_TRANSPORT_RECEIVE BIT3
+
+#define TRANSPARENT_CONNECT_TIMEOUT_MS 15000
+
+// TCP socket in transparent access mode (QIOPEN access mode 2). The UART becomes a raw
+// byte pipe while connected: no hex, no per-segment commands, no URCs. Only one such
+// connection can exist, and other AT commands wait until Suspend() or Disconnect().
+class EC800TransparentTransport : public Transport {
+public:
+    // EC800_AUTO_CONNECTION_ID takes a free id from the modem
+    EC800TransparentTransport(EC800AtModem& modem, int tcp_id = EC800_AUTO_CONNECTION_ID);
+    ~EC800TransparentTransport();
+
+    bool Connect(const char* host, int port) override;
+    void Disconnect() override;
+    int Send(const char* data, size_t length) override;
+    int Receive(char* buffer, size_t bufferSize) override;
+
+    // Back to command mode with the socket kept open, and into the pipe again with ATO
+    bool Suspend();
+    bool Resume();
+    // Connect again with the last host and port if the modem restarted while connected and
+    // the application did not disconnect since. True if there was nothing to restore.
+    bool Restore();
+
+private:
+    std::mutex mutex_;
+    EC800AtModem& modem_;
+    EventGroupHandle_t event_group_handle_;
+    int tcp_id_ = 0;
+    // QIOPEN was sent and QICLOSE not yet, also after the peer closed
+    bool opened_ = false;
+    std::string rx_buffer_;
+    std::vector<EC800UrcRouter::HandlerId> urc_handlers_;
+    EC800Reconnector reconnector_;
+
+    // MODEM_RESET: true if a connection was lost
+    bool OnModemReset();
+};
+
+#endif // EC800_TRANSPARENT_TRANSPORT_H
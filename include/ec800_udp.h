@@ -3,9 +3,11 @@
 
 #include "udp.h"
 #include "ec800_at_modem.h"
+#include "ec800_reconnector.h"
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
+#include <vector>
 
 #define EC800_UDP_CONNECTED BIT0
 #define EC800_UDP_DISCONNECTED BIT1
@@ -18,18 +20,36 @@
 
 class EC800Udp : public Udp {
 public:
-    EC800Udp(EC800AtModem& modem, int udp_id);
+    // EC800_AUTO_CONNECTION_ID takes a free id from the modem
+    EC800Udp(EC800AtModem& modem, int udp_id = EC800_AUTO_CONNECTION_ID);
     ~EC800Udp();
 
     bool Connect(const std::string& host, int port) override;
     void Disconnect() override;
     int Send(const std::string& data) override;
 
+    // Binary by default, Hex falls back to AT+QISENDEX
+    void SetSendMode(EC800SendMode mode);
+    // DirectPush by default, takes effect on the next Connect()
+    void SetReceiveMode(EC800ReceiveMode mode);
+    // Connect again with the last host and port if the modem restarted while connected and
+    // the application did not disconnect since. True if there was nothing to restore.
+    bool Restore();
+
 private:
     EC800AtModem& modem_;
     int udp_id_;
+    uint32_t payload_generation_ = 0;
+    EC800SendMode send_mode_ = EC800SendMode::Binary;
+    EC800ReceiveMode receive_mode_ = EC800ReceiveMode::DirectPush;
+    std::string datagram_;
     EventGroupHandle_t event_group_handle_;
-    std::list<EcCommandResponseCallback>::iterator command_callback_it_;
+    std::vector<EC800UrcRouter::HandlerId> urc_handlers_;
+    EC800Reconnector reconnector_;
+
+    void OpenPayloadSink();
+    // MODEM_RESET: true if a connection was lost
+    bool OnModemReset();
 };
 
 #endif // EC800_UDP_H
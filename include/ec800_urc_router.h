@@ -0,0 +1,69 @@
+#ifndef EC800_URC_ROUTER_H
+#define EC800_URC_ROUTER_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "ec800_at_arguments.h"
+
+#define EC800_URC_ANY_ID (-1)
+
+// Zero-copy variant: command and arguments view the receive buffer and are only valid during the call
+typedef std::function<void(std::string_view command, const AtArgumentListEC& arguments)> EcCommandResponseViewCallback;
+
+// Incremental consumer for a hex payload that ends a URC line (+QIRD, +MQTTURC "publish" ...).
+// The payload is decoded while the line is still arriving and never buffered as a whole.
+struct EcUrcStreamHandler {
+    // Arguments before the payload, views valid during the call only
+    std::function<void(const AtArgumentListEC& header)> begin;
+    // Decoded payload bytes
+    std::function<void(const char* data, size_t length)> data;
+    // End of the line; false if the payload was not valid hex
+    std::function<void(bool ok)> end;
+};
+
+// FNV-1a, usable in case labels: switch (EcUrcHash(command)) { case EcUrcHash("CSQ"): ... }
+constexpr uint32_t EcUrcHash(std::string_view name) {
+    uint32_t hash = 2166136261u;
+    for (char c : name) {
+        hash = (hash ^ (uint8_t)c) * 16777619u;
+    }
+    return hash;
+}
+
+// Routes "+XXX:" lines to the handlers subscribed to that name and connection id.
+// Not thread safe, EC800AtModem guards it with its own mutex.
+class EC800UrcRouter {
+public:
+    typedef uint32_t HandlerId;
+
+    HandlerId Register(std::string_view urc, int connection_id, EcCommandResponseViewCallback handler);
+    void Unregister(HandlerId id);
+
+    // Calls the handlers for (urc, connection_id) and the ones registered with EC800_URC_ANY_ID.
+    // Returns the number of handlers called.
+    size_t Dispatch(uint32_t hash, std::string_view urc, int connection_id, const AtArgumentListEC& arguments);
+    // Copies of the handlers Dispatch() would call, to call them without holding the lock
+    std::vector<EcCommandResponseViewCallback> Handlers(uint32_t hash, std::string_view urc, int connection_id) const;
+
+private:
+    struct Route {
+        HandlerId id;
+        std::string urc;
+        EcCommandResponseViewCallback handler;
+    };
+
+    static uint64_t Key(uint32_t hash, int connection_id) {
+        return ((uint64_t)hash << 32) | (uint32_t)connection_id;
+    }
+    size_t DispatchKey(uint64_t key, std::string_view urc, const AtArgumentListEC& arguments);
+
+    std::unordered_multimap<uint64_t, Route> routes_;
+    HandlerId next_id_ = 1;
+};
+
+#endif // EC800_URC_ROUTER_H
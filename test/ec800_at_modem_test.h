@@ -0,0 +1,68 @@
+#ifndef EC800_AT_MODEM_TEST_H
+#define EC800_AT_MODEM_TEST_H
+
+#include <string>
+#include <functional>
+
+#include "ec800_at_modem.h"
+
+// Feeds bytes to the parser of the AT channel the way the receive task would, so the
+// parsers can be tested without a module on the UART
+class EC800AtModemTest {
+public:
+    EC800AtModemTest(EC800AtModem& modem) : modem_(modem) {}
+
+    void Feed(const std::string& data) {
+        auto& channel = modem_.at_channel_;
+        size_t offset = 0;
+        while (offset < data.size()) {
+            offset += channel.rx_buffer.Write(data.data() + offset, data.size() - offset);
+            while (modem_.ParseResponse(channel)) {}
+        }
+    }
+
+    // Transparent data mode on the AT channel
+    void EnterRawMode(EcRawDataCallback on_data, std::function<void()> on_closed) {
+        auto& channel = modem_.at_channel_;
+        modem_.on_raw_data_ = std::move(on_data);
+        modem_.on_data_mode_closed_ = std::move(on_closed);
+        modem_.data_mode_ = true;
+        channel.raw = true;
+        modem_.data_mode_channel_ = &channel;
+    }
+
+    // As if the guard time passed in silence since the last bytes
+    void ExpireGuardTime() {
+        auto& channel = modem_.at_channel_;
+        channel.raw_receive_time_us -= (AT_DATA_MODE_GUARD_MS + 1) * 1000LL;
+        modem_.CheckNoCarrier(channel);
+    }
+
+    // As if the module reported that it booted
+    void ForgetModuleState() { modem_.ForgetModuleState(); }
+
+    // Run the work Defer() queued on the calling thread, and wait for work the deferred work
+    // task took meanwhile
+    void FlushDeferred() {
+        while (true) {
+            EC800AtModem::DeferredWork item;
+            {
+                std::unique_lock<std::mutex> lock(modem_.defer_mutex_);
+                if (modem_.defer_queue_.empty()) {
+                    modem_.defer_cv_.wait(lock, [this] { return !modem_.defer_running_; });
+                    return;
+                }
+                item = std::move(modem_.defer_queue_.front());
+                modem_.defer_queue_.pop_front();
+            }
+            item.work();
+        }
+    }
+
+    size_t raw_held() const { return modem_.at_channel_.raw_held; }
+
+private:
+    EC800AtModem& modem_;
+};
+
+#endif // EC800_AT_MODEM_TEST_H
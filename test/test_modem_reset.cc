@@ -0,0 +1,29 @@
+#include <unity.h>
+#include <atomic>
+
+#include "ec800_at_modem_test.h"
+
+TEST_CASE("MODEM_RESET is sent once per restart, without the modem's lock", "[ec800][reset]")
+{
+    EC800AtModem modem;
+    EC800AtModemTest test(modem);
+    std::atomic<int> resets{0};
+    auto id = modem.RegisterUrcHandler("MODEM_RESET", EC800_URC_ANY_ID, [&](std::string_view command, const AtArgumentListEC& arguments) {
+        // Needs the lock URC dispatch holds
+        modem.UnregisterUrcHandler(modem.RegisterUrcHandler("CSQ", EC800_URC_ANY_ID, nullptr));
+        resets++;
+    });
+
+    // The boot message that follows belongs to the same restart
+    modem.Reset();
+    test.Feed("\r\nRDY\r\n");
+    test.FlushDeferred();
+    TEST_ASSERT_EQUAL(1, resets.load());
+
+    // One the module did on its own
+    test.Feed("\r\nRDY\r\n");
+    test.FlushDeferred();
+    TEST_ASSERT_EQUAL(2, resets.load());
+
+    modem.UnregisterUrcHandler(id);
+}
@@ -0,0 +1,61 @@
+#include <unity.h>
+#include <string>
+
+#include "ec800_at_modem_test.h"
+
+TEST_CASE("raw payload ending in CRLF is delivered after the guard time", "[ec800][raw]")
+{
+    EC800AtModem modem;
+    EC800AtModemTest test(modem);
+    std::string received;
+    bool closed = false;
+    test.EnterRawMode([&](const char* data, size_t length) { received.append(data, length); }, [&]() { closed = true; });
+
+    test.Feed("HTTP/1.1 200 OK\r\n");
+    TEST_ASSERT_EQUAL_STRING("HTTP/1.1 200 OK", received.c_str());
+    TEST_ASSERT_EQUAL(2, test.raw_held());
+
+    test.ExpireGuardTime();
+    TEST_ASSERT_EQUAL_STRING("HTTP/1.1 200 OK\r\n", received.c_str());
+    TEST_ASSERT_EQUAL(0, test.raw_held());
+    TEST_ASSERT_FALSE(closed);
+    TEST_ASSERT_TRUE(modem.data_mode());
+}
+
+TEST_CASE("NO CARRIER closes data mode only when complete and followed by silence", "[ec800][raw]")
+{
+    EC800AtModem modem;
+    EC800AtModemTest test(modem);
+    std::string received;
+    bool closed = false;
+    test.EnterRawMode([&](const char* data, size_t length) { received.append(data, length); }, [&]() { closed = true; });
+
+    // The sequence inside the payload is payload
+    test.Feed("abc\r\nNO CARRIER\r\n");
+    test.Feed("xyz");
+    TEST_ASSERT_EQUAL_STRING("abc\r\nNO CARRIER\r\nxyz", received.c_str());
+    TEST_ASSERT_FALSE(closed);
+
+    test.Feed("\r\nNO CAR");
+    TEST_ASSERT_EQUAL(8, test.raw_held());
+    test.Feed("RIER\r\n");
+    TEST_ASSERT_EQUAL(14, test.raw_held());
+    test.ExpireGuardTime();
+    TEST_ASSERT_TRUE(closed);
+    TEST_ASSERT_FALSE(modem.data_mode());
+    TEST_ASSERT_EQUAL_STRING("abc\r\nNO CARRIER\r\nxyz", received.c_str());
+}
+
+TEST_CASE("a module restart leaves data mode", "[ec800][raw]")
+{
+    EC800AtModem modem;
+    EC800AtModemTest test(modem);
+    std::string received;
+    test.EnterRawMode([&](const char* data, size_t length) { received.append(data, length); }, nullptr);
+
+    test.ForgetModuleState();
+    TEST_ASSERT_FALSE(modem.data_mode());
+    // Lines are parsed again, not handed to the pipe
+    test.Feed("\r\nRDY\r\n");
+    TEST_ASSERT_EQUAL_STRING("", received.c_str());
+}
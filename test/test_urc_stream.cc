@@ -0,0 +1,37 @@
+#include <unity.h>
+#include <string>
+
+#include "ec800_at_modem_test.h"
+
+TEST_CASE("streamed URC header that wraps the receive ring", "[ec800][stream]")
+{
+    EC800AtModem modem;
+    EC800AtModemTest test(modem);
+    int other_begins = 0;
+    std::string type;
+    std::string received;
+    bool ok = false;
+
+    EcUrcStreamHandler other;
+    other.begin = [&](const AtArgumentListEC& header) { other_begins++; };
+    modem.RegisterUrcStream("QTEST", "a", EC800_URC_ANY_ID, 2, std::move(other));
+    EcUrcStreamHandler handler;
+    handler.begin = [&](const AtArgumentListEC& header) { type = std::string(header[0].string_value()); };
+    handler.data = [&](const char* data, size_t length) { received.append(data, length); };
+    handler.end = [&](bool result) { ok = result; };
+    modem.RegisterUrcStream("QTEST", "b", EC800_URC_ANY_ID, 2, std::move(handler));
+
+    // Empty lines move the read position to where "+QTEST: " just fits, so the name is
+    // contiguous but the header wraps and the first candidate stream linearizes it
+    std::string data;
+    while (data.size() + 8 < modem.rx_buffer_capacity()) {
+        data += "\r\n";
+    }
+    data += "+QTEST: \"b\",1,\"414243\"\r\n";
+    test.Feed(data);
+
+    TEST_ASSERT_EQUAL(0, other_begins);
+    TEST_ASSERT_EQUAL_STRING("b", type.c_str());
+    TEST_ASSERT_EQUAL_STRING("ABC", received.c_str());
+    TEST_ASSERT_TRUE(ok);
+}